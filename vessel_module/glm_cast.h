@@ -3,6 +3,10 @@
 
 #include <glm/gtc/type_ptr.hpp>
 
+#include <cstring>
+#include <span>
+#include <vector>
+
 namespace PYBIND11_NAMESPACE { namespace detail {
 
 template<typename T, glm::precision P>
@@ -52,4 +56,108 @@ struct type_caster<glm::tvec3<T, P>>
     }
 };
 
+
+/*
+ * point lists as (N, 3) arrays
+ * -> load: C-contiguous (N, 3) float32/float64 arrays (other inputs, e.g. lists of points, only in convert mode)
+ *          are converted by numpy at most once and copied with a single memcpy
+ * -> cast: one (N, 3) array; temporaries are moved into the array (no copy)
+ */
+template<typename T, glm::precision P>
+struct vec3_array
+{
+    using vector_type = glm::tvec3<T, P>;
+    using array_type = array_t<T, array::c_style | array::forcecast>;
+
+    static_assert(sizeof(vector_type) == 3 * sizeof(T), "glm::vec3 is expected to be tightly packed");
+
+    /* (N, 3) array of scalar type T (converted if necessary); false if src is not compatible */
+    static bool ensure(handle src, bool convert, array_type& result)
+    {
+        if(!convert && !array_type::check_(src)) { return false; }
+
+        auto buf = array_type::ensure(src);
+        if(!buf) { return false; }
+
+        if((buf.ndim() == 2 && buf.shape(1) == 3) || (buf.ndim() == 1 && buf.shape(0) == 0))
+        {
+            result = std::move(buf);
+            return true;
+        }
+        return false;
+    }
+
+    static std::size_t count(const array_type& buf)
+    {
+        return buf.ndim() == 2 ? static_cast<std::size_t>(buf.shape(0)) : 0;
+    }
+
+    static handle copy(const vector_type* data, std::size_t n)
+    {
+        array_type result({static_cast<ssize_t>(n), ssize_t(3)});
+        if(n > 0) { std::memcpy(result.mutable_data(), data, n * sizeof(vector_type)); }
+        return result.release();
+    }
+};
+
+template<typename T, glm::precision P, typename Alloc>
+struct type_caster<std::vector<glm::tvec3<T, P>, Alloc>>
+{
+    using vector_type = glm::tvec3<T, P>;
+    using list_type = std::vector<vector_type, Alloc>;
+    using helper = vec3_array<T, P>;
+
+    PYBIND11_TYPE_CASTER(list_type, const_name("numpy.ndarray[N, 3]"));
+
+    bool load(handle src, bool convert)
+    {
+        typename helper::array_type buf;
+        if(!helper::ensure(src, convert, buf)) { return false; }
+
+        value.resize(helper::count(buf));
+        if(!value.empty()) { std::memcpy(value.data(), buf.data(), value.size() * sizeof(vector_type)); }
+        return true;
+    }
+
+    static handle cast(const list_type& src, return_value_policy /* policy */, handle /* parent */)
+    {
+        return helper::copy(src.data(), src.size());
+    }
+
+    static handle cast(list_type&& src, return_value_policy /* policy */, handle /* parent */)
+    {
+        auto* owner = new list_type(std::move(src));
+        capsule free(owner, [](void* ptr) { delete static_cast<list_type*>(ptr); });
+
+        return typename helper::array_type({static_cast<ssize_t>(owner->size()), ssize_t(3)}, reinterpret_cast<const T*>(owner->data()), free).release();
+    }
+};
+
+/* views the (converted) array; the caster keeps it alive for the duration of the call */
+template<typename T, glm::precision P>
+struct type_caster<std::span<const glm::tvec3<T, P>>>
+{
+    using vector_type = glm::tvec3<T, P>;
+    using span_type = std::span<const vector_type>;
+    using helper = vec3_array<T, P>;
+
+    PYBIND11_TYPE_CASTER(span_type, const_name("numpy.ndarray[N, 3]"));
+
+    bool load(handle src, bool convert)
+    {
+        if(!helper::ensure(src, convert, m_buffer)) { return false; }
+
+        value = span_type(reinterpret_cast<const vector_type*>(m_buffer.data()), helper::count(m_buffer));
+        return true;
+    }
+
+    static handle cast(const span_type& src, return_value_policy /* policy */, handle /* parent */)
+    {
+        return helper::copy(src.data(), src.size());
+    }
+
+private:
+    typename helper::array_type m_buffer;
+};
+
 }}
@@ -5,8 +5,19 @@
 #include <pybind11/numpy.h>
 #include <pybind11/stl.h>
 
+#include <vessel_synthesis/arrays.h>
 #include <vessel_synthesis/domain.h>
+#include <vessel_synthesis/mapped.h>
+#include <vessel_synthesis/raster.h>
+#include <vessel_synthesis/mesh.h>
+#include <vessel_synthesis/serialize.h>
 #include <vessel_synthesis/synthesizer.h>
+#include <vessel_synthesis/vtp.h>
+
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
 
 #include "glm_cast.h"
 
@@ -33,15 +44,524 @@ namespace py = pybind11;
  *  -> for documentation you can use .doc() = ""; I haven't done this yet
  *
  *  -> do not edit the topology of the tree while iterating with (breadth_first, depth_first, ...)!
+ *     for large trees prefer orders() and delete_where(mask) (numpy index arrays, no python call per node)
+ *
+ *  -> long running calls (run, samples, arrays, ...) release the GIL; python callbacks reacquire it
+ *     run_async() runs the synthesis on a native thread and returns a concurrent.futures.Future
+ *     do not access the synthesizer (or share its domain with another running synthesizer) until it is done
  *
  *  -> I did not spend a lot of time optimizing data access (lot of data copy for conversion to python container)
+ *     point lists (std::vector<glm::vec3>) are converted from/to (N, 3) numpy arrays in one copy (see glm_cast.h)
  *  -> this is the single threaded synthesizer which should be fast enough for prototyping
  */
 
+namespace
+{
+
+/* per frame counters as dictionary of numpy arrays (name -> int64 array over frames) */
+py::dict counters_to_numpy(vs::prf::monitor& profiler)
+{
+    py::dict result;
+    for(const auto& [name, counts] : profiler.get_counters())
+    {
+        result[py::str(name)] = py::array_t<std::int64_t>(counts.size(), counts.data());
+    }
+    return result;
+}
+
+/* hardware counters as nested dictionary (scope -> event -> int64 array over frames) */
+py::dict hw_counters_to_numpy(vs::prf::monitor& profiler)
+{
+    py::dict result;
+    for(const auto& [name, events] : profiler.get_hw_counters())
+    {
+        py::dict scope;
+        for(std::size_t e = 0; e < vs::prf::hw_event_count; e++)
+        {
+            scope[vs::prf::hw_event_name(static_cast<vs::prf::hw_event>(e))] = py::array_t<std::int64_t>(events[e].size(), events[e].data());
+        }
+        result[py::str(name)] = scope;
+    }
+    return result;
+}
+
+/* allocations as nested dictionary (scope -> {"count", "bytes"} -> int64 array over frames) */
+py::dict allocations_to_numpy(vs::prf::monitor& profiler)
+{
+    py::dict result;
+    for(const auto& [name, allocs] : profiler.get_allocations())
+    {
+        py::dict scope;
+        scope["count"] = py::array_t<std::int64_t>(allocs.m_count.size(), allocs.m_count.data());
+        scope["bytes"] = py::array_t<std::int64_t>(allocs.m_bytes.size(), allocs.m_bytes.data());
+        result[py::str(name)] = scope;
+    }
+    return result;
+}
+
+/*
+ * voxel domain from a bool/uint8 mask[x][y][z]
+ * -> 3d masks must have the shape of the resolution; their memory layout (F or C) is used as is
+ * -> flat masks are interpreted in the given order ("F": x fastest, "C": z fastest)
+ */
+vs::domain_voxels* voxels_from_mask(const glm::vec3& min, const glm::vec3& max, const glm::vec3& resolution, py::array mask, const std::string& order)
+{
+    glm::ivec3 res(resolution);
+    if(mask.size() != py::ssize_t(res.x)*res.y*res.z) { throw py::value_error("mask size does not match resolution"); }
+
+    vs::voxel_order voxel_order;
+    if(mask.ndim() == 3)
+    {
+        if(mask.shape(0) != res.x || mask.shape(1) != res.y || mask.shape(2) != res.z) { throw py::value_error("mask shape does not match resolution"); }
+
+        if(mask.flags() & py::array::f_style) { voxel_order = vs::voxel_order::fortran; }
+        else if(mask.flags() & py::array::c_style) { voxel_order = vs::voxel_order::c; }
+        else
+        {
+            mask = py::module_::import("numpy").attr("asfortranarray")(mask);
+            voxel_order = vs::voxel_order::fortran;
+        }
+    }
+    else if(mask.ndim() == 1)
+    {
+        if(order != "F" && order != "C") { throw py::value_error("order must be 'F' or 'C'"); }
+        if(!(mask.flags() & py::array::c_style)) { mask = py::module_::import("numpy").attr("ascontiguousarray")(mask); }
+        voxel_order = (order == "F") ? vs::voxel_order::fortran : vs::voxel_order::c;
+    }
+    else
+    {
+        throw py::value_error("mask must be 1 or 3 dimensional");
+    }
+
+    const auto* data = static_cast<const std::uint8_t*>(mask.data());
+
+    py::gil_scoped_release release;
+    return new vs::domain_voxels(min, max, res, data, voxel_order);
+}
+
+/* moves the vector into a numpy array without copy; the capsule owns the memory */
+template<typename T>
+py::array_t<T> to_numpy(std::vector<T>&& values, std::vector<py::ssize_t> shape)
+{
+    auto* owner = new std::vector<T>(std::move(values));
+    py::capsule free(owner, [](void* ptr) { delete static_cast<std::vector<T>*>(ptr); });
+    return py::array_t<T>(shape, owner->data(), free);
+}
+
+/* node arrays as dictionary of numpy arrays; offsets are only included for forests */
+py::dict arrays_to_numpy(vs::node_arrays&& arrays, bool offsets)
+{
+    auto n = static_cast<py::ssize_t>(arrays.size());
+
+    py::dict result;
+    result["positions"] = to_numpy(std::move(arrays.m_positions), {n, 3});
+    result["radii"] = to_numpy(std::move(arrays.m_radii), {n});
+    result["parents"] = to_numpy(std::move(arrays.m_parents), {n});
+    result["types"] = to_numpy(std::move(arrays.m_types), {n});
+    result["ids"] = to_numpy(std::move(arrays.m_ids), {n});
+    if(offsets) { result["offsets"] = to_numpy(std::move(arrays.m_offsets), {static_cast<py::ssize_t>(arrays.m_offsets.size())}); }
+    return result;
+}
+
+/*
+ * read-only view of a forest owned by the synthesizer (Synthesizer.view_forest(), keeps the synthesizer alive)
+ * -> arrays() are read-only numpy views of the synthesizer's snapshot; no copy as long as the forest is unchanged
+ * -> changes go through the synthesizer (delete_where, update_nodes, set_*_forest, run) and are visible immediately
+ */
+struct forest_view
+{
+    vs::synthesizer* m_synth;
+    vs::system m_system;
+
+public:
+    std::shared_ptr<const vs::node_arrays> arrays() const
+    {
+        if(m_synth->is_running()) { throw std::runtime_error("forest is being modified by a running synthesis"); }
+        return m_synth->get_arrays(m_system);
+    }
+};
+
+/* read-only numpy array over memory owned by a shared snapshot (the capsule holds a reference) */
+template<typename T>
+py::array_t<T> view_numpy(const std::vector<T>& values, std::vector<py::ssize_t> shape, const std::shared_ptr<const void>& owner)
+{
+    auto* ref = new std::shared_ptr<const void>(owner);
+    py::capsule free(ref, [](void* ptr) { delete static_cast<std::shared_ptr<const void>*>(ptr); });
+
+    py::array_t<T> result(std::move(shape), values.data(), free);
+    py::detail::array_proxy(result.ptr())->flags &= ~py::detail::npy_api::NPY_ARRAY_WRITEABLE_;
+    return result;
+}
+
+py::dict arrays_to_numpy(const std::shared_ptr<const vs::node_arrays>& arrays)
+{
+    auto n = static_cast<py::ssize_t>(arrays->size());
+
+    py::dict result;
+    result["positions"] = view_numpy(arrays->m_positions, {n, 3}, arrays);
+    result["radii"] = view_numpy(arrays->m_radii, {n}, arrays);
+    result["parents"] = view_numpy(arrays->m_parents, {n}, arrays);
+    result["types"] = view_numpy(arrays->m_types, {n}, arrays);
+    result["ids"] = view_numpy(arrays->m_ids, {n}, arrays);
+    result["offsets"] = view_numpy(arrays->m_offsets, {static_cast<py::ssize_t>(arrays->m_offsets.size())}, arrays);
+    return result;
+}
+
+/* serialized tree/forest (see serialize.h) written directly into the bytes object */
+template<typename Trees>
+py::bytes serialize_to_bytes(const Trees& trees)
+{
+    auto size = vs::serialized_size(trees);
+    auto result = py::reinterpret_steal<py::bytes>(PyBytes_FromStringAndSize(nullptr, static_cast<py::ssize_t>(size)));
+    if(!result) { throw py::error_already_set(); }
+
+    auto* out = reinterpret_cast<std::byte*>(PyBytes_AS_STRING(result.ptr()));
+    {
+        py::gil_scoped_release release;
+        vs::serialize(trees, out);
+    }
+    return result;
+}
+
+/* deserializes without copying the bytes (kept alive by the caller) and with the GIL released */
+template<typename Result>
+Result deserialize_from_bytes(const py::bytes& state, Result (*deserialize)(const std::byte*, std::size_t))
+{
+    auto* data = reinterpret_cast<const std::byte*>(PyBytes_AS_STRING(state.ptr()));
+    auto size = static_cast<std::size_t>(PyBytes_GET_SIZE(state.ptr()));
+
+    py::gil_scoped_release release;
+    return deserialize(data, size);
+}
+
+/*
+ * pickle state of the settings as tuple of plain values with a version tag (independent of layout and byte order)
+ *      (version, steps, samples, boundary mode, boundary resolution, profiling, arterial, venous)
+ *      system: (parent inertia, birth attr, birth node, influence attr, kill attr, perception volume, terminal radius,
+ *               terminal growth, bifurcation thresh, bifurcation index, domain scaling, domain scaling value, only leaf growth)
+ * -> enums are validated on restore; malformed states raise ValueError
+ */
+constexpr int settings_version = 1;
+
+py::tuple settings_state(const vs::settings& self)
+{
+    auto system = [](const vs::settings::system& sys)
+    {
+        return py::make_tuple(sys.m_parent_inertia, sys.m_birth_attr, sys.m_birth_node, sys.m_influence_attr, sys.m_kill_attr,
+                              sys.m_percept_vol, sys.m_term_radius, sys.m_growth_distance, sys.m_bif_thresh, sys.m_bif_index,
+                              static_cast<int>(sys.m_grow_func.m_type), sys.m_grow_func.m_value, sys.m_only_leaf_development);
+    };
+
+    return py::make_tuple(settings_version, self.m_steps, self.m_sample_count, static_cast<int>(self.m_boundary.m_mode),
+                          self.m_boundary.m_resolution, static_cast<int>(self.m_profiling),
+                          system(self.m_system[static_cast<int>(vs::system::arterial)]), system(self.m_system[static_cast<int>(vs::system::venous)]));
+}
+
+template<typename Enum>
+Enum checked_enum(py::handle value, Enum last, const char* name)
+{
+    auto v = value.cast<int>();
+    if(v < 0 || v > static_cast<int>(last)) { throw py::value_error(std::string("settings state has an invalid ") + name); }
+    return static_cast<Enum>(v);
+}
+
+vs::settings settings_from_state(const py::tuple& state)
+{
+    if(state.size() != 8 || !py::isinstance<py::int_>(state[0]) || state[0].cast<int>() != settings_version)
+    {
+        throw py::value_error("unsupported settings state (expected version " + std::to_string(settings_version) + ")");
+    }
+
+    vs::settings result;
+    try
+    {
+        result.m_steps = state[1].cast<unsigned int>();
+        result.m_sample_count = state[2].cast<unsigned int>();
+        result.m_boundary.m_mode = checked_enum(state[3], vs::boundary::deflect, "boundary mode");
+        result.m_boundary.m_resolution = state[4].cast<unsigned int>();
+        result.m_profiling = checked_enum(state[5], vs::prf::level::tracing, "profiling level");
+
+        for(auto sys : {vs::system::arterial, vs::system::venous})
+        {
+            auto values = state[6 + static_cast<int>(sys)].cast<py::tuple>();
+            if(values.size() != 13) { throw py::value_error("settings state has a malformed system"); }
+
+            auto& target = result.m_system[static_cast<int>(sys)];
+            target.m_parent_inertia = values[0].cast<float>();
+            target.m_birth_attr = values[1].cast<float>();
+            target.m_birth_node = values[2].cast<float>();
+            target.m_influence_attr = values[3].cast<float>();
+            target.m_kill_attr = values[4].cast<float>();
+            target.m_percept_vol = values[5].cast<float>();
+            target.m_term_radius = values[6].cast<float>();
+            target.m_growth_distance = values[7].cast<float>();
+            target.m_bif_thresh = values[8].cast<float>();
+            target.m_bif_index = values[9].cast<float>();
+            target.m_grow_func.m_type = checked_enum(values[10], vs::grow_func::exponential, "domain scaling");
+            target.m_grow_func.m_value = values[11].cast<float>();
+            target.m_only_leaf_development = values[12].cast<bool>();
+        }
+    }
+    catch(const py::cast_error&)
+    {
+        throw py::value_error("settings state has a value of the wrong type");
+    }
+    return result;
+}
+
+/* read-only numpy view into a mapped file; the mapped forest object is the base and keeps the mapping alive */
+template<typename T>
+py::array_t<T> mapped_numpy(std::span<const T> values, std::vector<py::ssize_t> shape, py::handle mapped)
+{
+    py::array_t<T> result(std::move(shape), values.data(), mapped);
+    py::detail::array_proxy(result.ptr())->flags &= ~py::detail::npy_api::NPY_ARRAY_WRITEABLE_;
+    return result;
+}
+
+py::dict mapped_to_numpy(const vs::mapped_tree& tree, py::handle mapped)
+{
+    auto n = static_cast<py::ssize_t>(tree.size());
+
+    py::dict result;
+    result["positions"] = mapped_numpy(tree.m_positions, {n, 3}, mapped);
+    result["radii"] = mapped_numpy(tree.m_radii, {n}, mapped);
+    result["parents"] = mapped_numpy(tree.m_parents, {n}, mapped);
+    result["types"] = mapped_numpy(tree.m_types, {n}, mapped);
+    result["ids"] = mapped_numpy(tree.m_ids, {n}, mapped);
+    return result;
+}
+
+/* (X, Y, Z) volume in the memory order of the voxel grid, filled with value */
+template<typename T>
+py::array_t<T> make_volume(const glm::ivec3& resolution, vs::voxel_order order, T value)
+{
+    std::vector<py::ssize_t> shape{resolution.x, resolution.y, resolution.z};
+    std::vector<py::ssize_t> strides = (order == vs::voxel_order::fortran)
+        ? std::vector<py::ssize_t>{1, resolution.x, py::ssize_t(resolution.x) * resolution.y}
+        : std::vector<py::ssize_t>{py::ssize_t(resolution.y) * resolution.z, resolution.z, 1};
+    for(auto& s : strides) { s *= sizeof(T); }
+
+    py::array_t<T> result(shape, strides);
+    std::fill_n(result.mutable_data(), result.size(), value);
+    return result;
+}
+
+/* existing volume to write into; exact dtype, shape and memory order, no conversion */
+template<typename T>
+py::array_t<T> output_volume(py::handle volume, const glm::ivec3& resolution, vs::voxel_order order, const char* name)
+{
+    auto flag = (order == vs::voxel_order::fortran) ? py::array::f_style : py::array::c_style;
+    if(!py::array_t<T>::check_(volume)) { throw py::value_error(std::string(name) + " has the wrong dtype"); }
+
+    auto result = py::reinterpret_borrow<py::array_t<T>>(volume);
+    if(result.ndim() != 3 || result.shape(0) != resolution.x || result.shape(1) != resolution.y || result.shape(2) != resolution.z)
+    {
+        throw py::value_error(std::string(name) + " does not match the grid resolution");
+    }
+    if(!(result.flags() & flag) || !result.writeable()) { throw py::value_error(std::string(name) + " must be writeable and contiguous in the requested order"); }
+    return result;
+}
+
+/* labels and distance volumes (new or out=(labels, distance)) of the segments of a tree or forest */
+template<typename Trees>
+py::tuple rasterize_numpy(const Trees& trees, const glm::vec3& min, const glm::vec3& max, const glm::ivec3& resolution, std::uint8_t label,
+                          float band, const std::string& order, unsigned int threads, std::optional<py::tuple> out)
+{
+    if(order != "F" && order != "C") { throw py::value_error("order must be 'F' or 'C'"); }
+
+    vs::voxel_grid grid{min, max, resolution};
+    vs::raster_settings settings{(order == "F") ? vs::voxel_order::fortran : vs::voxel_order::c, band, threads};
+    if(glm::any(glm::lessThanEqual(resolution, glm::ivec3(0)))) { throw py::value_error("grid resolution must be positive"); }
+
+    py::array_t<std::uint8_t> labels;
+    py::array_t<float> distance;
+    if(out)
+    {
+        if(out->size() != 2) { throw py::value_error("out must be a tuple (labels, distance)"); }
+        labels = output_volume<std::uint8_t>((*out)[0], resolution, settings.m_order, "labels");
+        distance = output_volume<float>((*out)[1], resolution, settings.m_order, "distance");
+    }
+    else
+    {
+        labels = make_volume<std::uint8_t>(resolution, settings.m_order, 0);
+        distance = make_volume<float>(resolution, settings.m_order, settings.band_distance(grid));
+    }
+
+    std::span<std::uint8_t> label_span(labels.mutable_data(), grid.count());
+    std::span<float> distance_span(distance.mutable_data(), grid.count());
+    {
+        py::gil_scoped_release release;
+        vs::rasterize(vs::to_arrays(trees), grid, label, label_span, distance_span, settings);
+    }
+    return py::make_tuple(labels, distance);
+}
+
+/* partial volume occupancy (new or written into out) of the segments of a tree or forest */
+template<typename Trees>
+py::array_t<float> occupancy_numpy(const Trees& trees, const glm::vec3& min, const glm::vec3& max, const glm::ivec3& resolution,
+                                   unsigned int supersampling, const std::string& order, unsigned int threads, std::optional<py::array> out)
+{
+    if(order != "F" && order != "C") { throw py::value_error("order must be 'F' or 'C'"); }
+    if(glm::any(glm::lessThanEqual(resolution, glm::ivec3(0)))) { throw py::value_error("grid resolution must be positive"); }
+
+    vs::voxel_grid grid{min, max, resolution};
+    vs::raster_settings settings;
+    settings.m_order = (order == "F") ? vs::voxel_order::fortran : vs::voxel_order::c;
+    settings.m_threads = threads;
+    settings.m_supersampling = supersampling;
+
+    auto occupancy = out ? output_volume<float>(*out, resolution, settings.m_order, "out") : make_volume<float>(resolution, settings.m_order, 0.0f);
+    std::span<float> occupancy_span(occupancy.mutable_data(), grid.count());
+    {
+        py::gil_scoped_release release;
+        vs::rasterize_occupancy(vs::to_arrays(trees), grid, occupancy_span, settings);
+    }
+    return occupancy;
+}
+
+/* tube mesh of a tree, forest or node arrays with the GIL released */
+template<typename Trees>
+vs::tube_mesh make_mesh(const Trees& trees, unsigned int segments, unsigned int subdivisions, bool caps, unsigned int threads)
+{
+    vs::mesh_settings settings{segments, subdivisions, caps, threads};
+
+    py::gil_scoped_release release;
+    return vs::make_tube_mesh(trees, settings);
+}
+
+/* numpy view of a mesh buffer; the mesh object is the base and stays alive with the array */
+template<typename T>
+py::array_t<T> mesh_buffer(const std::vector<T>& values, py::handle mesh)
+{
+    return py::array_t<T>({static_cast<py::ssize_t>(values.size() / 3), py::ssize_t(3)}, values.data(), mesh);
+}
+
+/* traversal orders (row indices into arrays()) and per row topology */
+py::dict orders_to_numpy(vs::node_orders&& orders)
+{
+    auto n = static_cast<py::ssize_t>(orders.m_depths.size());
+
+    py::dict result;
+    result["depth_first"] = to_numpy(std::move(orders.m_depth_first), {n});
+    result["post_order"] = to_numpy(std::move(orders.m_post_order), {n});
+    result["depths"] = to_numpy(std::move(orders.m_depths), {n});
+    result["strahler"] = to_numpy(std::move(orders.m_strahler), {n});
+    result["subtree_begin"] = to_numpy(std::move(orders.m_subtree_begin), {n});
+    result["subtree_end"] = to_numpy(std::move(orders.m_subtree_end), {n});
+    return result;
+}
+
+/*
+ * samples as (scope names, int64 nanosecond matrix of shape (frames, scopes)); no copy of the monitor's export
+ * -> the matrix is stored per scope, i.e. columns are contiguous (fortran order) as pandas keeps them
+ */
+py::tuple sample_matrix_to_numpy(vs::prf::monitor& profiler)
+{
+    auto* matrix = new vs::prf::monitor::sample_matrix(profiler.get_sample_matrix());
+    py::capsule free(matrix, [](void* ptr) { delete static_cast<vs::prf::monitor::sample_matrix*>(ptr); });
+
+    auto frames = static_cast<py::ssize_t>(matrix->m_frames);
+    auto scopes = static_cast<py::ssize_t>(matrix->m_names.size());
+    auto item = static_cast<py::ssize_t>(sizeof(std::int64_t));
+
+    py::array_t<std::int64_t> values({frames, scopes}, {item, item * frames}, matrix->m_values.data(), free);
+    return py::make_tuple(py::cast(matrix->m_names), values);
+}
+
+/* samples as dictionary of int64 nanosecond arrays (columns of the sample matrix, no copy) */
+py::dict samples_to_numpy(vs::prf::monitor& profiler)
+{
+    auto matrix = sample_matrix_to_numpy(profiler);
+    auto names = matrix[0].cast<std::vector<std::string>>();
+    auto values = matrix[1].cast<py::array>();
+
+    py::dict result;
+    for(std::size_t i = 0; i < names.size(); i++)
+    {
+        result[py::str(names[i])] = values[py::make_tuple(py::slice(py::none(), py::none(), py::none()), py::int_(i))];
+    }
+    return result;
+}
+
+/* changes of one step as dictionary of numpy arrays (copied, the buffers are reused by the next step) */
+py::dict delta_to_numpy(const vs::synthesizer::step_delta& delta)
+{
+    auto n = static_cast<py::ssize_t>(delta.m_new_ids.size());
+    auto r = static_cast<py::ssize_t>(delta.m_radii.size());
+    auto k = static_cast<py::ssize_t>(delta.m_killed_attr.size());
+
+    py::dict result;
+    result["new_trees"] = py::array_t<std::uint32_t>(n, delta.m_new_trees.data());
+    result["new_ids"] = py::array_t<vs::node_id>(n, delta.m_new_ids.data());
+    result["new_parents"] = py::array_t<vs::node_id>(n, delta.m_new_parents.data());
+    result["new_positions"] = py::array_t<float>({n, py::ssize_t(3)}, reinterpret_cast<const float*>(delta.m_new_positions.data()));
+    result["new_radii"] = py::array_t<float>(n, delta.m_new_radii.data());
+    result["radius_trees"] = py::array_t<std::uint32_t>(r, delta.m_radius_trees.data());
+    result["radius_ids"] = py::array_t<vs::node_id>(r, delta.m_radius_ids.data());
+    result["radii"] = py::array_t<float>(r, delta.m_radii.data());
+    result["killed_attr"] = py::array_t<float>({k, py::ssize_t(3)}, reinterpret_cast<const float*>(delta.m_killed_attr.data()));
+    return result;
+}
+
+/* frame times as int64 nanoseconds */
+py::array_t<std::int64_t> times_to_numpy(const vs::prf::monitor::frame_times& times)
+{
+    py::array_t<std::int64_t> result(times.size());
+    auto data = result.mutable_data();
+    for(std::size_t i = 0; i < times.size(); i++)
+    {
+        data[i] = std::chrono::duration_cast<vs::prf::nano_seconds>(times[i]).count();
+    }
+    return result;
+}
+
+/*
+ * worker threads of Synthesizer.run_async(); only accessed with the GIL held
+ * -> finished workers are joined on the next run_async(), running ones are stopped and joined at interpreter exit
+ * -> m_done is set by the worker with the GIL held after it released its references, so m_synth is alive while it is false
+ */
+struct async_worker
+{
+    vs::synthesizer* m_synth;
+    std::shared_ptr<bool> m_done;
+    std::thread m_thread;
+};
+
+std::vector<async_worker>& async_workers()
+{
+    static std::vector<async_worker> workers;
+    return workers;
+}
+
+/* join finished workers (all = false) or stop and join all of them; the workers need the GIL to finish */
+void join_async_workers(bool all)
+{
+    std::vector<async_worker> joinable;
+    auto& workers = async_workers();
+    for(auto it = workers.begin(); it != workers.end();)
+    {
+        if(all && !*it->m_done) { it->m_synth->stop(); }
+        if(all || *it->m_done)
+        {
+            joinable.push_back(std::move(*it));
+            it = workers.erase(it);
+        }
+        else { ++it; }
+    }
+
+    py::gil_scoped_release release;
+    for(auto& worker : joinable) { worker.m_thread.join(); }
+}
+
+}
+
 PYBIND11_MODULE(vessel_module, m)
 {
     m.doc() = "Vessel-Synthesizer Module";
 
+    /* run_async() workers must not outlive the interpreter */
+    py::module_::import("atexit").attr("register")(py::cpp_function([]() { join_async_workers(true); }));
+
     /****************************************************
      *                   Domain Geometry                *
      ****************************************************/
@@ -50,12 +570,14 @@ PYBIND11_MODULE(vessel_module, m)
             .def("min_extends", &vs::domain::min_extends)
             .def("max_extends", &vs::domain::max_extends)
             .def("sample", &vs::domain::sample)
+            .def("contains", &vs::domain::contains)
+            .def("volume", &vs::domain::volume)
             .def("samples", [](vs::domain& self, unsigned int count)
             {
                 std::vector<glm::vec3> _samples;
                 self.samples(_samples, count);
                 return _samples;
-            });
+            }, py::call_guard<py::gil_scoped_release>());
 
     py::class_<vs::domain_circle, vs::domain>(m, "DomainCircle")
             .def(py::init<const glm::vec3&, float>())
@@ -63,12 +585,14 @@ PYBIND11_MODULE(vessel_module, m)
             .def("min_extends", &vs::domain_circle::min_extends)
             .def("max_extends", &vs::domain_circle::max_extends)
             .def("sample", &vs::domain_circle::sample)
+            .def("contains", &vs::domain_circle::contains)
+            .def("volume", &vs::domain_circle::volume)
             .def("samples", [](vs::domain& self, unsigned int count)
             {
                 std::vector<glm::vec3> _samples;
                 self.samples(_samples, count);
                 return _samples;
-            });
+            }, py::call_guard<py::gil_scoped_release>());
 
     py::class_<vs::domain_sphere, vs::domain>(m, "DomainSphere")
             .def(py::init<const glm::vec3&, float>())
@@ -76,12 +600,14 @@ PYBIND11_MODULE(vessel_module, m)
             .def("min_extends", &vs::domain_sphere::min_extends)
             .def("max_extends", &vs::domain_sphere::max_extends)
             .def("sample", &vs::domain_sphere::sample)
+            .def("contains", &vs::domain_sphere::contains)
+            .def("volume", &vs::domain_sphere::volume)
             .def("samples", [](vs::domain& self, unsigned int count)
             {
                 std::vector<glm::vec3> _samples;
                 self.samples(_samples, count);
                 return _samples;
-            });
+            }, py::call_guard<py::gil_scoped_release>());
 
     py::class_<vs::domain_lines, vs::domain>(m, "DomainLines")
             .def(py::init<const std::vector<glm::vec3>&, const std::vector<glm::vec3>&, float>())
@@ -90,32 +616,119 @@ PYBIND11_MODULE(vessel_module, m)
             .def("min_extends", &vs::domain_lines::min_extends)
             .def("max_extends", &vs::domain_lines::max_extends)
             .def("sample", &vs::domain_lines::sample)
+            .def("contains", &vs::domain_lines::contains)
+            .def("volume", &vs::domain_lines::volume)
             .def("samples", [](vs::domain& self, unsigned int count)
             {
                 std::vector<glm::vec3> _samples;
                 self.samples(_samples, count);
                 return _samples;
-            });
+            }, py::call_guard<py::gil_scoped_release>());
 
     py::class_<vs::domain_voxels, vs::domain>(m, "DomainVoxels")
-            .def(py::init<const glm::vec3&, const glm::vec3&, const glm::vec3&, const std::vector<bool>&>())
             .def(py::init<const glm::vec3&, const glm::vec3&, const glm::vec3&, const std::vector<glm::vec3>&>())
+            .def(py::init([](const glm::vec3& min, const glm::vec3& max, const glm::vec3& resolution, py::array_t<bool, 0> mask, const std::string& order)
+            {
+                return voxels_from_mask(min, max, resolution, mask, order);
+            }), py::arg("min"), py::arg("max"), py::arg("resolution"), py::arg("mask"), py::arg("order") = "F")
+            .def(py::init([](const glm::vec3& min, const glm::vec3& max, const glm::vec3& resolution, py::array_t<std::uint8_t, 0> mask, const std::string& order)
+            {
+                return voxels_from_mask(min, max, resolution, mask, order);
+            }), py::arg("min"), py::arg("max"), py::arg("resolution"), py::arg("mask"), py::arg("order") = "F")
             .def("seed", &vs::domain_voxels::seed)
             .def("min_extends", &vs::domain_voxels::min_extends)
             .def("max_extends", &vs::domain_voxels::max_extends)
             .def("sample", &vs::domain_voxels::sample)
+            .def("contains", &vs::domain_voxels::contains)
+            .def("volume", &vs::domain_voxels::volume)
+            .def("grid", [](const vs::domain_voxels& self) { auto grid = self.grid(); return py::make_tuple(grid.m_min, grid.m_max, grid.m_resolution); })
             .def("samples", [](vs::domain& self, unsigned int count)
             {
                 std::vector<glm::vec3> _samples;
                 self.samples(_samples, count);
                 return _samples;
-            });
+            }, py::call_guard<py::gil_scoped_release>());
+
+    py::class_<vs::domain_sparse_voxels, vs::domain>(m, "DomainSparseVoxels")
+            .def(py::init<const glm::vec3&, const glm::vec3&>())
+            .def(py::init<const glm::vec3&, const glm::vec3&, const glm::vec3&, const std::vector<bool>&>())
+            .def(py::init<const glm::vec3&, const glm::vec3&, const glm::vec3&, const std::vector<glm::vec3>&>())
+            .def("seed", &vs::domain_sparse_voxels::seed)
+            .def("min_extends", &vs::domain_sparse_voxels::min_extends)
+            .def("max_extends", &vs::domain_sparse_voxels::max_extends)
+            .def("sample", &vs::domain_sparse_voxels::sample)
+            .def("contains", &vs::domain_sparse_voxels::contains)
+            .def("volume", &vs::domain_sparse_voxels::volume)
+            .def("activate", static_cast<void (vs::domain_sparse_voxels::*)(const glm::vec3&)>(&vs::domain_sparse_voxels::activate))
+            .def("active_count", &vs::domain_sparse_voxels::active_count)
+            .def("tile_count", &vs::domain_sparse_voxels::tile_count)
+            .def("samples", [](vs::domain& self, unsigned int count)
+            {
+                std::vector<glm::vec3> _samples;
+                self.samples(_samples, count);
+                return _samples;
+            }, py::call_guard<py::gil_scoped_release>());
+
+    py::class_<vs::domain_union, vs::domain>(m, "DomainUnion")
+            .def(py::init<const std::vector<vs::domain_composite::domain_ref>&>(), py::keep_alive<1, 2>())
+            .def("seed", &vs::domain_union::seed)
+            .def("min_extends", &vs::domain_union::min_extends)
+            .def("max_extends", &vs::domain_union::max_extends)
+            .def("sample", &vs::domain_union::sample)
+            .def("contains", &vs::domain_union::contains)
+            .def("volume", &vs::domain_union::volume)
+            .def("acceptance_rate", &vs::domain_union::acceptance_rate)
+            .def("samples", [](vs::domain& self, unsigned int count)
+            {
+                std::vector<glm::vec3> _samples;
+                self.samples(_samples, count);
+                return _samples;
+            }, py::call_guard<py::gil_scoped_release>());
+
+    py::class_<vs::domain_intersection, vs::domain>(m, "DomainIntersection")
+            .def(py::init<const std::vector<vs::domain_composite::domain_ref>&>(), py::keep_alive<1, 2>())
+            .def("seed", &vs::domain_intersection::seed)
+            .def("min_extends", &vs::domain_intersection::min_extends)
+            .def("max_extends", &vs::domain_intersection::max_extends)
+            .def("sample", &vs::domain_intersection::sample)
+            .def("contains", &vs::domain_intersection::contains)
+            .def("volume", &vs::domain_intersection::volume)
+            .def("acceptance_rate", &vs::domain_intersection::acceptance_rate)
+            .def("samples", [](vs::domain& self, unsigned int count)
+            {
+                std::vector<glm::vec3> _samples;
+                self.samples(_samples, count);
+                return _samples;
+            }, py::call_guard<py::gil_scoped_release>());
+
+    py::class_<vs::domain_difference, vs::domain>(m, "DomainDifference")
+            .def(py::init<vs::domain&, vs::domain&>(), py::keep_alive<1, 2>(), py::keep_alive<1, 3>())
+            .def(py::init<vs::domain&, const std::vector<vs::domain_composite::domain_ref>&>(), py::keep_alive<1, 2>(), py::keep_alive<1, 3>())
+            .def("seed", &vs::domain_difference::seed)
+            .def("min_extends", &vs::domain_difference::min_extends)
+            .def("max_extends", &vs::domain_difference::max_extends)
+            .def("sample", &vs::domain_difference::sample)
+            .def("contains", &vs::domain_difference::contains)
+            .def("volume", &vs::domain_difference::volume)
+            .def("acceptance_rate", &vs::domain_difference::acceptance_rate)
+            .def("samples", [](vs::domain& self, unsigned int count)
+            {
+                std::vector<glm::vec3> _samples;
+                self.samples(_samples, count);
+                return _samples;
+            }, py::call_guard<py::gil_scoped_release>());
 
 
 
     /****************************************************
      *                   Vessel Node                    *
      ****************************************************/
+    py::enum_<vs::node_type>(m, "NodeType", py::arithmetic())
+            .value("ROOT", vs::node_type::root)
+            .value("INTER", vs::node_type::inter)
+            .value("JOINT", vs::node_type::joint)
+            .value("LEAF", vs::node_type::leaf);
+
     using vs_node = vs::synthesizer::tree::node;
     py::class_<vs_node>(m, "Node")
             .def_property_readonly("id", &vs_node::id)
@@ -132,6 +745,47 @@ PYBIND11_MODULE(vessel_module, m)
             .def("is_leaf", &vs_node::is_leaf)
             .def("is_joint", &vs_node::is_joint);
 
+    /****************************************************
+     *                   Mapped Forest                  *
+     ****************************************************/
+    py::class_<vs::mapped_forest>(m, "MappedForest")
+            .def(py::init<const std::string&>(), py::arg("path"), py::call_guard<py::gil_scoped_release>())
+            .def_property_readonly("size", &vs::mapped_forest::tree_count)
+            .def_property_readonly("node_count", &vs::mapped_forest::size)
+            .def("__len__", &vs::mapped_forest::tree_count)
+            .def("arrays", [](py::object self)
+            {
+                const auto& mapped = self.cast<const vs::mapped_forest&>();
+
+                vs::mapped_tree all{0, mapped.positions(), mapped.radii(), mapped.parents(), mapped.types(), mapped.ids()};
+                auto result = mapped_to_numpy(all, self);
+                result["offsets"] = mapped_numpy(mapped.offsets(), {static_cast<py::ssize_t>(mapped.offsets().size())}, self);
+                return result;
+            })
+            .def("tree_arrays", [](py::object self, std::size_t index)
+            {
+                auto tree = self.cast<const vs::mapped_forest&>().tree(index);
+                auto result = mapped_to_numpy(tree, self);
+                result["first"] = tree.m_first;
+                return result;
+            }, py::arg("index"))
+            .def("tree", &vs::mapped_forest::to_tree, py::arg("index"), py::call_guard<py::gil_scoped_release>())
+            .def("to_forest", &vs::mapped_forest::to_forest, py::call_guard<py::gil_scoped_release>());
+
+    /****************************************************
+     *                     Tube Mesh                    *
+     ****************************************************/
+    py::class_<vs::tube_mesh>(m, "TubeMesh")
+            .def_property_readonly("vertex_count", &vs::tube_mesh::vertex_count)
+            .def_property_readonly("triangle_count", &vs::tube_mesh::triangle_count)
+            .def_property_readonly("vertices", [](py::object self) { return mesh_buffer(self.cast<const vs::tube_mesh&>().m_vertices, self); })
+            .def_property_readonly("normals", [](py::object self) { return mesh_buffer(self.cast<const vs::tube_mesh&>().m_normals, self); })
+            .def_property_readonly("triangles", [](py::object self) { return mesh_buffer(self.cast<const vs::tube_mesh&>().m_triangles, self); })
+            .def("write_ply", [](const vs::tube_mesh& self, const std::string& path) { return vs::write_ply(path, self); },
+                 py::arg("path"), py::call_guard<py::gil_scoped_release>())
+            .def("write_obj", [](const vs::tube_mesh& self, const std::string& path) { return vs::write_obj(path, self); },
+                 py::arg("path"), py::call_guard<py::gil_scoped_release>());
+
     /****************************************************
      *                    Vessel Tree                   *
      ****************************************************/
@@ -170,7 +824,50 @@ PYBIND11_MODULE(vessel_module, m)
                 });
 
                 return std::make_tuple(start, end, radius);
-            });
+            })
+            .def("arrays", [](const vs_tree& self)
+            {
+                vs::node_arrays arrays;
+                {
+                    py::gil_scoped_release release;
+                    arrays = vs::to_arrays(self);
+                }
+                return arrays_to_numpy(std::move(arrays), false);
+            })
+            .def("orders", [](const vs_tree& self)
+            {
+                vs::node_orders orders;
+                {
+                    py::gil_scoped_release release;
+                    orders = vs::to_orders(vs::to_arrays(self));
+                }
+                return orders_to_numpy(std::move(orders));
+            })
+            .def("delete_where", [](vs_tree& self, py::array_t<bool, py::array::c_style | py::array::forcecast> mask)
+            {
+                if(mask.ndim() != 1) { throw py::value_error("mask must be one dimensional"); }
+                auto data = reinterpret_cast<const std::uint8_t*>(mask.data());
+
+                py::gil_scoped_release release;
+                return vs::delete_where(self, data, static_cast<std::size_t>(mask.size()));
+            }, py::arg("mask"))
+            .def(py::pickle([](const vs_tree& self) { return serialize_to_bytes(self); },
+                            [](const py::bytes& state)
+                            {
+                                /* nodes link to the tree where the instance finally lives */
+                                auto tree = std::make_unique<vs_tree>(deserialize_from_bytes(state, &vs::deserialize_tree));
+                                for(auto& [id, n] : tree->get_all_nodes()) { n.data().m_tree = tree.get(); }
+                                return tree;
+                            }))
+            .def("write_vtp", [](const vs_tree& self, const std::string& path, bool compress, int level)
+            {
+                return vs::write_vtp(path, self, vs::vtp_settings{compress, level});
+            }, py::arg("path"), py::arg("compress") = false, py::arg("level") = 6, py::call_guard<py::gil_scoped_release>())
+            .def("rasterize", &rasterize_numpy<vs_tree>, py::arg("min"), py::arg("max"), py::arg("resolution"), py::arg("label") = 1, py::arg("band") = 4.0f, py::arg("order") = "F",
+                 py::arg("threads") = 0, py::arg("out") = py::none())
+            .def("rasterize_occupancy", &occupancy_numpy<vs_tree>, py::arg("min"), py::arg("max"), py::arg("resolution"), py::arg("supersampling") = 4, py::arg("order") = "F",
+                 py::arg("threads") = 0, py::arg("out") = py::none())
+            .def("tube_mesh", &make_mesh<vs_tree>, py::arg("segments") = 12, py::arg("subdivisions") = 0, py::arg("caps") = true, py::arg("threads") = 0);
 
     /****************************************************
      *                      Forest                      *
@@ -179,6 +876,58 @@ PYBIND11_MODULE(vessel_module, m)
     py::class_<vs_forest>(m, "Forest")
             .def("trees", static_cast<std::list<vs_tree>& (vs_forest::*)()>(&vs_forest::trees))
             .def_property_readonly("size", [](const vs_forest& self){ return self.trees().size(); })
+            .def_static("from_arrays", [](py::array_t<float, py::array::c_style | py::array::forcecast> positions,
+                                          py::array_t<float, py::array::c_style | py::array::forcecast> radii,
+                                          py::array_t<std::int64_t, py::array::c_style | py::array::forcecast> parents,
+                                          std::optional<py::array_t<std::int64_t, py::array::c_style | py::array::forcecast>> tree_ids)
+            {
+                auto n = radii.size();
+                if(positions.ndim() != 2 || positions.shape(1) != 3 || positions.shape(0) != n) { throw py::value_error("positions must have shape (N, 3)"); }
+                if(radii.ndim() != 1 || parents.ndim() != 1 || parents.size() != n) { throw py::value_error("radii and parents must have shape (N,)"); }
+                if(tree_ids && (tree_ids->ndim() != 1 || tree_ids->size() != n)) { throw py::value_error("tree_ids must have shape (N,)"); }
+
+                py::gil_scoped_release release;
+                return vs::from_arrays(positions.data(), radii.data(), parents.data(), tree_ids ? tree_ids->data() : nullptr, static_cast<std::size_t>(n));
+            }, py::arg("positions"), py::arg("radii"), py::arg("parents"), py::arg("tree_ids") = py::none())
+            .def("arrays", [](const vs_forest& self)
+            {
+                vs::node_arrays arrays;
+                {
+                    py::gil_scoped_release release;
+                    arrays = vs::to_arrays(self);
+                }
+                return arrays_to_numpy(std::move(arrays), true);
+            })
+            .def("orders", [](const vs_forest& self)
+            {
+                vs::node_orders orders;
+                {
+                    py::gil_scoped_release release;
+                    orders = vs::to_orders(vs::to_arrays(self));
+                }
+                return orders_to_numpy(std::move(orders));
+            })
+            .def("delete_where", [](vs_forest& self, py::array_t<bool, py::array::c_style | py::array::forcecast> mask)
+            {
+                if(mask.ndim() != 1) { throw py::value_error("mask must be one dimensional"); }
+                auto data = reinterpret_cast<const std::uint8_t*>(mask.data());
+
+                py::gil_scoped_release release;
+                return vs::delete_where(self, data, static_cast<std::size_t>(mask.size()));
+            }, py::arg("mask"))
+            .def(py::pickle([](const vs_forest& self) { return serialize_to_bytes(self); },
+                            [](const py::bytes& state) { return deserialize_from_bytes(state, &vs::deserialize_forest); }))
+            .def("write_vtp", [](const vs_forest& self, const std::string& path, bool compress, int level)
+            {
+                return vs::write_vtp(path, self, vs::vtp_settings{compress, level});
+            }, py::arg("path"), py::arg("compress") = false, py::arg("level") = 6, py::call_guard<py::gil_scoped_release>())
+            .def("write_mapped", [](const vs_forest& self, const std::string& path) { return vs::write_mapped(path, self); },
+                 py::arg("path"), py::call_guard<py::gil_scoped_release>())
+            .def("rasterize", &rasterize_numpy<vs_forest>, py::arg("min"), py::arg("max"), py::arg("resolution"), py::arg("label") = 1, py::arg("band") = 4.0f, py::arg("order") = "F",
+                 py::arg("threads") = 0, py::arg("out") = py::none())
+            .def("rasterize_occupancy", &occupancy_numpy<vs_forest>, py::arg("min"), py::arg("max"), py::arg("resolution"), py::arg("supersampling") = 4, py::arg("order") = "F",
+                 py::arg("threads") = 0, py::arg("out") = py::none())
+            .def("tube_mesh", &make_mesh<vs_forest>, py::arg("segments") = 12, py::arg("subdivisions") = 0, py::arg("caps") = true, py::arg("threads") = 0)
             .def("__getitem__", [](vs_forest& self, unsigned int idx) -> vs_tree&
             {
                 if(idx >= self.trees().size())
@@ -202,7 +951,37 @@ PYBIND11_MODULE(vessel_module, m)
                 *ptr = t;
             });
 
-
+    py::class_<forest_view>(m, "ForestView")
+            .def_property_readonly("size", [](const forest_view& self){ return self.arrays()->tree_count(); })
+            .def_property_readonly("node_count", [](const forest_view& self){ return self.arrays()->size(); })
+            .def_property_readonly("generation", [](const forest_view& self){ return self.m_synth->get_generation(self.m_system); })
+            .def("arrays", [](const forest_view& self)
+            {
+                std::shared_ptr<const vs::node_arrays> arrays;
+                {
+                    py::gil_scoped_release release;
+                    arrays = self.arrays();
+                }
+                return arrays_to_numpy(arrays);
+            })
+            .def("orders", [](const forest_view& self)
+            {
+                vs::node_orders orders;
+                {
+                    py::gil_scoped_release release;
+                    orders = vs::to_orders(*self.arrays());
+                }
+                return orders_to_numpy(std::move(orders));
+            })
+            .def("copy", [](const forest_view& self)
+            {
+                if(self.m_synth->is_running()) { throw std::runtime_error("forest is being modified by a running synthesis"); }
+                return self.m_synth->get_forest(self.m_system);
+            }, py::return_value_policy::copy)
+            .def("tube_mesh", [](const forest_view& self, unsigned int segments, unsigned int subdivisions, bool caps, unsigned int threads)
+            {
+                return make_mesh(*self.arrays(), segments, subdivisions, caps, threads);
+            }, py::arg("segments") = 12, py::arg("subdivisions") = 0, py::arg("caps") = true, py::arg("threads") = 0);
 
     /****************************************************
      *                      Settings                    *
@@ -212,10 +991,29 @@ PYBIND11_MODULE(vessel_module, m)
             .value("LINEAR", vs::grow_func::linear)
             .value("EXPONENTIAL", vs::grow_func::exponential);
 
+    py::enum_<vs::boundary>(m, "Boundary", py::arithmetic())
+            .value("NONE", vs::boundary::none)
+            .value("REJECT", vs::boundary::reject)
+            .value("DEFLECT", vs::boundary::deflect);
+
+    py::enum_<vs::prf::level>(m, "ProfileLevel", py::arithmetic())
+            .value("OFF", vs::prf::level::off)
+            .value("FRAMES", vs::prf::level::frames)
+            .value("SCOPES", vs::prf::level::scopes)
+            .value("TRACING", vs::prf::level::tracing);
+
     py::class_<vs::settings>(m, "Settings")
             .def(py::init<>())
+            .def(py::pickle(&settings_state, &settings_from_state))
             .def_readwrite("steps", &vs::settings::m_steps)
+            .def_readwrite("profiling", &vs::settings::m_profiling)
             .def_readwrite("samples", &vs::settings::m_sample_count)
+            .def_property("boundary",
+                          [](const vs::settings& self){ return self.m_boundary.m_mode; },
+                          [](vs::settings& self, const vs::boundary b){ self.m_boundary.m_mode = b; })
+            .def_property("boundary_resolution",
+                          [](const vs::settings& self){ return self.m_boundary.m_resolution; },
+                          [](vs::settings& self, unsigned int res){ self.m_boundary.m_resolution = res; })
             .def("scale", &vs::settings::scale)
             .def("system", &vs::settings::get_system_data, py::return_value_policy::reference);
 
@@ -251,19 +1049,170 @@ PYBIND11_MODULE(vessel_module, m)
             .def(py::init<vs::domain&>())
             .def("create_root", &vs::synthesizer::create_root)
             .def_property("settings", &vs::synthesizer::get_settings, &vs::synthesizer::set_settings)
-            .def("run", &vs::synthesizer::run)
+            .def("run", [](vs::synthesizer& self) { self.run(); }, py::call_guard<py::gil_scoped_release>())
+            .def("run_async", [](py::object self, py::object progress)
+            {
+                auto& synth = self.cast<vs::synthesizer&>();
+                join_async_workers(false);
+
+                /* everything that may throw is prepared before the claim */
+                vs::synthesizer::progress_callback callback;
+                if(!progress.is_none()) { callback = progress.cast<vs::synthesizer::progress_callback>(); }
+
+                auto future = py::module_::import("concurrent.futures").attr("Future")();
+                future.attr("set_running_or_notify_cancel")();
+                auto done = std::make_shared<bool>(false);
+                async_workers().reserve(async_workers().size() + 1);
+
+                /* python references are released on the worker thread while holding the GIL */
+                auto state = std::make_unique<std::pair<py::object, py::object>>(self, future);
+
+                /* claimed here, so a second call fails before any thread is started */
+                if(!synth.try_claim()) { throw std::runtime_error("synthesizer is already running"); }
+
+                /* progress callback is wrapped by pybind11; calls and destruction acquire the GIL */
+                if(callback) { synth.set_progress_callback(callback); }
+
+                std::thread worker;
+                try
+                {
+                    worker = std::thread([state = state.get(), done, &synth, reset = static_cast<bool>(callback)]()
+                    {
+                        std::string error;
+                        try { synth.run(true); }
+                        catch(const std::exception& e) { error = e.what(); }
+
+                        py::gil_scoped_acquire acquire;
+                        if(reset) { synth.set_progress_callback(nullptr); }
+                        if(error.empty()) { state->second.attr("set_result")(py::none()); }
+                        else { state->second.attr("set_exception")(py::module_::import("builtins").attr("RuntimeError")(error)); }
+                        delete state;
+                        *done = true;
+                    });
+                }
+                catch(...)
+                {
+                    if(callback) { synth.set_progress_callback(nullptr); }
+                    synth.release_claim();
+                    throw;
+                }
+                state.release();
+                async_workers().push_back({&synth, done, std::move(worker)});
+
+                return future;
+            }, py::arg("progress") = py::none())
+            .def("stop", &vs::synthesizer::stop)
+            .def("is_running", &vs::synthesizer::is_running)
+            .def("set_progress_callback", [](vs::synthesizer& self, py::object progress)
+            {
+                if(progress.is_none()) { self.set_progress_callback(nullptr); }
+                else { self.set_progress_callback(progress.cast<vs::synthesizer::progress_callback>()); }
+            })
+            .def("set_step_callback", [](vs::synthesizer& self, py::object callback)
+            {
+                if(callback.is_none())
+                {
+                    self.set_step_callback(nullptr);
+                    return;
+                }
+
+                /* func(step, arterial, venous); the deltas are converted with the GIL held */
+                auto func = callback.cast<std::function<void(unsigned int, py::dict, py::dict)>>();
+                self.set_step_callback([func](unsigned int step, const auto& arterial, const auto& venous)
+                {
+                    py::gil_scoped_acquire acquire;
+                    func(step, delta_to_numpy(arterial), delta_to_numpy(venous));
+                });
+            })
+            .def("view_forest", [](vs::synthesizer& self, vs::system sys) { return forest_view{&self, sys}; }, py::keep_alive<0, 1>())
+            .def("delete_where", [](vs::synthesizer& self, vs::system sys, py::array_t<bool, py::array::c_style | py::array::forcecast> mask)
+            {
+                if(self.is_running()) { throw std::runtime_error("forest is being modified by a running synthesis"); }
+                if(mask.ndim() != 1) { throw py::value_error("mask must be one dimensional"); }
+                auto data = reinterpret_cast<const std::uint8_t*>(mask.data());
+
+                py::gil_scoped_release release;
+                return self.delete_where(sys, data, static_cast<std::size_t>(mask.size()));
+            }, py::arg("system"), py::arg("mask"))
+            .def("update_nodes", [](vs::synthesizer& self, vs::system sys,
+                                    std::optional<py::array_t<float, py::array::c_style | py::array::forcecast>> positions,
+                                    std::optional<py::array_t<float, py::array::c_style | py::array::forcecast>> radii)
+            {
+                if(self.is_running()) { throw std::runtime_error("forest is being modified by a running synthesis"); }
+                auto n = self.get_arrays(sys)->size();
+                if(positions && (positions->ndim() != 2 || positions->shape(1) != 3 || std::size_t(positions->shape(0)) != n)) { throw py::value_error("positions must have shape (N, 3)"); }
+                if(radii && (radii->ndim() != 1 || std::size_t(radii->size()) != n)) { throw py::value_error("radii must have shape (N,)"); }
+
+                py::gil_scoped_release release;
+                self.update_nodes(sys, positions ? positions->data() : nullptr, radii ? radii->data() : nullptr, n);
+            }, py::arg("system"), py::arg("positions") = py::none(), py::arg("radii") = py::none())
             .def("get_arterial_forest", [](vs::synthesizer& self) { return self.get_forest(vs::system::arterial); }, py::return_value_policy::copy)
             .def("get_venous_forest", [](vs::synthesizer& self) { return self.get_forest(vs::system::venous); }, py::return_value_policy::copy)
-            .def("set_arterial_forest",  [](vs::synthesizer& self, const vs::synthesizer::forest& trees) { return self.set_forest(vs::system::arterial, trees); })
-            .def("set_venous_forest", [](vs::synthesizer& self, const vs::synthesizer::forest& trees) { return self.set_forest(vs::system::venous, trees); })
+            .def("set_arterial_forest",  [](vs::synthesizer& self, const vs::synthesizer::forest& trees) { return self.set_forest(vs::system::arterial, trees); }, py::call_guard<py::gil_scoped_release>())
+            .def("set_venous_forest", [](vs::synthesizer& self, const vs::synthesizer::forest& trees) { return self.set_forest(vs::system::venous, trees); }, py::call_guard<py::gil_scoped_release>())
             .def("get_arterial_perftimes", [](vs::synthesizer& self) { return self.get_system_data(vs::system::arterial).m_profiler.get_samples(); })
-            .def("get_venous_perftimes", [](vs::synthesizer& self) { return self.get_system_data(vs::system::venous).m_profiler.get_samples(); });
+            .def("get_venous_perftimes", [](vs::synthesizer& self) { return self.get_system_data(vs::system::venous).m_profiler.get_samples(); })
+            .def("get_arterial_perftimes_matrix", [](vs::synthesizer& self) { return sample_matrix_to_numpy(self.get_system_data(vs::system::arterial).m_profiler); })
+            .def("get_venous_perftimes_matrix", [](vs::synthesizer& self) { return sample_matrix_to_numpy(self.get_system_data(vs::system::venous).m_profiler); })
+            .def("get_arterial_perftimes_ns", [](vs::synthesizer& self) { return samples_to_numpy(self.get_system_data(vs::system::arterial).m_profiler); })
+            .def("get_venous_perftimes_ns", [](vs::synthesizer& self) { return samples_to_numpy(self.get_system_data(vs::system::venous).m_profiler); })
+            .def("get_arterial_counters", [](vs::synthesizer& self) { return counters_to_numpy(self.get_system_data(vs::system::arterial).m_profiler); })
+            .def("get_venous_counters", [](vs::synthesizer& self) { return counters_to_numpy(self.get_system_data(vs::system::venous).m_profiler); })
+            .def("get_arterial_profile_tree", [](vs::synthesizer& self) { return self.get_system_data(vs::system::arterial).m_profiler.get_call_tree(); })
+            .def("get_venous_profile_tree", [](vs::synthesizer& self) { return self.get_system_data(vs::system::venous).m_profiler.get_call_tree(); })
+            .def("enable_hw_counters", [](vs::synthesizer& self)
+            {
+                bool arterial = self.get_system_data(vs::system::arterial).m_profiler.enable_hw_counters();
+                bool venous = self.get_system_data(vs::system::venous).m_profiler.enable_hw_counters();
+                return arterial && venous;
+            })
+            .def("disable_hw_counters", [](vs::synthesizer& self)
+            {
+                self.get_system_data(vs::system::arterial).m_profiler.disable_hw_counters();
+                self.get_system_data(vs::system::venous).m_profiler.disable_hw_counters();
+            })
+            .def("get_arterial_hw_counters", [](vs::synthesizer& self) { return hw_counters_to_numpy(self.get_system_data(vs::system::arterial).m_profiler); })
+            .def("get_venous_hw_counters", [](vs::synthesizer& self) { return hw_counters_to_numpy(self.get_system_data(vs::system::venous).m_profiler); })
+            .def("get_arterial_allocations", [](vs::synthesizer& self) { return allocations_to_numpy(self.get_system_data(vs::system::arterial).m_profiler); })
+            .def("get_venous_allocations", [](vs::synthesizer& self) { return allocations_to_numpy(self.get_system_data(vs::system::venous).m_profiler); })
+            .def("enable_tracing", [](vs::synthesizer& self, std::size_t capacity)
+            {
+                self.get_system_data(vs::system::arterial).m_profiler.enable_tracing(capacity);
+                self.get_system_data(vs::system::venous).m_profiler.enable_tracing(capacity);
+                self.get_settings().m_profiling = vs::prf::level::tracing;
+            }, py::arg("capacity") = 1 << 20)
+            .def("disable_tracing", [](vs::synthesizer& self)
+            {
+                self.get_system_data(vs::system::arterial).m_profiler.disable_tracing();
+                self.get_system_data(vs::system::venous).m_profiler.disable_tracing();
+                if(self.get_settings().m_profiling == vs::prf::level::tracing) { self.get_settings().m_profiling = vs::prf::level::scopes; }
+            })
+            .def("write_trace", [](vs::synthesizer& self, const std::string& path)
+            {
+                return vs::prf::write_chrome_trace(path, { &self.get_system_data(vs::system::arterial).m_profiler,
+                                                           &self.get_system_data(vs::system::venous).m_profiler });
+            });
 
 
     /****************************************************
      *                    Profiler                      *
      ****************************************************/
     py::class_<vs::prf::monitor>(m, "PerfMonitor")
-            .def_readonly_static("Enabled", &vs::prf::monitor::is_enabled);
+            .def_readonly_static("Enabled", &vs::prf::monitor::is_enabled)
+            .def_property_readonly_static("AllocTracking", [](py::object) { return vs::prf::monitor::tracks_allocations && vs::prf::has_allocation_hooks(); });
+
+    py::class_<vs::prf::monitor::call_node>(m, "ProfileNode")
+            .def_readonly("name", &vs::prf::monitor::call_node::m_name)
+            .def_property_readonly("inclusive", [](const vs::prf::monitor::call_node& self) { return times_to_numpy(self.m_inclusive); })
+            .def_property_readonly("exclusive", [](const vs::prf::monitor::call_node& self) { return times_to_numpy(self.m_exclusive); })
+            .def_readonly("children", &vs::prf::monitor::call_node::m_children)
+            .def("__getitem__", [](const vs::prf::monitor::call_node& self, const std::string& name)
+            {
+                for(const auto& child : self.m_children)
+                {
+                    if(child.m_name == name) { return child; }
+                }
+                throw py::key_error(name);
+            });
 
 }
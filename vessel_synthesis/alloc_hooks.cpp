@@ -0,0 +1,111 @@
+#include "profiler.h"
+
+#include <cstdlib>
+#include <new>
+
+/*
+ * ******************** [allocation hooks] ********************
+ * -> replaced global operator new/delete (malloc/free based); every allocation is counted for the innermost active
+ *    profiler scope of the thread (vs::prf::track_allocation), frees are not tracked
+ * -> cmake target vessel_alloc_hooks (VS_PROFILER_ALLOC); add its objects to executables only, never to a shared library
+ *      target_sources(my_benchmark PRIVATE $<TARGET_OBJECTS:vessel_alloc_hooks>)
+ */
+namespace
+{
+
+/* announces the replacement to the library (profiler.h: has_allocation_hooks()) */
+const bool s_installed = (vs::prf::set_allocation_hooks(true), true);
+
+void* aligned_malloc(std::size_t size, std::align_val_t alignment)
+{
+#ifdef _WIN32
+    return _aligned_malloc(size, static_cast<std::size_t>(alignment));
+#else
+    void* ptr = nullptr;
+    return (posix_memalign(&ptr, static_cast<std::size_t>(alignment), size) == 0) ? ptr : nullptr;
+#endif
+}
+
+void aligned_free(void* ptr)
+{
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    std::free(ptr);
+#endif
+}
+
+/* as the library versions: on failure the installed new_handler is called until it succeeds, throws or is unset */
+template<typename Allocate>
+void* tracked_new(std::size_t size, Allocate allocate)
+{
+    if(size == 0) { size = 1; }
+    for(;;)
+    {
+        if(auto* ptr = allocate(size))
+        {
+            vs::prf::track_allocation(size);
+            return ptr;
+        }
+
+        auto handler = std::get_new_handler();
+        if(!handler) { throw std::bad_alloc(); }
+        handler();
+    }
+}
+
+void* tracked_malloc(std::size_t size)
+{
+    return tracked_new(size, [](std::size_t n) { return std::malloc(n); });
+}
+
+void* tracked_aligned_malloc(std::size_t size, std::align_val_t alignment)
+{
+    return tracked_new(size, [alignment](std::size_t n) { return aligned_malloc(n, alignment); });
+}
+
+}
+
+void* operator new(std::size_t size) { return tracked_malloc(size); }
+void* operator new[](std::size_t size) { return tracked_malloc(size); }
+void* operator new(std::size_t size, std::align_val_t alignment) { return tracked_aligned_malloc(size, alignment); }
+void* operator new[](std::size_t size, std::align_val_t alignment) { return tracked_aligned_malloc(size, alignment); }
+
+/* nothrow versions call the throwing ones (new_handler included) */
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    try { return tracked_malloc(size); }
+    catch(...) { return nullptr; }
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    try { return tracked_malloc(size); }
+    catch(...) { return nullptr; }
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    try { return tracked_aligned_malloc(size, alignment); }
+    catch(...) { return nullptr; }
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    try { return tracked_aligned_malloc(size, alignment); }
+    catch(...) { return nullptr; }
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, std::align_val_t) noexcept { aligned_free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { aligned_free(ptr); }
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept { aligned_free(ptr); }
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept { aligned_free(ptr); }
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { aligned_free(ptr); }
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { aligned_free(ptr); }
@@ -0,0 +1,289 @@
+#include "arrays.h"
+
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace vs
+{
+
+void node_arrays::reserve(std::size_t count)
+{
+    m_positions.reserve(3 * count);
+    m_radii.reserve(count);
+    m_parents.reserve(count);
+    m_types.reserve(count);
+    m_ids.reserve(count);
+}
+
+void node_arrays::append(const binary_tree<node_data>& tree)
+{
+    reserve(size() + tree.size());
+
+    if(tree.size() > 0)
+    {
+        /* breadth first with the array index of the parent; no id -> index lookup necessary */
+        std::queue<std::pair<node_id, std::int32_t>> queue;
+        queue.emplace(tree.get_root().id(), -1);
+
+        while(!queue.empty())
+        {
+            auto [id, parent] = queue.front();
+            queue.pop();
+
+            const auto& n = tree.get_node(id);
+            auto index = static_cast<std::int32_t>(size());
+
+            m_positions.insert(m_positions.end(), { n.data().m_pos.x, n.data().m_pos.y, n.data().m_pos.z });
+            m_radii.push_back(n.data().m_radius);
+            m_parents.push_back(parent);
+            m_types.push_back(static_cast<std::uint8_t>(classify<node_data>(n)));
+            m_ids.push_back(id);
+
+            for(auto child : n.children())
+            {
+                if(child != not_a_node) { queue.emplace(child, index); }
+            }
+        }
+    }
+
+    m_offsets.push_back(static_cast<std::int64_t>(size()));
+}
+
+node_arrays to_arrays(const binary_tree<node_data>& tree)
+{
+    node_arrays arrays;
+    arrays.append(tree);
+    return arrays;
+}
+
+namespace
+{
+
+[[noreturn]] void invalid_node(std::size_t i, const std::string& reason)
+{
+    throw std::invalid_argument("node " + std::to_string(i) + ": " + reason);
+}
+
+}
+
+forest<node_data> from_arrays(const float* positions, const float* radii, const std::int64_t* parents,
+                              const std::int64_t* tree_ids, std::size_t count)
+{
+    /* validation and children in compressed row format */
+    std::vector<std::uint32_t> child_offsets(count + 1, 0);
+    std::vector<std::size_t> roots;
+
+    for(std::size_t i = 0; i < count; i++)
+    {
+        if(!std::isfinite(positions[3*i]) || !std::isfinite(positions[3*i + 1]) || !std::isfinite(positions[3*i + 2])) { invalid_node(i, "position is not finite"); }
+        if(!std::isfinite(radii[i]) || radii[i] < 0.0f) { invalid_node(i, "radius is negative or not finite"); }
+
+        auto parent = parents[i];
+        if(parent < 0)
+        {
+            roots.push_back(i);
+            continue;
+        }
+
+        if(parent >= static_cast<std::int64_t>(count)) { invalid_node(i, "parent index out of range"); }
+        if(static_cast<std::size_t>(parent) == i) { invalid_node(i, "node is its own parent"); }
+        if(tree_ids && tree_ids[parent] != tree_ids[i]) { invalid_node(i, "parent belongs to another tree"); }
+        if(++child_offsets[parent + 1] > 2) { invalid_node(parent, "more than two children"); }
+    }
+
+    if(tree_ids)
+    {
+        std::unordered_map<std::int64_t, std::size_t> root_of;
+        for(auto r : roots)
+        {
+            if(!root_of.emplace(tree_ids[r], r).second) { invalid_node(r, "second root of tree " + std::to_string(tree_ids[r])); }
+        }
+        for(std::size_t i = 0; i < count; i++)
+        {
+            if(root_of.find(tree_ids[i]) == root_of.end()) { invalid_node(i, "tree " + std::to_string(tree_ids[i]) + " has no root"); }
+        }
+    }
+
+    for(std::size_t i = 0; i < count; i++) { child_offsets[i + 1] += child_offsets[i]; }
+
+    std::vector<std::uint32_t> children(child_offsets.back());
+    {
+        auto fill = child_offsets;
+        for(std::size_t i = 0; i < count; i++)
+        {
+            if(parents[i] >= 0) { children[fill[parents[i]]++] = static_cast<std::uint32_t>(i); }
+        }
+    }
+
+    /* one breadth first pass per root; nodes not reached are part of a cycle */
+    forest<node_data> result;
+    std::vector<std::pair<std::uint32_t, node_id>> queue;
+    std::size_t visited = 0;
+
+    for(auto r : roots)
+    {
+        auto& tree = result.emplace_back();
+
+        queue.clear();
+        auto& root = tree.create_root(node_data{{positions[3*r], positions[3*r + 1], positions[3*r + 2]}, radii[r], &tree});
+        queue.emplace_back(static_cast<std::uint32_t>(r), root.id());
+
+        for(std::size_t q = 0; q < queue.size(); q++)
+        {
+            auto [row, id] = queue[q];
+            for(auto c = child_offsets[row]; c < child_offsets[row + 1]; c++)
+            {
+                auto child = children[c];
+                auto& n = tree.create_node(id, node_data{{positions[3*child], positions[3*child + 1], positions[3*child + 2]}, radii[child], &tree});
+                queue.emplace_back(child, n.id());
+            }
+        }
+
+        visited += queue.size();
+    }
+
+    if(visited != count)
+    {
+        throw std::invalid_argument("parents contain a cycle (" + std::to_string(count - visited) + " nodes not reachable from a root)");
+    }
+
+    return result;
+}
+
+node_arrays to_arrays(const forest<node_data>& trees)
+{
+    std::size_t count = 0;
+    for(const auto& tree : trees.trees()) { count += tree.size(); }
+
+    node_arrays arrays;
+    arrays.reserve(count);
+    for(const auto& tree : trees.trees()) { arrays.append(tree); }
+    return arrays;
+}
+
+node_orders to_orders(const node_arrays& arrays)
+{
+    const auto n = arrays.size();
+    const auto& parents = arrays.m_parents;
+
+    node_orders orders;
+    orders.m_depth_first.resize(n);
+    orders.m_post_order.resize(n);
+    orders.m_depths.resize(n);
+    orders.m_strahler.resize(n);
+    orders.m_subtree_begin.resize(n);
+    orders.m_subtree_end.resize(n);
+
+    /* bottom up (children have larger rows): subtree sizes and strahler order (max of children, count of max) */
+    std::vector<std::int32_t> sizes(n, 1);
+    std::vector<std::int32_t> child_max(n, 0);
+    std::vector<std::uint8_t> child_max_count(n, 0);
+
+    for(std::size_t i = n; i-- > 0;)
+    {
+        auto order = (child_max[i] == 0) ? 1 : child_max[i] + (child_max_count[i] > 1 ? 1 : 0);
+        orders.m_strahler[i] = order;
+
+        auto parent = parents[i];
+        if(parent < 0) { continue; }
+
+        sizes[parent] += sizes[i];
+        if(order > child_max[parent]) { child_max[parent] = order; child_max_count[parent] = 1; }
+        else if(order == child_max[parent]) { child_max_count[parent]++; }
+    }
+
+    /* top down: a child's subtree starts after the parent (pre-order) resp. where the parent's subtree starts (post-order),
+       shifted by the subtrees of its earlier siblings; rows of siblings are in child order */
+    std::vector<std::int32_t> next_pre(n), next_post(n);
+    std::int32_t roots = 0;
+
+    for(std::size_t i = 0; i < n; i++)
+    {
+        auto parent = parents[i];
+
+        std::int32_t pre, post_begin;
+        if(parent < 0)
+        {
+            orders.m_depths[i] = 0;
+            pre = post_begin = roots;
+            roots += sizes[i];
+        }
+        else
+        {
+            orders.m_depths[i] = orders.m_depths[parent] + 1;
+            pre = next_pre[parent];
+            post_begin = next_post[parent];
+            next_pre[parent] += sizes[i];
+            next_post[parent] += sizes[i];
+        }
+
+        next_pre[i] = pre + 1;
+        next_post[i] = post_begin;
+
+        orders.m_depth_first[pre] = static_cast<std::int32_t>(i);
+        orders.m_post_order[post_begin + sizes[i] - 1] = static_cast<std::int32_t>(i);
+        orders.m_subtree_begin[i] = pre;
+        orders.m_subtree_end[i] = pre + sizes[i];
+    }
+
+    return orders;
+}
+
+namespace
+{
+
+/* deletes the marked nodes of one tree; mask holds the rows of this tree (breadth first) */
+std::size_t delete_marked(binary_tree<node_data>& tree, const std::uint8_t* mask)
+{
+    if(tree.size() == 0) { return 0; }
+    if(mask[0]) { auto count = tree.size(); tree.clear(); return count; }
+
+    /* same breadth first order as node_arrays::append(); the queue index is the row */
+    std::vector<node_id> queue{tree.get_root().id()};
+    queue.reserve(tree.size());
+    std::vector<node_id> marked;
+
+    for(std::size_t q = 0; q < queue.size(); q++)
+    {
+        if(mask[q]) { marked.push_back(queue[q]); }
+        for(auto child : tree.get_node(queue[q]).children())
+        {
+            if(child != not_a_node) { queue.push_back(child); }
+        }
+    }
+
+    /* ancestors come first; nodes inside an already deleted subtree are skipped by delete_node() */
+    auto before = tree.size();
+    for(auto id : marked) { tree.delete_node(id); }
+    return before - tree.size();
+}
+
+}
+
+std::size_t delete_where(binary_tree<node_data>& tree, const std::uint8_t* mask, std::size_t count)
+{
+    if(count != tree.size()) { throw std::invalid_argument("mask size does not match the node count"); }
+
+    return delete_marked(tree, mask);
+}
+
+std::size_t delete_where(forest<node_data>& trees, const std::uint8_t* mask, std::size_t count)
+{
+    std::size_t total = 0;
+    for(const auto& tree : trees.trees()) { total += tree.size(); }
+    if(count != total) { throw std::invalid_argument("mask size does not match the node count"); }
+
+    std::size_t deleted = 0;
+    for(auto& tree : trees.trees())
+    {
+        auto size = tree.size();
+        deleted += delete_marked(tree, mask);
+        mask += size;
+    }
+    return deleted;
+}
+
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "binarytree.h"
+#include "forest.h"
+#include "points.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace vs
+{
+
+/* node classification of binary_tree::node (is_root(), is_inter(), is_joint(), is_leaf()); root takes precedence */
+enum class node_type : std::uint8_t { root = 0, inter = 1, joint = 2, leaf = 3 };
+
+template<typename Data>
+node_type classify(const typename binary_tree<Data>::node& n)
+{
+    if(n.is_root()) { return node_type::root; }
+    if(n.is_leaf()) { return node_type::leaf; }
+    return n.is_joint() ? node_type::joint : node_type::inter;
+}
+
+/*
+ * ******************** [node arrays] ********************
+ * -> structure of arrays of vessel nodes; contiguous buffers for export (numpy, file formats, ...)
+ *      - nodes are stored in breadth first order per tree (a parent is always stored before its children)
+ *      - m_parents holds indices into the arrays (-1 for roots), m_ids the node ids of the source tree
+ *      - m_offsets has one entry per tree plus the total count; tree i is [m_offsets[i], m_offsets[i+1])
+ *
+ * -> for forests all trees are concatenated; parent indices refer to the concatenated arrays
+ */
+struct node_arrays
+{
+    std::vector<float> m_positions;         // 3 * size()
+    std::vector<float> m_radii;
+    std::vector<std::int32_t> m_parents;
+    std::vector<std::uint8_t> m_types;
+    std::vector<node_id> m_ids;
+    std::vector<std::int64_t> m_offsets{0};
+
+public:
+    std::size_t size() const { return m_radii.size(); }
+    std::size_t tree_count() const { return m_offsets.size() - 1; }
+
+    void reserve(std::size_t count);
+    void append(const binary_tree<node_data>& tree);
+};
+
+node_arrays to_arrays(const binary_tree<node_data>& tree);
+node_arrays to_arrays(const forest<node_data>& trees);
+
+/*
+ * ******************** [node orders] ********************
+ * -> traversal orders and per node topology of node arrays; computed from m_parents in O(n) without the tree
+ *      - rows of node_arrays are already in breadth first order per tree
+ *      - m_depth_first / m_post_order: rows in the order of binary_tree::depth_first() / post_order() (tree by tree)
+ *      - m_depths: edges to the root; m_strahler: strahler order (leaves 1, joints of equal order increment)
+ *      - the subtree of row i is m_depth_first[m_subtree_begin[i], m_subtree_end[i])
+ *
+ * -> requires parents to be stored before their children (as written by to_arrays())
+ */
+struct node_orders
+{
+    std::vector<std::int32_t> m_depth_first;
+    std::vector<std::int32_t> m_post_order;
+    std::vector<std::int32_t> m_depths;
+    std::vector<std::int32_t> m_strahler;
+    std::vector<std::int32_t> m_subtree_begin;
+    std::vector<std::int32_t> m_subtree_end;
+};
+
+node_orders to_orders(const node_arrays& arrays);
+
+/*
+ * ******************** [delete where] ********************
+ * -> deletes all nodes with mask[row] != 0 together with their subtrees; rows as in to_arrays() of the same tree/forest
+ *      - deleting a root clears the tree (the tree stays in the forest)
+ *      - returns the number of deleted nodes; throws std::invalid_argument if count does not match the node count
+ */
+std::size_t delete_where(binary_tree<node_data>& tree, const std::uint8_t* mask, std::size_t count);
+std::size_t delete_where(forest<node_data>& trees, const std::uint8_t* mask, std::size_t count);
+
+/*
+ * ******************** [forest from arrays] ********************
+ * -> builds a forest from flat node arrays in one pass (inverse of to_arrays())
+ *      - positions (3 * count), radii (count), parents as row index (-1 for roots)
+ *      - tree_ids (optional, may be nullptr): tree of each node; otherwise every root starts a tree
+ *      - trees are ordered by the first occurrence of their root; node ids are assigned breadth first
+ *
+ * -> throws std::invalid_argument if the arrays do not describe a forest of binary trees
+ *    (non-finite values, negative radii, parent out of range or in another tree, more than two children,
+ *     not exactly one root per tree, cycles)
+ */
+forest<node_data> from_arrays(const float* positions, const float* radii, const std::int64_t* parents,
+                              const std::int64_t* tree_ids, std::size_t count);
+
+}
@@ -80,6 +80,27 @@ public:
         return iter->second;
     }
 
+    /* creates a node with a given id (e.g. reading a serialized tree); parent not_a_node creates the root */
+    template<typename ...Args>
+    node& restore_node(const node_id id, const node_id parent, Args&&... args)
+    {
+        assert(!exists(id));
+
+        auto [iter, _] = m_nodes.emplace(id, node(id, parent, std::move(args)...));
+        if(parent == not_a_node)
+        {
+            assert(m_root_id == not_a_node);
+            m_root_id = id;
+        }
+        else
+        {
+            attach_node(parent, iter->second);
+        }
+
+        m_next_id = std::max(m_next_id, id + 1);
+        return iter->second;
+    }
+
     void delete_node(const node_id id)
     {
         if(!exists(id)) { return; }
@@ -257,6 +278,11 @@ public:
         return m_nodes.size();
     }
 
+    void reserve(std::size_t count)
+    {
+        m_nodes.reserve(count);
+    }
+
     std::unordered_map<node_id, node>& get_all_nodes()
     {
         return m_nodes;
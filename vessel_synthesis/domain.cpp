@@ -5,6 +5,18 @@
 #include <glm/gtx/rotate_vector.hpp>
 #include <glm/gtx/quaternion.hpp>
 
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define VS_SCAN_SSE2
+#endif
+
 // DEBUG
 #include <iostream>
 #include <glm/gtx/string_cast.hpp>
@@ -40,6 +52,17 @@ glm::vec3 domain_circle::sample()
     return { m_center.x + r * glm::cos(theta), m_center.y + r * glm::sin(theta), 0.0 };
 }
 
+bool domain_circle::contains(const glm::vec3 &p) const
+{
+    glm::vec2 d = glm::vec2(p) - glm::vec2(m_center);
+    return glm::dot(d, d) <= m_radius*m_radius;
+}
+
+float domain_circle::volume() const
+{
+    return glm::pi<float>() * m_radius * m_radius;
+}
+
 glm::vec3 domain_circle::min_extends() const
 {
     return m_center - glm::vec3{m_radius, m_radius, m_radius};
@@ -75,6 +98,17 @@ glm::vec3 domain_sphere::sample()
     return m_center + pos * d * m_radius;
 }
 
+bool domain_sphere::contains(const glm::vec3 &p) const
+{
+    glm::vec3 d = p - m_center;
+    return glm::dot(d, d) <= m_radius*m_radius;
+}
+
+float domain_sphere::volume() const
+{
+    return 4.0f / 3.0f * glm::pi<float>() * m_radius * m_radius * m_radius;
+}
+
 glm::vec3 domain_sphere::min_extends() const
 {
     return m_center - glm::vec3{m_radius, m_radius, m_radius};
@@ -156,6 +190,40 @@ glm::vec3 domain_lines::sample()
     return (rotation * sample_circle) + length * m_distribution(m_generator) * dir + m_start[idx];
 }
 
+bool domain_lines::contains(const glm::vec3 &p) const
+{
+    /* sample() places points in a cylinder around each line; tests every line (O(lines), see header) */
+    if(glm::any(glm::lessThan(p, min_extends())) || glm::any(glm::greaterThan(p, max_extends()))) { return false; }
+
+    auto size = std::min(m_start.size(), m_end.size());
+    for(auto i = 0u; i < size; i++)
+    {
+        auto dir = m_end[i] - m_start[i];
+        float length2 = glm::dot(dir, dir);
+        if(length2 <= 0.0f) { continue; }
+
+        float t = glm::dot(p - m_start[i], dir) / length2;
+        if(t < 0.0f || t > 1.0f) { continue; }
+
+        auto d = p - (m_start[i] + t * dir);
+        if(glm::dot(d, d) <= m_deviation*m_deviation) { return true; }
+    }
+
+    return false;
+}
+
+float domain_lines::volume() const
+{
+    float v = 0.0f;
+    auto size = std::min(m_start.size(), m_end.size());
+    for(auto i = 0u; i < size; i++)
+    {
+        v += glm::length(m_end[i] - m_start[i]) * glm::pi<float>() * m_deviation * m_deviation;
+    }
+
+    return v;
+}
+
 glm::vec3 domain_lines::min_extends() const
 {
     return m_min - glm::vec3(m_deviation);
@@ -166,19 +234,36 @@ glm::vec3 domain_lines::max_extends() const
     return m_max + glm::vec3(m_deviation);
 }
 
+namespace
+{
+
+/* throws std::invalid_argument for a non-positive resolution or less than resolution.x*y*z voxels */
+glm::ivec3 checked_resolution(const glm::ivec3& resolution, std::size_t voxels = std::numeric_limits<std::size_t>::max())
+{
+    if(glm::any(glm::lessThanEqual(resolution, glm::ivec3(0)))) { throw std::invalid_argument("voxel resolution must be positive"); }
+
+    auto count = std::size_t(resolution.x) * resolution.y * resolution.z;
+    if(voxels < count)
+    {
+        throw std::invalid_argument("voxel mask has " + std::to_string(voxels) + " entries, resolution needs " + std::to_string(count));
+    }
+    return resolution;
+}
+
+}
+
 domain_voxels::domain_voxels(const glm::vec3& min, const glm::vec3& max, const glm::vec3& resolution, const std::vector<bool>& voxels)
-    : m_min(min), m_max(max), m_voxel_size((max-min) / resolution),
+    : m_min(min), m_max(max), m_resolution(checked_resolution(resolution, voxels.size())), m_voxel_size((max-min) / resolution),
+      m_voxel_mask(voxels.begin(), voxels.begin() + std::size_t(m_resolution.x)*m_resolution.y*m_resolution.z),
       m_generator(42), m_distribution(0.0, 1.0)
 {
-    assert(voxels.size() >= resolution.x*resolution.y*resolution.z);
-
-    for(int z = 0; z < resolution.z; z++)
+    for(int z = 0; z < m_resolution.z; z++)
     {
-        for(int y = 0; y < resolution.y; y++)
+        for(int y = 0; y < m_resolution.y; y++)
         {
-            for(int x = 0; x < resolution.x; x++)
+            for(int x = 0; x < m_resolution.x; x++)
             {
-                if(voxels[z*resolution.y*resolution.x + y*resolution.x + x])
+                if(voxels[(std::size_t(z)*m_resolution.y + y)*m_resolution.x + x])
                 {
                     glm::vec3 p = m_min + glm::vec3{(x + 0.5f)*m_voxel_size.x, (y + 0.5f)*m_voxel_size.y, (z + 0.5f)*m_voxel_size.z};
                     m_voxel_center.emplace_back(p);
@@ -188,11 +273,91 @@ domain_voxels::domain_voxels(const glm::vec3& min, const glm::vec3& max, const g
     }
 }
 
+namespace
+{
+
+/* appends the indices of all non-zero bytes */
+void scan_nonzero(const std::uint8_t* data, std::size_t n, std::vector<std::uint32_t>& result)
+{
+    std::size_t i = 0;
+
+#ifdef VS_SCAN_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for(; i + 16 <= n; i += 16)
+    {
+        auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        auto bits = ~static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, zero))) & 0xffffu;
+        for(; bits != 0; bits &= bits - 1)
+        {
+            result.push_back(static_cast<std::uint32_t>(i + std::countr_zero(bits)));
+        }
+    }
+#else
+    for(; i + 8 <= n; i += 8)
+    {
+        std::uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        if(word == 0) { continue; }
+
+        for(std::size_t j = i; j < i + 8; j++)
+        {
+            if(data[j]) { result.push_back(static_cast<std::uint32_t>(j)); }
+        }
+    }
+#endif
+
+    for(; i < n; i++)
+    {
+        if(data[i]) { result.push_back(static_cast<std::uint32_t>(i)); }
+    }
+}
+
+}
+
+domain_voxels::domain_voxels(const glm::vec3& min, const glm::vec3& max, const glm::ivec3& resolution, const std::uint8_t* mask, voxel_order order)
+    : m_min(min), m_max(max), m_resolution(checked_resolution(resolution)), m_voxel_size((max-min) / glm::vec3(resolution)),
+      m_voxel_mask(std::size_t(m_resolution.x)*m_resolution.y*m_resolution.z, false),
+      m_generator(42), m_distribution(0.0, 1.0)
+{
+    /* rows along the fastest axis of the mask; row r enumerates the remaining axes (y is always the faster one) */
+    const int axis = (order == voxel_order::fortran) ? 0 : 2;
+    const int outer = (order == voxel_order::fortran) ? 2 : 0;
+    const std::size_t row_length = m_resolution[axis];
+    const std::size_t rows = m_voxel_mask.size() / std::max<std::size_t>(row_length, 1);
+
+    std::vector<std::uint32_t> active;
+    active.reserve(row_length);
+
+    for(std::size_t r = 0; r < rows; r++)
+    {
+        active.clear();
+        scan_nonzero(mask + r*row_length, row_length, active);
+
+        glm::ivec3 v;
+        v.y = static_cast<int>(r % m_resolution.y);
+        v[outer] = static_cast<int>(r / m_resolution.y);
+
+        for(auto a : active)
+        {
+            v[axis] = static_cast<int>(a);
+            m_voxel_center.emplace_back(m_min + (glm::vec3(v) + 0.5f) * m_voxel_size);
+            m_voxel_mask[(std::size_t(v.z)*m_resolution.y + v.y)*m_resolution.x + v.x] = true;
+        }
+    }
+}
+
 domain_voxels::domain_voxels(const glm::vec3& min, const glm::vec3& max, const glm::vec3& resolution, const std::vector<glm::vec3>& voxels)
-    : m_min(min), m_max(max), m_voxel_size((max-min) / resolution), m_voxel_center(voxels),
+    : m_min(min), m_max(max), m_resolution(checked_resolution(resolution)), m_voxel_size((max-min) / resolution), m_voxel_center(voxels),
+      m_voxel_mask(std::size_t(m_resolution.x)*m_resolution.y*m_resolution.z, false),
       m_generator(42), m_distribution(0.0, 1.0)
 {
+    for(const auto& c : m_voxel_center)
+    {
+        glm::ivec3 v = glm::floor((c - m_min) / m_voxel_size);
+        if(glm::any(glm::lessThan(v, glm::ivec3(0))) || glm::any(glm::greaterThanEqual(v, m_resolution))) { continue; }
 
+        m_voxel_mask[(std::size_t(v.z)*m_resolution.y + v.y)*m_resolution.x + v.x] = true;
+    }
 }
 
 void domain_voxels::seed(unsigned int number)
@@ -216,6 +381,19 @@ glm::vec3 domain_voxels::sample()
     return sampled_voxel + offset;
 }
 
+bool domain_voxels::contains(const glm::vec3 &p) const
+{
+    glm::ivec3 v = glm::floor((p - m_min) / m_voxel_size);
+    if(glm::any(glm::lessThan(v, glm::ivec3(0))) || glm::any(glm::greaterThanEqual(v, m_resolution))) { return false; }
+
+    return m_voxel_mask[(std::size_t(v.z)*m_resolution.y + v.y)*m_resolution.x + v.x];
+}
+
+float domain_voxels::volume() const
+{
+    return m_voxel_center.size() * m_voxel_size.x * m_voxel_size.y * m_voxel_size.z;
+}
+
 glm::vec3 domain_voxels::min_extends() const
 {
     return m_min;
@@ -226,4 +404,494 @@ glm::vec3 domain_voxels::max_extends() const
     return m_max;
 }
 
+voxel_grid domain_voxels::grid() const
+{
+    return { m_min, m_max, m_resolution };
+}
+
+namespace
+{
+
+int tile_bit(const glm::ivec3& voxel)
+{
+    constexpr int mask = domain_sparse_voxels::tile_dim - 1;
+    return (voxel.x & mask) + domain_sparse_voxels::tile_dim * ((voxel.y & mask) + domain_sparse_voxels::tile_dim * (voxel.z & mask));
+}
+
+}
+
+std::size_t domain_sparse_voxels::tile_hash::operator()(const glm::ivec3& coord) const
+{
+    /* multiplicative mixing of the three coordinates (large odd constants) */
+    auto h = static_cast<std::uint64_t>(static_cast<std::uint32_t>(coord.x)) * 0x9e3779b97f4a7c15ull;
+    h ^= static_cast<std::uint64_t>(static_cast<std::uint32_t>(coord.y)) * 0xc2b2ae3d27d4eb4full;
+    h ^= static_cast<std::uint64_t>(static_cast<std::uint32_t>(coord.z)) * 0x165667b19e3779f9ull;
+    return static_cast<std::size_t>(h ^ (h >> 29));
+}
+
+domain_sparse_voxels::domain_sparse_voxels(const glm::vec3 &origin, const glm::vec3 &voxel_size)
+    : m_origin(origin), m_voxel_size(voxel_size),
+      m_min_voxel(std::numeric_limits<int>::max()), m_max_voxel(std::numeric_limits<int>::lowest()),
+      m_generator(42), m_distribution(0.0, 1.0)
+{
+
+}
+
+domain_sparse_voxels::domain_sparse_voxels(const glm::vec3& min, const glm::vec3& max, const glm::vec3& resolution, const std::vector<bool>& voxels)
+    : domain_sparse_voxels(min, (max-min) / resolution)
+{
+    glm::ivec3 res = checked_resolution(resolution, voxels.size());
+
+    std::size_t idx = 0;
+    for(int z = 0; z < res.z; z++)
+    {
+        for(int y = 0; y < res.y; y++)
+        {
+            for(int x = 0; x < res.x; x++)
+            {
+                if(voxels[idx++]) { activate(glm::ivec3{x, y, z}); }
+            }
+        }
+    }
+}
+
+domain_sparse_voxels::domain_sparse_voxels(const glm::vec3& min, const glm::vec3& max, const glm::vec3& resolution, const std::vector<glm::vec3>& voxels)
+    : domain_sparse_voxels(min, (max-min) / resolution)
+{
+    for(const auto& c : voxels)
+    {
+        activate(c);
+    }
+}
+
+void domain_sparse_voxels::seed(unsigned int number)
+{
+    m_generator.seed(number);
+}
+
+glm::vec3 domain_sparse_voxels::sample()
+{
+    if(m_tiles.empty()) { throw std::runtime_error("sparse voxel domain: no active voxel to sample"); }
+
+    if(m_cumulative_dirty) { update_cumulative(); }
+
+    /* pick tile by cumulative active count */
+    std::uniform_int_distribution<std::uint64_t> pick(0, m_cumulative.back() - 1);
+    auto n = pick(m_generator);
+    auto iter = std::upper_bound(m_cumulative.begin(), m_cumulative.end(), n);
+    auto tile_idx = std::distance(m_cumulative.begin(), iter);
+    const auto& t = m_tiles[tile_idx];
+
+    /* pick the n-th active voxel in the tile */
+    auto rank = n - (tile_idx > 0 ? m_cumulative[tile_idx - 1] : 0);
+    int bit = 0;
+    for(std::size_t w = 0; w < t.m_mask.size(); w++)
+    {
+        auto word = t.m_mask[w];
+        auto count = static_cast<std::uint64_t>(std::popcount(word));
+        if(rank >= count) { rank -= count; continue; }
+
+        for(; rank > 0; rank--) { word &= word - 1; }
+        bit = static_cast<int>(w * 64) + std::countr_zero(word);
+        break;
+    }
+
+    glm::ivec3 voxel = t.m_coord * tile_dim + glm::ivec3{ bit % tile_dim, (bit / tile_dim) % tile_dim, bit / (tile_dim*tile_dim) };
+
+    glm::vec3 offset =
+    {
+        m_distribution(m_generator),
+        m_distribution(m_generator),
+        m_distribution(m_generator)
+    };
+
+    return m_origin + (glm::vec3(voxel) + offset) * m_voxel_size;
+}
+
+bool domain_sparse_voxels::contains(const glm::vec3 &p) const
+{
+    return is_active(voxel_index(p));
+}
+
+float domain_sparse_voxels::volume() const
+{
+    return active_count() * m_voxel_size.x * m_voxel_size.y * m_voxel_size.z;
+}
+
+glm::vec3 domain_sparse_voxels::min_extends() const
+{
+    if(m_tiles.empty()) { return m_origin; }
+    return m_origin + glm::vec3(m_min_voxel) * m_voxel_size;
+}
+
+glm::vec3 domain_sparse_voxels::max_extends() const
+{
+    if(m_tiles.empty()) { return m_origin; }
+    return m_origin + glm::vec3(m_max_voxel + 1) * m_voxel_size;
+}
+
+void domain_sparse_voxels::activate(const glm::ivec3 &voxel)
+{
+    glm::ivec3 coord = voxel >> tile_log2;
+    auto [iter, inserted] = m_tile_lookup.try_emplace(coord, static_cast<std::uint32_t>(m_tiles.size()));
+    if(inserted)
+    {
+        m_tiles.emplace_back().m_coord = coord;
+    }
+
+    auto& t = m_tiles[iter->second];
+    int bit = tile_bit(voxel);
+    auto& word = t.m_mask[bit >> 6];
+    auto flag = std::uint64_t(1) << (bit & 63);
+    if(word & flag) { return; }
+
+    word |= flag;
+    t.m_count++;
+
+    m_min_voxel = glm::min(m_min_voxel, voxel);
+    m_max_voxel = glm::max(m_max_voxel, voxel);
+    m_cumulative_dirty = true;
+    m_generation++;
+}
+
+void domain_sparse_voxels::activate(const glm::vec3 &p)
+{
+    activate(voxel_index(p));
+}
+
+bool domain_sparse_voxels::is_active(const glm::ivec3 &voxel) const
+{
+    auto search = m_tile_lookup.find(voxel >> tile_log2);
+    if(search == m_tile_lookup.end()) { return false; }
+
+    int bit = tile_bit(voxel);
+    return (m_tiles[search->second].m_mask[bit >> 6] >> (bit & 63)) & 1u;
+}
+
+glm::ivec3 domain_sparse_voxels::voxel_index(const glm::vec3 &p) const
+{
+    return glm::floor((p - m_origin) / m_voxel_size);
+}
+
+std::size_t domain_sparse_voxels::active_count() const
+{
+    std::size_t count = 0;
+    for(const auto& t : m_tiles) { count += t.m_count; }
+    return count;
+}
+
+std::size_t domain_sparse_voxels::tile_count() const
+{
+    return m_tiles.size();
+}
+
+void domain_sparse_voxels::update_cumulative()
+{
+    m_cumulative.resize(m_tiles.size());
+
+    std::uint64_t sum = 0;
+    for(std::size_t i = 0; i < m_tiles.size(); i++)
+    {
+        sum += m_tiles[i].m_count;
+        m_cumulative[i] = sum;
+    }
+
+    m_cumulative_dirty = false;
+}
+
+domain_composite::domain_composite(const std::vector<domain_ref>& children)
+    : m_children(children), m_generator(42), m_distribution(0.0, 1.0)
+{
+    assert(!m_children.empty());
+}
+
+void domain_composite::seed(unsigned int number)
+{
+    m_generator.seed(number);
+}
+
+bool domain_composite::contains(const glm::vec3 &p) const
+{
+    refresh();
+    return inside(p);
+}
+
+float domain_composite::volume() const
+{
+    refresh();
+    return m_proposal_volume * acceptance_rate();
+}
+
+glm::vec3 domain_composite::min_extends() const
+{
+    refresh();
+    return m_min;
+}
+
+glm::vec3 domain_composite::max_extends() const
+{
+    refresh();
+    return m_max;
+}
+
+std::uint64_t domain_composite::generation() const
+{
+    /* sum of monotonic counters */
+    std::uint64_t sum = m_generation;
+    for(const auto& c : m_children) { sum += c.get().generation(); }
+    return sum;
+}
+
+float domain_composite::acceptance_rate() const
+{
+    /* monte carlo estimate acts as prior for the observed acceptance */
+    return static_cast<float>( (m_acceptance * estimate_samples + m_accepted) / (estimate_samples + m_tries) );
+}
+
+void domain_composite::refresh() const
+{
+    auto current = generation();
+    if(m_built_generation.load(std::memory_order_acquire) == current) { return; }
+
+    std::lock_guard lock(m_build_mutex);
+    if(m_built_generation.load(std::memory_order_relaxed) == current) { return; }
+
+    m_child_min.clear();
+    m_child_max.clear();
+    for(const auto& c : m_children)
+    {
+        m_child_min.emplace_back(c.get().min_extends());
+        m_child_max.emplace_back(c.get().max_extends());
+    }
+
+    m_min = glm::vec3(std::numeric_limits<float>::max());
+    m_max = glm::vec3(-std::numeric_limits<float>::max());
+    m_proposal_volume = 0.0f;
+    build();
+    estimate_acceptance();
+
+    m_built_generation.store(current, std::memory_order_release);
+}
+
+bool domain_composite::child_contains(std::size_t idx, const glm::vec3 &p) const
+{
+    if(glm::any(glm::lessThan(p, m_child_min[idx])) || glm::any(glm::greaterThan(p, m_child_max[idx]))) { return false; }
+    return m_children[idx].get().contains(p);
+}
+
+void domain_composite::estimate_acceptance() const
+{
+    /* own generator; children are not sampled so their random sequence is not changed */
+    std::mt19937 generator(42);
+    std::uniform_real_distribution<float> distribution(0.0, 1.0);
+
+    glm::vec3 extends = glm::max(m_max - m_min, glm::vec3(0.0f));
+    float box_volume = extends.x * extends.y * extends.z;
+
+    unsigned int hits = 0;
+    for(unsigned int i = 0; i < estimate_samples; i++)
+    {
+        glm::vec3 p = m_min + extends * glm::vec3{ distribution(generator), distribution(generator), distribution(generator) };
+        if(inside(p)) { hits++; }
+    }
+
+    float volume = box_volume * hits / estimate_samples;
+    m_acceptance = (m_proposal_volume > 0.0f) ? std::min(1.0, double(volume) / m_proposal_volume) : 1.0;
+    m_tries = 0;
+    m_accepted = 0;
+}
+
+void domain_composite::record_try(bool accepted)
+{
+    m_tries++;
+    m_accepted += accepted;
+}
+
+std::uint64_t domain_composite::max_tries() const
+{
+    float rate = std::max(acceptance_rate(), 1e-4f);
+    return std::max<std::uint64_t>(min_tries, static_cast<std::uint64_t>(64.0f / rate));
+}
+
+void domain_composite::sampling_failed(std::uint64_t tries) const
+{
+    throw std::runtime_error("composite domain: no sample accepted in " + std::to_string(tries) + " tries (empty domain?)");
+}
+
+domain_union::domain_union(const std::vector<domain_ref>& children)
+    : domain_composite(children)
+{
+    refresh();
+}
+
+void domain_union::build() const
+{
+    std::vector<float> weights;
+    for(std::size_t i = 0; i < m_children.size(); i++)
+    {
+        weights.emplace_back(m_children[i].get().volume());
+        m_proposal_volume += weights.back();
+
+        m_min = glm::min(m_min, m_child_min[i]);
+        m_max = glm::max(m_max, m_child_max[i]);
+    }
+    m_child_distribution = std::discrete_distribution<std::size_t>(weights.begin(), weights.end());
+}
+
+glm::vec3 domain_union::sample()
+{
+    refresh();
+
+    auto max = max_tries();
+    for(std::uint64_t t = 0; t < max; t++)
+    {
+        auto idx = m_child_distribution(m_generator);
+        auto p = m_children[idx].get().sample();
+
+        /* number of children covering the sample; the sampled child always counts */
+        int count = 1;
+        for(std::size_t i = 0; i < m_children.size(); i++)
+        {
+            if(i != idx && child_contains(i, p)) { count++; }
+        }
+
+        bool accept = (count == 1) || (m_distribution(m_generator) * count < 1.0f);
+        record_try(accept);
+        if(accept) { return p; }
+    }
+
+    sampling_failed(max);
+}
+
+bool domain_union::inside(const glm::vec3 &p) const
+{
+    for(std::size_t i = 0; i < m_children.size(); i++)
+    {
+        if(child_contains(i, p)) { return true; }
+    }
+    return false;
+}
+
+domain_intersection::domain_intersection(const std::vector<domain_ref>& children)
+    : domain_composite(children)
+{
+    refresh();
+}
+
+void domain_intersection::build() const
+{
+    m_min = m_child_min.front();
+    m_max = m_child_max.front();
+
+    m_proposal_volume = std::numeric_limits<float>::max();
+    for(std::size_t i = 0; i < m_children.size(); i++)
+    {
+        float v = m_children[i].get().volume();
+        if(v < m_proposal_volume)
+        {
+            m_proposal_volume = v;
+            m_proposal = i;
+        }
+
+        m_min = glm::max(m_min, m_child_min[i]);
+        m_max = glm::min(m_max, m_child_max[i]);
+    }
+    m_max = glm::max(m_min, m_max);
+}
+
+glm::vec3 domain_intersection::sample()
+{
+    refresh();
+
+    auto max = max_tries();
+    for(std::uint64_t t = 0; t < max; t++)
+    {
+        auto p = m_children[m_proposal].get().sample();
+
+        bool accept = true;
+        for(std::size_t i = 0; i < m_children.size() && accept; i++)
+        {
+            if(i != m_proposal) { accept = child_contains(i, p); }
+        }
+
+        record_try(accept);
+        if(accept) { return p; }
+    }
+
+    sampling_failed(max);
+}
+
+bool domain_intersection::inside(const glm::vec3 &p) const
+{
+    for(std::size_t i = 0; i < m_children.size(); i++)
+    {
+        if(!child_contains(i, p)) { return false; }
+    }
+    return true;
+}
+
+namespace
+{
+
+std::vector<domain_composite::domain_ref> difference_children(domain& base, const std::vector<domain_composite::domain_ref>& subtracted)
+{
+    std::vector<domain_composite::domain_ref> children{ std::ref(base) };
+    children.insert(children.end(), subtracted.begin(), subtracted.end());
+    return children;
+}
+
+}
+
+domain_difference::domain_difference(domain &base, const std::vector<domain_ref>& subtracted)
+    : domain_composite(difference_children(base, subtracted))
+{
+    refresh();
+}
+
+domain_difference::domain_difference(domain &base, domain &subtracted)
+    : domain_difference(base, std::vector<domain_ref>{ std::ref(subtracted) })
+{
+
+}
+
+void domain_difference::build() const
+{
+    m_min = m_child_min.front();
+    m_max = m_child_max.front();
+    m_proposal_volume = m_children.front().get().volume();
+}
+
+glm::vec3 domain_difference::sample()
+{
+    refresh();
+
+    auto max = max_tries();
+    for(std::uint64_t t = 0; t < max; t++)
+    {
+        auto p = m_children.front().get().sample();
+
+        bool accept = true;
+        for(std::size_t i = 1; i < m_children.size() && accept; i++)
+        {
+            accept = !child_contains(i, p);
+        }
+
+        record_try(accept);
+        if(accept) { return p; }
+    }
+
+    sampling_failed(max);
+}
+
+bool domain_difference::inside(const glm::vec3 &p) const
+{
+    if(!child_contains(0, p)) { return false; }
+
+    for(std::size_t i = 1; i < m_children.size(); i++)
+    {
+        if(child_contains(i, p)) { return false; }
+    }
+    return true;
+}
+
 }
@@ -2,20 +2,31 @@
 
 #include <glm/glm.hpp>
 
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <mutex>
 #include <random>
+#include <unordered_map>
 #include <vector>
 
 namespace vs
 {
 /*
  * ******************** [domain] ********************
- * - domains are solely defined by sampling points
- *      i.e. there is currently no enforcement of boundaries
+ * - domains are defined by sampling points
+ *      i.e. boundaries are only enforced if enabled in the synthesizer settings (signed distance grid from contains())
  *
  *  - sample() creates a 3d point in space that is used by synthesizer to place attraction points
+ *  - contains() tests if a point lies inside the domain (i.e. could have been created by sample())
  *  - min_extends() and max_extends() are needed for the oc-tree
+ *  - volume() is used to weight domains against each other (e.g. for composite domains)
  *  - the result of the synthesizer is uniquely determined by the seed in the domain
  *      --> careful: std random are not standardized over platforms!
+ *  - generation() changes whenever the geometry changes (e.g. domain_sparse_voxels::activate());
+ *    caches derived from contains() (the synthesizer's signed distance grid) are rebuilt when it differs
  */
 struct domain
 {
@@ -23,13 +34,23 @@ struct domain
 
     virtual void seed(unsigned int number) = 0;
     virtual glm::vec3 sample() = 0;
+    virtual bool contains(const glm::vec3& p) const = 0;
+    virtual float volume() const = 0;
     virtual glm::vec3 min_extends() const = 0;
     virtual glm::vec3 max_extends() const = 0;
+    virtual std::uint64_t generation() const { return m_generation; }
 
     void samples(std::vector<glm::vec3>& points, std::size_t count);
+
+protected:
+    std::uint64_t m_generation{0};
 };
 
 
+/*
+ * ******************** [circle domain] ********************
+ * -> 2d disk in the xy-plane; contains() ignores the z coordinate and volume() is the area
+ */
 struct domain_circle : public domain
 {
 private:
@@ -45,6 +66,8 @@ public:
 
     void seed(unsigned int number = 42) override;
     glm::vec3 sample() override;
+    bool contains(const glm::vec3& p) const override;
+    float volume() const override;
     virtual glm::vec3 min_extends() const override;
     virtual glm::vec3 max_extends() const override;
 };
@@ -66,6 +89,8 @@ public:
 
     void seed(unsigned int number = 42) override;
     glm::vec3 sample() override;
+    bool contains(const glm::vec3& p) const override;
+    float volume() const override;
     virtual glm::vec3 min_extends() const override;
     virtual glm::vec3 max_extends() const override;
 };
@@ -73,6 +98,8 @@ public:
 /*
  * ******************** [line domain] ********************
  * -> this can be used to develop an initial tree; not really ideal/working (more of a proof-of-concept)
+ * -> contains() tests every line after a bounding box check (O(lines)); meant for a few lines, not for dense
+ *    centerlines (boundary grids call it once per cell; use voxel domains there)
  */
 struct domain_lines : public domain
 {
@@ -94,14 +121,40 @@ public:
 
     void seed(unsigned int number = 42) override;
     glm::vec3 sample() override;
+    bool contains(const glm::vec3& p) const override;
+    float volume() const override;
     virtual glm::vec3 min_extends() const override;
     virtual glm::vec3 max_extends() const override;
 };
 
+/* memory layout of a voxel mask[x][y][z]: fortran (x fastest) or c (z fastest) */
+enum class voxel_order : int { fortran = 0, c = 1 };
+
+/* regular grid of m_resolution voxels over [m_min, m_max]; voxel (x, y, z) is centered at m_min + ((x, y, z) + 0.5) * voxel_size() */
+struct voxel_grid
+{
+    glm::vec3 m_min;
+    glm::vec3 m_max;
+    glm::ivec3 m_resolution;
+
+public:
+    glm::vec3 voxel_size() const { return (m_max - m_min) / glm::vec3(m_resolution); }
+    std::size_t count() const { return std::size_t(m_resolution.x) * m_resolution.y * m_resolution.z; }
+
+    std::size_t index(int x, int y, int z, voxel_order order) const
+    {
+        return (order == voxel_order::fortran) ? (std::size_t(z) * m_resolution.y + y) * m_resolution.x + x
+                                               : (std::size_t(x) * m_resolution.y + y) * m_resolution.z + z;
+    }
+};
+
 /*
  * ******************** [voxel domain] ********************
- * -> either by boolean array indicating voxel locations (true)
+ * -> either by boolean array indicating voxel locations (true; x fastest)
+ * -> or by a byte mask (non-zero) in fortran or c order; scanned 16 bytes at a time (sse2, otherwise 8 byte words)
  * -> or directly feedings voxel centers
+ * -> throws std::invalid_argument for a non-positive resolution or a boolean array smaller than the resolution
+ *    (also domain_sparse_voxels)
  */
 struct domain_voxels : public domain
 {
@@ -109,22 +162,225 @@ private:
     glm::vec3 m_min;
     glm::vec3 m_max;
 
+    glm::ivec3 m_resolution;
     glm::vec3 m_voxel_size;
     std::vector<glm::vec3> m_voxel_center;
+    std::vector<bool> m_voxel_mask;
 
     std::mt19937 m_generator;
     std::uniform_real_distribution<float> m_distribution;
 
 public:
     domain_voxels(const glm::vec3& min, const glm::vec3& max, const glm::vec3& resolution, const std::vector<bool>& voxels);
+    domain_voxels(const glm::vec3& min, const glm::vec3& max, const glm::ivec3& resolution, const std::uint8_t* mask, voxel_order order);
     domain_voxels(const glm::vec3& min, const glm::vec3& max, const glm::vec3& resolution, const std::vector<glm::vec3>& voxels);
     ~domain_voxels() = default;
 
     void seed(unsigned int number = 42) override;
     glm::vec3 sample() override;
+    bool contains(const glm::vec3& p) const override;
+    float volume() const override;
+    virtual glm::vec3 min_extends() const override;
+    virtual glm::vec3 max_extends() const override;
+
+    voxel_grid grid() const;
+};
+
+/*
+ * ******************** [sparse voxel domain] ********************
+ * -> two-level sparse grid for very large volumes (e.g. whole organs at high resolution)
+ *      - active voxels are stored as bitmasks in 8x8x8 tiles, with an active count per tile
+ *      - tiles are looked up by a hash of their tile coordinate --> contains() is O(1)
+ *      - memory scales with the number of occupied tiles, not with the bounding box
+ *
+ * -> sample() picks a tile by its cumulative active count and then the n-th active voxel within the tile;
+ *    throws std::runtime_error if no voxel is active
+ * -> min_extends() and max_extends() are the tight bounds of the active voxels
+ */
+struct domain_sparse_voxels : public domain
+{
+    static constexpr int tile_log2 = 3;
+    static constexpr int tile_dim = 1 << tile_log2;
+    static constexpr int tile_voxels = tile_dim * tile_dim * tile_dim;
+
+    struct tile
+    {
+        glm::ivec3 m_coord;
+        std::array<std::uint64_t, tile_voxels / 64> m_mask{};
+        std::uint32_t m_count{0};
+    };
+
+    /* full tile coordinate as key, so distant tiles never share an entry */
+    struct tile_hash
+    {
+        std::size_t operator()(const glm::ivec3& coord) const;
+    };
+
+private:
+    glm::vec3 m_origin;
+    glm::vec3 m_voxel_size;
+
+    glm::ivec3 m_min_voxel;
+    glm::ivec3 m_max_voxel;
+
+    std::vector<tile> m_tiles;
+    std::unordered_map<glm::ivec3, std::uint32_t, tile_hash> m_tile_lookup;
+
+    std::vector<std::uint64_t> m_cumulative;
+    bool m_cumulative_dirty{true};
+
+    std::mt19937 m_generator;
+    std::uniform_real_distribution<float> m_distribution;
+
+public:
+    domain_sparse_voxels(const glm::vec3& origin, const glm::vec3& voxel_size);
+    domain_sparse_voxels(const glm::vec3& min, const glm::vec3& max, const glm::vec3& resolution, const std::vector<bool>& voxels);
+    domain_sparse_voxels(const glm::vec3& min, const glm::vec3& max, const glm::vec3& resolution, const std::vector<glm::vec3>& voxels);
+    ~domain_sparse_voxels() = default;
+
+    void seed(unsigned int number = 42) override;
+    glm::vec3 sample() override;
+    bool contains(const glm::vec3& p) const override;
+    float volume() const override;
+    virtual glm::vec3 min_extends() const override;
+    virtual glm::vec3 max_extends() const override;
+
+    void activate(const glm::ivec3& voxel);
+    void activate(const glm::vec3& p);
+    bool is_active(const glm::ivec3& voxel) const;
+
+    glm::ivec3 voxel_index(const glm::vec3& p) const;
+    std::size_t active_count() const;
+    std::size_t tile_count() const;
+
+private:
+    void update_cumulative();
+};
+
+/*
+ * ******************** [composite domains] ********************
+ * -> constructive solid geometry over existing domains, based on contains() tests
+ *      e.g. "organ minus tumour" or the union of several lobes
+ * -> child domains are referenced and need to outlive the composite (same as for the synthesizer)
+ *
+ *  - union: picks a child weighted by its volume and accepts its sample with 1/(number of children containing it);
+ *           this keeps the samples uniform in overlapping regions
+ *  - intersection: samples the smallest child and rejects samples outside of the other children
+ *  - difference: samples the first child and rejects samples inside of the subtracted children
+ *
+ * -> children are only tested by contains() if a point lies within their bounding box
+ * -> the acceptance rate is estimated once (monte carlo in the bounding box) and refined while sampling;
+ *    it bounds the number of rejection tries and gives the volume estimate of the composite
+ * -> bounding boxes, volumes and the acceptance estimate are rebuilt on the next call when the generation of a
+ *    child changed (e.g. domain_sparse_voxels::activate()); the rebuild is locked, so contains() stays thread safe
+ * -> sample() throws std::runtime_error if no sample is accepted within these tries (e.g. disjoint intersection)
+ * -> seed() only seeds the composite (child selection, union acceptance); children may be shared and keep their seed
+ */
+struct domain_composite : public domain
+{
+    using domain_ref = std::reference_wrapper<domain>;
+
+protected:
+    std::vector<domain_ref> m_children;
+
+    /* derived from the children for m_built_generation (refresh()) */
+    mutable std::vector<glm::vec3> m_child_min;
+    mutable std::vector<glm::vec3> m_child_max;
+
+    mutable glm::vec3 m_min;
+    mutable glm::vec3 m_max;
+
+    mutable float m_proposal_volume{0.0f};
+    mutable double m_acceptance{1.0};
+    mutable std::uint64_t m_tries{0};
+    mutable std::uint64_t m_accepted{0};
+
+    mutable std::atomic<std::uint64_t> m_built_generation{std::numeric_limits<std::uint64_t>::max()};
+    mutable std::mutex m_build_mutex;
+
+    std::mt19937 m_generator;
+    std::uniform_real_distribution<float> m_distribution;
+
+public:
+    static constexpr unsigned int estimate_samples = 4096;
+    static constexpr unsigned int min_tries = 64;
+
+    domain_composite(const std::vector<domain_ref>& children);
+    virtual ~domain_composite() = default;
+
+    void seed(unsigned int number = 42) override;
+    bool contains(const glm::vec3& p) const override;
+    float volume() const override;
     virtual glm::vec3 min_extends() const override;
     virtual glm::vec3 max_extends() const override;
+    /* changes with the generation of any child */
+    std::uint64_t generation() const override;
+
+    float acceptance_rate() const;
+
+protected:
+    /* rebuilds the derived state if the children changed; called first by every public function */
+    void refresh() const;
+    /* bounds and proposal volume of the operation from the child boxes (m_min, m_max, m_proposal_volume) */
+    virtual void build() const = 0;
+    /* contains() without refresh() */
+    virtual bool inside(const glm::vec3& p) const = 0;
+
+    bool child_contains(std::size_t idx, const glm::vec3& p) const;
+
+    void estimate_acceptance() const;
+    void record_try(bool accepted);
+    std::uint64_t max_tries() const;
+    [[noreturn]] void sampling_failed(std::uint64_t tries) const;
+};
+
+
+struct domain_union : public domain_composite
+{
+private:
+    mutable std::discrete_distribution<std::size_t> m_child_distribution;
+
+public:
+    domain_union(const std::vector<domain_ref>& children);
+    ~domain_union() = default;
+
+    glm::vec3 sample() override;
+
+protected:
+    void build() const override;
+    bool inside(const glm::vec3& p) const override;
+};
+
+
+struct domain_intersection : public domain_composite
+{
+private:
+    mutable std::size_t m_proposal{0};
+
+public:
+    domain_intersection(const std::vector<domain_ref>& children);
+    ~domain_intersection() = default;
+
+    glm::vec3 sample() override;
+
+protected:
+    void build() const override;
+    bool inside(const glm::vec3& p) const override;
+};
+
+
+struct domain_difference : public domain_composite
+{
+public:
+    domain_difference(domain& base, const std::vector<domain_ref>& subtracted);
+    domain_difference(domain& base, domain& subtracted);
+    ~domain_difference() = default;
+
+    glm::vec3 sample() override;
 
+protected:
+    void build() const override;
+    bool inside(const glm::vec3& p) const override;
 };
 
 }
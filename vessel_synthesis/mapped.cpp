@@ -0,0 +1,253 @@
+#include "mapped.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace vs
+{
+
+namespace
+{
+
+static_assert(sizeof(mapped_header) == 80, "unexpected padding in mapped_header");
+
+constexpr std::uint64_t alignment = 64;
+
+std::uint64_t align(std::uint64_t offset)
+{
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+/* element size of every section */
+constexpr std::uint64_t element_sizes[6] = { sizeof(std::int64_t), 3 * sizeof(float), sizeof(float), sizeof(std::int32_t), sizeof(std::uint8_t), sizeof(node_id) };
+
+std::uint64_t section_count(int s, std::uint64_t trees, std::uint64_t nodes)
+{
+    return (s == 0) ? trees + 1 : nodes;
+}
+
+[[noreturn]] void malformed(const std::string& reason)
+{
+    throw std::invalid_argument("malformed mapped forest: " + reason);
+}
+
+}
+
+mapped_forest::mapped_forest(const std::string& path)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file == INVALID_HANDLE_VALUE) { throw std::runtime_error("can not open " + path); }
+
+    LARGE_INTEGER size;
+    GetFileSizeEx(file, &size);
+    m_size = static_cast<std::size_t>(size.QuadPart);
+
+    if(m_size > 0)
+    {
+        m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if(m_mapping) { m_data = static_cast<const std::byte*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0)); }
+    }
+    CloseHandle(file);
+#else
+    int file = ::open(path.c_str(), O_RDONLY);
+    if(file < 0) { throw std::runtime_error("can not open " + path); }
+
+    struct stat status;
+    m_size = (::fstat(file, &status) == 0) ? static_cast<std::size_t>(status.st_size) : 0;
+
+    if(m_size > 0)
+    {
+        void* data = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if(data != MAP_FAILED) { m_data = static_cast<const std::byte*>(data); }
+    }
+    ::close(file);
+#endif
+
+    if(!m_data)
+    {
+        unmap();
+        throw std::runtime_error("can not map " + path);
+    }
+
+    /* header only; the mapping is aligned to pages, so the sections are aligned as well */
+    try
+    {
+        if(m_size < sizeof(mapped_header)) { malformed("file too small"); }
+        m_header = reinterpret_cast<const mapped_header*>(m_data);
+
+        mapped_header expected;
+        if(std::memcmp(m_header->m_magic, expected.m_magic, sizeof(expected.m_magic)) != 0) { malformed("wrong magic"); }
+        if(m_header->m_version != expected.m_version) { malformed("unsupported version " + std::to_string(m_header->m_version)); }
+        if(m_header->m_byte_order != expected.m_byte_order) { malformed("written with a different byte order"); }
+        if(m_header->m_trees > m_size || m_header->m_nodes > m_size) { malformed("counts exceed the file size"); }
+
+        for(int s = 0; s < 6; s++)
+        {
+            auto begin = m_header->m_sections[s];
+            auto bytes = section_count(s, m_header->m_trees, m_header->m_nodes) * element_sizes[s];
+            if(begin % alignment != 0 || begin < sizeof(mapped_header) || begin > m_size || bytes > m_size - begin) { malformed("section " + std::to_string(s) + " out of range"); }
+        }
+
+        if(offsets().front() != 0 || offsets().back() != static_cast<std::int64_t>(m_header->m_nodes)) { malformed("offsets do not match node count"); }
+    }
+    catch(...)
+    {
+        unmap();
+        throw;
+    }
+}
+
+mapped_forest::~mapped_forest()
+{
+    unmap();
+}
+
+mapped_forest::mapped_forest(mapped_forest&& other) noexcept
+    : m_data(std::exchange(other.m_data, nullptr)), m_size(std::exchange(other.m_size, 0)),
+      m_header(std::exchange(other.m_header, nullptr)), m_mapping(std::exchange(other.m_mapping, nullptr))
+{
+}
+
+mapped_forest& mapped_forest::operator=(mapped_forest&& other) noexcept
+{
+    if(this != &other)
+    {
+        unmap();
+        m_data = std::exchange(other.m_data, nullptr);
+        m_size = std::exchange(other.m_size, 0);
+        m_header = std::exchange(other.m_header, nullptr);
+        m_mapping = std::exchange(other.m_mapping, nullptr);
+    }
+    return *this;
+}
+
+void mapped_forest::unmap()
+{
+#ifdef _WIN32
+    if(m_data) { UnmapViewOfFile(m_data); }
+    if(m_mapping) { CloseHandle(m_mapping); }
+#else
+    if(m_data) { ::munmap(const_cast<std::byte*>(m_data), m_size); }
+#endif
+    m_data = nullptr;
+    m_mapping = nullptr;
+    m_header = nullptr;
+}
+
+mapped_tree mapped_forest::tree(std::size_t index) const
+{
+    if(index >= tree_count()) { throw std::out_of_range("tree index " + std::to_string(index) + " out of range"); }
+
+    auto begin = offsets()[index];
+    auto end = offsets()[index + 1];
+    if(begin < 0 || end < begin || end > static_cast<std::int64_t>(size())) { malformed("offsets of tree " + std::to_string(index) + " out of range"); }
+
+    auto first = static_cast<std::size_t>(begin);
+    auto count = static_cast<std::size_t>(end - begin);
+
+    mapped_tree result;
+    result.m_first = first;
+    result.m_positions = positions().subspan(3 * first, 3 * count);
+    result.m_radii = radii().subspan(first, count);
+    result.m_parents = parents().subspan(first, count);
+    result.m_types = types().subspan(first, count);
+    result.m_ids = ids().subspan(first, count);
+    return result;
+}
+
+binary_tree<node_data> mapped_forest::to_tree(std::size_t index) const
+{
+    auto view = tree(index);
+    auto count = view.size();
+
+    /* validate before building: breadth first rows, one root at the first row, at most two children */
+    std::vector<std::uint8_t> children(count, 0);
+    for(std::size_t i = 0; i < count; i++)
+    {
+        auto parent = static_cast<std::int64_t>(view.m_parents[i]) - static_cast<std::int64_t>(view.m_first);
+        if((i == 0) != (view.m_parents[i] < 0)) { malformed("tree " + std::to_string(index) + " must have exactly one root at its first row"); }
+        if(i > 0 && (parent < 0 || static_cast<std::size_t>(parent) >= i || ++children[parent] > 2)) { malformed("invalid parent of row " + std::to_string(view.m_first + i)); }
+    }
+
+    binary_tree<node_data> result;
+    result.reserve(count);
+    for(std::size_t i = 0; i < count; i++)
+    {
+        auto id = view.m_ids[i];
+        auto parent = (i == 0) ? not_a_node : view.m_ids[view.m_parents[i] - view.m_first];
+        if(id == not_a_node || result.exists(id)) { malformed("duplicate node id " + std::to_string(id)); }
+
+        const auto* p = &view.m_positions[3*i];
+        result.restore_node(id, parent, node_data{{p[0], p[1], p[2]}, view.m_radii[i], nullptr});
+    }
+    return result;
+}
+
+forest<node_data> mapped_forest::to_forest() const
+{
+    forest<node_data> result;
+    for(std::size_t t = 0; t < tree_count(); t++)
+    {
+        auto& tree = result.emplace_back(to_tree(t));
+        for(auto& [id, n] : tree.get_all_nodes()) { n.data().m_tree = &tree; }
+    }
+    return result;
+}
+
+bool write_mapped(const std::string& path, const node_arrays& arrays)
+{
+    std::ofstream out(path, std::ios::binary);
+    if(!out) { return false; }
+
+    mapped_header header;
+    header.m_trees = arrays.tree_count();
+    header.m_nodes = arrays.size();
+
+    std::uint64_t offset = sizeof(mapped_header);
+    for(int s = 0; s < 6; s++)
+    {
+        header.m_sections[s] = offset = align(offset);
+        offset += section_count(s, header.m_trees, header.m_nodes) * element_sizes[s];
+    }
+
+    const void* data[6] = { arrays.m_offsets.data(), arrays.m_positions.data(), arrays.m_radii.data(),
+                            arrays.m_parents.data(), arrays.m_types.data(), arrays.m_ids.data() };
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    std::uint64_t position = sizeof(mapped_header);
+
+    const char padding[alignment]{};
+    for(int s = 0; s < 6; s++)
+    {
+        out.write(padding, static_cast<std::streamsize>(header.m_sections[s] - position));
+
+        auto bytes = section_count(s, header.m_trees, header.m_nodes) * element_sizes[s];
+        out.write(static_cast<const char*>(data[s]), static_cast<std::streamsize>(bytes));
+        position = header.m_sections[s] + bytes;
+    }
+
+    return static_cast<bool>(out);
+}
+
+bool write_mapped(const std::string& path, const forest<node_data>& trees)
+{
+    return write_mapped(path, to_arrays(trees));
+}
+
+}
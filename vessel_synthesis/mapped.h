@@ -0,0 +1,101 @@
+#pragma once
+
+#include "arrays.h"
+#include "binarytree.h"
+#include "forest.h"
+#include "points.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+
+namespace vs
+{
+
+/*
+ * ******************** [mapped forest] ********************
+ * -> versioned on-disk format of node arrays that is used in place through a read-only memory map
+ *      - header: magic "VSFM", format version, byte order mark, tree and node count, byte offset of every section
+ *      - sections (each aligned to 64 bytes): tree offsets (int64, trees + 1), positions (float, 3 per node),
+ *        radii (float), parents (int32, rows of the whole file, -1 for roots), node types (uint8), node ids
+ *      - rows, parents, offsets, types and ids are the same as node_arrays (breadth first per tree)
+ *
+ * -> opening only validates the header (O(1)); arrays and tree() are views into the mapping, pages of other trees are
+ *    not touched; to_tree() / to_forest() validate the topology and build trees with the stored node ids
+ * -> the views are valid as long as the mapped_forest lives; the file must not be modified while it is mapped
+ *
+ * usage: write_mapped() returns false if the file can not be written; mapped_forest() throws std::runtime_error if the
+ *        file can not be mapped and std::invalid_argument for malformed files (also to_tree(), to_forest())
+ */
+struct mapped_header
+{
+    char m_magic[4]{'V', 'S', 'F', 'M'};
+    std::uint32_t m_version{1};
+    std::uint32_t m_byte_order{0x01020304};
+    std::uint32_t m_reserved{0};
+    std::uint64_t m_trees{0};
+    std::uint64_t m_nodes{0};
+    std::uint64_t m_sections[6]{};          // offsets, positions, radii, parents, types, ids
+};
+
+/* one tree of a mapped forest; parents refer to rows of the forest (row m_first is the root) */
+struct mapped_tree
+{
+    std::size_t m_first{0};
+    std::span<const float> m_positions;
+    std::span<const float> m_radii;
+    std::span<const std::int32_t> m_parents;
+    std::span<const std::uint8_t> m_types;
+    std::span<const node_id> m_ids;
+
+public:
+    std::size_t size() const { return m_radii.size(); }
+};
+
+class mapped_forest
+{
+public:
+    explicit mapped_forest(const std::string& path);
+    ~mapped_forest();
+
+    mapped_forest(const mapped_forest&) = delete;
+    mapped_forest& operator=(const mapped_forest&) = delete;
+    mapped_forest(mapped_forest&& other) noexcept;
+    mapped_forest& operator=(mapped_forest&& other) noexcept;
+
+    std::size_t size() const { return m_header->m_nodes; }
+    std::size_t tree_count() const { return m_header->m_trees; }
+
+    std::span<const std::int64_t> offsets() const { return section<std::int64_t>(0, tree_count() + 1); }
+    std::span<const float> positions() const { return section<float>(1, 3 * size()); }
+    std::span<const float> radii() const { return section<float>(2, size()); }
+    std::span<const std::int32_t> parents() const { return section<std::int32_t>(3, size()); }
+    std::span<const std::uint8_t> types() const { return section<std::uint8_t>(4, size()); }
+    std::span<const node_id> ids() const { return section<node_id>(5, size()); }
+
+    /* throws std::out_of_range for an invalid index */
+    mapped_tree tree(std::size_t index) const;
+
+    binary_tree<node_data> to_tree(std::size_t index) const;
+    forest<node_data> to_forest() const;
+
+private:
+    template<typename T>
+    std::span<const T> section(int s, std::size_t count) const
+    {
+        return { reinterpret_cast<const T*>(m_data + m_header->m_sections[s]), count };
+    }
+
+    void unmap();
+
+    const std::byte* m_data{nullptr};
+    std::size_t m_size{0};
+    const mapped_header* m_header{nullptr};
+    void* m_mapping{nullptr};               // file mapping handle (windows)
+};
+
+bool write_mapped(const std::string& path, const node_arrays& arrays);
+bool write_mapped(const std::string& path, const forest<node_data>& trees);
+
+}
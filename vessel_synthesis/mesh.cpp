@@ -0,0 +1,398 @@
+#include "mesh.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+
+namespace vs
+{
+
+namespace
+{
+
+constexpr float two_pi = 6.28318530717958647692f;
+constexpr float epsilon = 1e-12f;
+
+/* unit vector perpendicular to t (t is a unit vector) */
+glm::vec3 perpendicular(const glm::vec3& t)
+{
+    glm::vec3 axis = (std::abs(t.x) < 0.9f) ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    return glm::normalize(glm::cross(t, axis));
+}
+
+/* u projected onto the plane perpendicular to t (parallel transport of the ring orientation) */
+glm::vec3 transport(const glm::vec3& u, const glm::vec3& t)
+{
+    glm::vec3 projected = u - glm::dot(u, t) * t;
+    float length = glm::length(projected);
+    return (length > 1e-6f) ? projected / length : perpendicular(t);
+}
+
+/* tangent, ring orientation and first vertex/triangle owned by a node */
+struct node_frame
+{
+    glm::vec3 m_tangent;
+    glm::vec3 m_normal;
+    std::size_t m_vertex;
+    std::size_t m_triangle;
+};
+
+struct mesher
+{
+    const node_arrays& m_arrays;
+    const unsigned int m_segments;
+    const unsigned int m_subdivisions;
+    const bool m_caps;
+
+    std::vector<std::int32_t> m_first_child;
+    std::vector<std::uint8_t> m_child_count;
+    std::vector<node_frame> m_frames;
+    std::vector<float> m_cos, m_sin;
+
+    tube_mesh m_mesh;
+
+public:
+    mesher(const node_arrays& arrays, const mesh_settings& settings)
+        : m_arrays(arrays), m_segments(settings.m_segments), m_subdivisions(settings.m_subdivisions), m_caps(settings.m_caps)
+    {
+        for(unsigned int k = 0; k < m_segments; k++)
+        {
+            m_cos.push_back(std::cos(two_pi * k / m_segments));
+            m_sin.push_back(std::sin(two_pi * k / m_segments));
+        }
+    }
+
+    glm::vec3 position(std::size_t i) const
+    {
+        return { m_arrays.m_positions[3*i], m_arrays.m_positions[3*i + 1], m_arrays.m_positions[3*i + 2] };
+    }
+
+    glm::vec3 direction(std::size_t from, std::size_t to) const
+    {
+        glm::vec3 d = position(to) - position(from);
+        float length = glm::length(d);
+        return (length > epsilon) ? d / length : glm::vec3(0.0f);
+    }
+
+    bool has_tube(std::size_t i) const { return m_arrays.m_parents[i] >= 0 || m_child_count[i] > 0; }
+    bool has_cap(std::size_t i) const { return m_caps && has_tube(i) && (m_arrays.m_parents[i] < 0 || m_child_count[i] == 0); }
+
+    /* sequential pass: children, frames (parents first) and buffer offsets */
+    void prepare()
+    {
+        const auto n = m_arrays.size();
+        const auto& parents = m_arrays.m_parents;
+
+        m_first_child.assign(n, -1);
+        m_child_count.assign(n, 0);
+        for(std::size_t i = 0; i < n; i++)
+        {
+            auto p = parents[i];
+            if(p < 0) { continue; }
+            if(static_cast<std::size_t>(p) >= i) { throw std::invalid_argument("node arrays must store parents before their children"); }
+
+            if(m_first_child[p] < 0) { m_first_child[p] = static_cast<std::int32_t>(i); }
+            m_child_count[p]++;
+        }
+
+        const std::size_t ring = m_segments;
+        const std::size_t band = 2 * ring;
+
+        m_frames.resize(n);
+        std::size_t vertices = 0;
+        std::size_t triangles = 0;
+
+        for(std::size_t i = 0; i < n; i++)
+        {
+            auto p = parents[i];
+            auto c = m_first_child[i];
+
+            glm::vec3 in = (p >= 0) ? direction(p, i) : glm::vec3(0.0f);
+            glm::vec3 out = (c >= 0) ? direction(i, c) : glm::vec3(0.0f);
+
+            /* smooth along chains; joints keep the incoming direction so their ring fits the parent segment */
+            glm::vec3 t = (m_child_count[i] == 1) ? in + out : in;
+            if(glm::length(t) <= epsilon) { t = (glm::length(in) > epsilon) ? in : out; }
+            if(glm::length(t) <= epsilon) { t = (p >= 0) ? m_frames[p].m_tangent : glm::vec3(0.0f, 0.0f, 1.0f); }
+            t = glm::normalize(t);
+
+            auto& frame = m_frames[i];
+            frame.m_tangent = t;
+            frame.m_normal = (p >= 0) ? transport(m_frames[p].m_normal, t) : perpendicular(t);
+            frame.m_vertex = vertices;
+            frame.m_triangle = triangles;
+
+            if(!has_tube(i)) { continue; }
+
+            vertices += ring;
+            if(p >= 0)
+            {
+                vertices += m_subdivisions * ring;
+                triangles += (m_subdivisions + 1) * band;
+            }
+            if(has_cap(i))
+            {
+                vertices += 1;
+                triangles += ring;
+            }
+        }
+
+        if(vertices > std::numeric_limits<std::uint32_t>::max()) { throw std::invalid_argument("mesh exceeds 2^32 vertices"); }
+
+        m_mesh.m_vertices.resize(3 * vertices);
+        m_mesh.m_normals.resize(3 * vertices);
+        m_mesh.m_triangles.resize(3 * triangles);
+    }
+
+    void write_vertex(std::size_t v, const glm::vec3& p, const glm::vec3& normal)
+    {
+        std::memcpy(&m_mesh.m_vertices[3*v], &p, sizeof(float) * 3);
+        std::memcpy(&m_mesh.m_normals[3*v], &normal, sizeof(float) * 3);
+    }
+
+    void write_ring(std::size_t first, const glm::vec3& center, float radius, const glm::vec3& t, const glm::vec3& u)
+    {
+        glm::vec3 w = glm::cross(t, u);
+        for(unsigned int k = 0; k < m_segments; k++)
+        {
+            glm::vec3 radial = m_cos[k] * u + m_sin[k] * w;
+            write_vertex(first + k, center + radius * radial, radial);
+        }
+    }
+
+    void write_triangle(std::size_t& tri, std::size_t a, std::size_t b, std::size_t c)
+    {
+        auto* out = &m_mesh.m_triangles[3 * tri++];
+        out[0] = static_cast<std::uint32_t>(a);
+        out[1] = static_cast<std::uint32_t>(b);
+        out[2] = static_cast<std::uint32_t>(c);
+    }
+
+    /* quads between ring a (behind) and ring b (ahead), outward facing */
+    void write_band(std::size_t& tri, std::size_t a, std::size_t b)
+    {
+        for(unsigned int k = 0; k < m_segments; k++)
+        {
+            unsigned int k1 = (k + 1) % m_segments;
+            write_triangle(tri, a + k, a + k1, b + k1);
+            write_triangle(tri, a + k, b + k1, b + k);
+        }
+    }
+
+    /* everything owned by node i: its ring, the segment from its parent and its cap */
+    void write_node(std::size_t i)
+    {
+        if(!has_tube(i)) { return; }
+
+        const auto& frame = m_frames[i];
+        const auto p = m_arrays.m_parents[i];
+        const glm::vec3 pos = position(i);
+        const float radius = m_arrays.m_radii[i];
+
+        std::size_t vertex = frame.m_vertex;
+        std::size_t tri = frame.m_triangle;
+
+        write_ring(vertex, pos, radius, frame.m_tangent, frame.m_normal);
+        vertex += m_segments;
+
+        if(p >= 0)
+        {
+            const auto& parent = m_frames[p];
+            const glm::vec3 p0 = position(p);
+            const float r0 = m_arrays.m_radii[p];
+            const float length = glm::distance(p0, pos);
+            const glm::vec3 m0 = parent.m_tangent * length;
+            const glm::vec3 m1 = frame.m_tangent * length;
+
+            std::size_t previous = parent.m_vertex;
+            for(unsigned int j = 1; j <= m_subdivisions; j++)
+            {
+                float s = static_cast<float>(j) / (m_subdivisions + 1);
+                float s2 = s * s, s3 = s2 * s;
+
+                /* cubic hermite curve between the nodes */
+                glm::vec3 center = (2*s3 - 3*s2 + 1) * p0 + (s3 - 2*s2 + s) * m0 + (-2*s3 + 3*s2) * pos + (s3 - s2) * m1;
+                glm::vec3 d = (6*s2 - 6*s) * p0 + (3*s2 - 4*s + 1) * m0 + (-6*s2 + 6*s) * pos + (3*s2 - 2*s) * m1;
+                glm::vec3 t = (glm::length(d) > epsilon) ? glm::normalize(d) : frame.m_tangent;
+
+                write_ring(vertex, center, r0 + s * (radius - r0), t, transport(parent.m_normal, t));
+                write_band(tri, previous, vertex);
+
+                previous = vertex;
+                vertex += m_segments;
+            }
+            write_band(tri, previous, frame.m_vertex);
+        }
+
+        if(has_cap(i))
+        {
+            const bool leaf = (p >= 0);
+            const glm::vec3 normal = leaf ? frame.m_tangent : -frame.m_tangent;
+            write_vertex(vertex, pos, normal);
+
+            for(unsigned int k = 0; k < m_segments; k++)
+            {
+                unsigned int k1 = (k + 1) % m_segments;
+                if(leaf) { write_triangle(tri, vertex, frame.m_vertex + k, frame.m_vertex + k1); }
+                else { write_triangle(tri, vertex, frame.m_vertex + k1, frame.m_vertex + k); }
+            }
+        }
+    }
+
+    void write(unsigned int threads)
+    {
+        const auto n = m_arrays.size();
+        if(threads == 0) { threads = std::max(1u, std::thread::hardware_concurrency()); }
+
+        /* not worth a thread for small trees */
+        constexpr std::size_t min_nodes = 4096;
+        threads = static_cast<unsigned int>(std::min<std::size_t>(threads, (n + min_nodes - 1) / min_nodes));
+
+        if(threads <= 1)
+        {
+            for(std::size_t i = 0; i < n; i++) { write_node(i); }
+            return;
+        }
+
+        std::vector<std::thread> workers;
+        for(unsigned int t = 0; t < threads; t++)
+        {
+            std::size_t begin = n * t / threads;
+            std::size_t end = n * (t + 1) / threads;
+            workers.emplace_back([this, begin, end]() { for(std::size_t i = begin; i < end; i++) { write_node(i); } });
+        }
+        for(auto& worker : workers) { worker.join(); }
+    }
+};
+
+/* appends the shortest representation of value to the buffer */
+template<typename T>
+void append_number(std::string& buffer, T value)
+{
+    char text[32];
+    auto result = std::to_chars(text, text + sizeof(text), value);
+    buffer.append(text, result.ptr);
+}
+
+}
+
+tube_mesh make_tube_mesh(const node_arrays& arrays, const mesh_settings& settings)
+{
+    if(settings.m_segments < 3) { throw std::invalid_argument("tube mesh needs at least 3 segments"); }
+
+    mesher m(arrays, settings);
+    m.prepare();
+    m.write(settings.m_threads);
+    return std::move(m.m_mesh);
+}
+
+tube_mesh make_tube_mesh(const binary_tree<node_data>& tree, const mesh_settings& settings)
+{
+    return make_tube_mesh(to_arrays(tree), settings);
+}
+
+tube_mesh make_tube_mesh(const forest<node_data>& trees, const mesh_settings& settings)
+{
+    return make_tube_mesh(to_arrays(trees), settings);
+}
+
+bool write_ply(const std::string& path, const tube_mesh& mesh)
+{
+    std::ofstream out(path, std::ios::binary);
+    if(!out) { return false; }
+
+    constexpr bool little = (std::endian::native == std::endian::little);
+    out << "ply\n"
+        << "format " << (little ? "binary_little_endian" : "binary_big_endian") << " 1.0\n"
+        << "element vertex " << mesh.vertex_count() << "\n"
+        << "property float x\nproperty float y\nproperty float z\n"
+        << "property float nx\nproperty float ny\nproperty float nz\n"
+        << "element face " << mesh.triangle_count() << "\n"
+        << "property list uchar uint vertex_indices\n"
+        << "end_header\n";
+
+    /* interleaved records, written in chunks */
+    constexpr std::size_t chunk = 1 << 14;
+    std::vector<char> buffer;
+
+    for(std::size_t first = 0; first < mesh.vertex_count(); first += chunk)
+    {
+        auto count = std::min(chunk, mesh.vertex_count() - first);
+        buffer.resize(count * 6 * sizeof(float));
+        for(std::size_t v = 0; v < count; v++)
+        {
+            std::memcpy(&buffer[v * 6 * sizeof(float)], &mesh.m_vertices[3 * (first + v)], 3 * sizeof(float));
+            std::memcpy(&buffer[(v * 6 + 3) * sizeof(float)], &mesh.m_normals[3 * (first + v)], 3 * sizeof(float));
+        }
+        out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    }
+
+    constexpr std::size_t face_size = 1 + 3 * sizeof(std::uint32_t);
+    for(std::size_t first = 0; first < mesh.triangle_count(); first += chunk)
+    {
+        auto count = std::min(chunk, mesh.triangle_count() - first);
+        buffer.resize(count * face_size);
+        for(std::size_t f = 0; f < count; f++)
+        {
+            buffer[f * face_size] = 3;
+            std::memcpy(&buffer[f * face_size + 1], &mesh.m_triangles[3 * (first + f)], 3 * sizeof(std::uint32_t));
+        }
+        out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    }
+
+    return static_cast<bool>(out);
+}
+
+bool write_obj(const std::string& path, const tube_mesh& mesh)
+{
+    std::ofstream out(path, std::ios::binary);
+    if(!out) { return false; }
+
+    std::string buffer;
+    auto flush = [&](bool force)
+    {
+        if(force || buffer.size() > (1 << 20)) { out.write(buffer.data(), static_cast<std::streamsize>(buffer.size())); buffer.clear(); }
+    };
+
+    auto write_vectors = [&](const char* tag, const std::vector<float>& values)
+    {
+        for(std::size_t i = 0; i < values.size(); i += 3)
+        {
+            buffer += tag;
+            for(int j = 0; j < 3; j++) { buffer += ' '; append_number(buffer, values[i + j]); }
+            buffer += '\n';
+            flush(false);
+        }
+    };
+    write_vectors("v", mesh.m_vertices);
+    write_vectors("vn", mesh.m_normals);
+
+    /* indices are 1-based; vertex and normal indices are the same */
+    for(std::size_t i = 0; i < mesh.m_triangles.size(); i += 3)
+    {
+        buffer += 'f';
+        for(int j = 0; j < 3; j++)
+        {
+            auto index = static_cast<std::uint64_t>(mesh.m_triangles[i + j]) + 1;
+            buffer += ' ';
+            append_number(buffer, index);
+            buffer += "//";
+            append_number(buffer, index);
+        }
+        buffer += '\n';
+        flush(false);
+    }
+    flush(true);
+
+    return static_cast<bool>(out);
+}
+
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "arrays.h"
+#include "binarytree.h"
+#include "forest.h"
+#include "points.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace vs
+{
+
+/*
+ * ******************** [tube mesh] ********************
+ * -> triangle mesh of the vessel surfaces of a tree or forest (one connected tube surface per tree)
+ *      - every node has one ring of m_segments vertices; segments (parent -> node) connect the two rings
+ *        with m_subdivisions additional rings on a hermite curve (radius interpolated linearly)
+ *      - rings are perpendicular to the node's tangent (average of the incoming and outgoing direction along
+ *        chains, the incoming direction at joints) and oriented with a frame transported from the parent,
+ *        so consecutive rings do not twist
+ *      - a joint's ring is shared by the incoming segment and both outgoing segments (no seams at bifurcations)
+ *      - roots and leaves are closed with a center vertex (m_caps)
+ *
+ * -> frames and buffer offsets are computed in one pass over the nodes, the vertices and triangles are then
+ *    written in parallel over contiguous node ranges (m_threads, 0: hardware concurrency); the result does not
+ *    depend on the number of threads
+ * -> triangles are counter clockwise seen from outside; normals are the radial directions (flat caps: the tangent)
+ */
+struct mesh_settings
+{
+    unsigned int m_segments{12};
+    unsigned int m_subdivisions{0};
+    bool m_caps{true};
+    unsigned int m_threads{0};
+};
+
+struct tube_mesh
+{
+    std::vector<float> m_vertices;              // 3 * vertex_count()
+    std::vector<float> m_normals;               // 3 * vertex_count()
+    std::vector<std::uint32_t> m_triangles;     // 3 * triangle_count()
+
+public:
+    std::size_t vertex_count() const { return m_vertices.size() / 3; }
+    std::size_t triangle_count() const { return m_triangles.size() / 3; }
+};
+
+/* throws std::invalid_argument for less than 3 segments */
+tube_mesh make_tube_mesh(const node_arrays& arrays, const mesh_settings& settings = {});
+tube_mesh make_tube_mesh(const binary_tree<node_data>& tree, const mesh_settings& settings = {});
+tube_mesh make_tube_mesh(const forest<node_data>& trees, const mesh_settings& settings = {});
+
+/* binary little endian PLY (positions, normals, triangles) resp. wavefront OBJ; false if the file can not be written */
+bool write_ply(const std::string& path, const tube_mesh& mesh);
+bool write_obj(const std::string& path, const tube_mesh& mesh);
+
+}
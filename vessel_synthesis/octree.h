@@ -1,6 +1,10 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <cassert>
+#include <cstdint>
+#include <numeric>
 #include <vector>
 #include <map>
 
@@ -17,6 +21,13 @@ constexpr static int pow( int base, int exp ) noexcept
 
 }
 
+/* optional statistics of range queries (e.g. for profiling) */
+struct query_stats
+{
+    std::size_t m_nodes_visited{0};
+    std::size_t m_candidates_tested{0};
+};
+
 
 template<typename Point, int N, typename Data>
 struct oc_tree
@@ -47,8 +58,8 @@ struct oc_tree
         virtual bool insert( const Point& p, const Data& data ) noexcept = 0;
         virtual bool remove( const Point& p, const Data& data ) noexcept = 0;
 
-        virtual void euclidean_range( const Point& p, float range, std::multimap<float, Data>& result) const noexcept = 0;
-        virtual void euclidean_range( const Point& p, float range, std::vector<Data>& result) const noexcept = 0;
+        virtual void euclidean_range( const Point& p, float range, std::multimap<float, Data>& result, query_stats* stats ) const noexcept = 0;
+        virtual void euclidean_range( const Point& p, float range, std::vector<Data>& result, query_stats* stats ) const noexcept = 0;
     };
 
     /*****************************************************/
@@ -144,14 +155,16 @@ struct oc_tree
 
             if( m_children[index] )
             {
-                m_children[index]->remove(p, data);
+                return m_children[index]->remove(p, data);
             }
 
             return false;
         }
 
-        virtual void euclidean_range( const Point& p, float range, std::multimap<float, Data>& result) const noexcept override
+        virtual void euclidean_range( const Point& p, float range, std::multimap<float, Data>& result, query_stats* stats ) const noexcept override
         {
+            if(stats) { stats->m_nodes_visited++; }
+
             for( int i = 0; i < N; i++ )
             {
                 if( node::m_max[i] < (p[i] - range) || node::m_min[i] >= (p[i] + range) )
@@ -162,12 +175,14 @@ struct oc_tree
 
             for(auto* child : m_children)
             {
-                if(child) child->euclidean_range( p, range, result );
+                if(child) child->euclidean_range( p, range, result, stats );
             }
         }
 
-        virtual void euclidean_range( const Point& p, float range, std::vector<Data>& result) const noexcept override
+        virtual void euclidean_range( const Point& p, float range, std::vector<Data>& result, query_stats* stats ) const noexcept override
         {
+            if(stats) { stats->m_nodes_visited++; }
+
             for( int i = 0; i < N; i++ )
             {
                 if( node::m_max[i] < (p[i] - range) || node::m_min[i] >= (p[i] + range) )
@@ -178,7 +193,7 @@ struct oc_tree
 
             for(auto* child : m_children)
             {
-                if(child) child->euclidean_range( p, range, result );
+                if(child) child->euclidean_range( p, range, result, stats );
             }
         }
     };
@@ -223,16 +238,18 @@ struct oc_tree
 
             if( iter != m_data.end() )
             {
-                m_data.erase(iter);
                 m_point.erase( m_point.begin() + std::distance(m_data.begin(), iter) );
+                m_data.erase(iter);
                 return true;
             }
 
             return false;
         }
 
-        virtual void euclidean_range( const Point& p, float range, std::multimap<float, Data>& result) const noexcept override
+        virtual void euclidean_range( const Point& p, float range, std::multimap<float, Data>& result, query_stats* stats ) const noexcept override
         {
+            if(stats) { stats->m_nodes_visited++; }
+
             for( int i = 0; i < N; i++ )
             {
                 if( node::m_max[i] < p[i] - range || node::m_min[i] >= p[i] + range )
@@ -241,6 +258,8 @@ struct oc_tree
                 }
             }
 
+            if(stats) { stats->m_candidates_tested += m_data.size(); }
+
             for(int j = 0; j < static_cast<int>(m_data.size()); j++)
             {
                 float distance = 0.0f;
@@ -257,8 +276,10 @@ struct oc_tree
             }
         }
 
-        virtual void euclidean_range( const Point& p, float range, std::vector<Data>& result) const noexcept override
+        virtual void euclidean_range( const Point& p, float range, std::vector<Data>& result, query_stats* stats ) const noexcept override
         {
+            if(stats) { stats->m_nodes_visited++; }
+
             for( int i = 0; i < N; i++ )
             {
                 if( node::m_max[i] < p[i] - range || node::m_min[i] >= p[i] + range )
@@ -267,6 +288,8 @@ struct oc_tree
                 }
             }
 
+            if(stats) { stats->m_candidates_tested += m_data.size(); }
+
             for(int j = 0; j < static_cast<int>(m_data.size()); j++)
             {
                 float distance = 0.0f;
@@ -290,6 +313,7 @@ private:
     Point m_min;
     Point m_max;
     int m_max_pop;
+    std::size_t m_size{0};
 
     node* m_root{nullptr};
 
@@ -309,6 +333,12 @@ public:
     {
         delete m_root;
         m_root = new leaf( m_min, m_max, m_max_pop, 1 );
+        m_size = 0;
+    }
+
+    std::size_t size() const noexcept
+    {
+        return m_size;
     }
 
     bool insert( const Point& p, const Data& data ) noexcept
@@ -321,6 +351,7 @@ public:
             }
         }
 
+        m_size++;
         if( m_root->insert(p, data) ) return true;
 
         auto* tmp_b = new branch( m_min, m_max, m_max_pop, 1 );
@@ -339,6 +370,47 @@ public:
         return true;
     }
 
+    /*
+     * builds the tree top-down from all points at once (existing points are kept)
+     * -> points are partitioned per octant like insert() does; splitting stops at max_bulk_depth
+     * -> points outside of the extends are skipped; returns the number of inserted points
+     */
+    std::size_t bulk_insert( const std::vector<Point>& points, const std::vector<Data>& data )
+    {
+        assert(points.size() == data.size());
+
+        std::vector<Point> all_points;
+        std::vector<Data> all_data;
+        all_points.reserve(m_size + points.size());
+        all_data.reserve(m_size + points.size());
+        collect(m_root, all_points, all_data);
+
+        std::size_t inserted = 0;
+        for(std::size_t j = 0; j < points.size(); j++)
+        {
+            bool inside = true;
+            for( int i = 0; i < N; i++ )
+            {
+                inside &= !(points[j][i] < m_min[i] || points[j][i] > m_max[i]);
+            }
+            if(!inside) { continue; }
+
+            all_points.push_back(points[j]);
+            all_data.push_back(data[j]);
+            inserted++;
+        }
+
+        std::vector<std::uint32_t> indices(all_points.size());
+        std::iota(indices.begin(), indices.end(), 0u);
+        std::vector<std::uint32_t> scratch(indices.size());
+
+        delete m_root;
+        m_root = build(m_min, m_max, 1, indices.data(), scratch.data(), indices.size(), all_points, all_data);
+        m_size = all_points.size();
+
+        return inserted;
+    }
+
     bool remove( const Point& p, const Data& data ) noexcept
     {
         for( int i = 0; i < N; i++ )
@@ -349,21 +421,99 @@ public:
             }
         }
 
-        return m_root->remove(p, data);
+        bool removed = m_root->remove(p, data);
+        m_size -= removed;
+        return removed;
     }
 
-    void euclidean_range( const Point& p, float range, std::multimap<float, Data>& result) const noexcept
+    void euclidean_range( const Point& p, float range, std::multimap<float, Data>& result, query_stats* stats = nullptr ) const noexcept
     {
         result.clear();
-        m_root->euclidean_range(p, range, result);
+        m_root->euclidean_range(p, range, result, stats);
     }
 
-    void euclidean_range( const Point& p, float range, std::vector<Data>& result) const noexcept
+    void euclidean_range( const Point& p, float range, std::vector<Data>& result, query_stats* stats = nullptr ) const noexcept
     {
         result.clear();
-        m_root->euclidean_range(p, range, result);
+        m_root->euclidean_range(p, range, result, stats);
+    }
+
+private:
+    static constexpr int max_bulk_depth = 24;
+
+    void collect(node* curr_node, std::vector<Point>& points, std::vector<Data>& data) const
+    {
+        if(curr_node->is_leaf())
+        {
+            auto* _leaf = static_cast<leaf*>(curr_node);
+            points.insert(points.end(), _leaf->m_point.begin(), _leaf->m_point.end());
+            data.insert(data.end(), _leaf->m_data.begin(), _leaf->m_data.end());
+        }
+        else
+        {
+            for(auto* c : static_cast<branch*>(curr_node)->m_children)
+            {
+                if(c) { collect(c, points, data); }
+            }
+        }
     }
 
+    node* build(const Point& min, const Point& max, int depth, std::uint32_t* indices, std::uint32_t* scratch, std::size_t count,
+                const std::vector<Point>& points, const std::vector<Data>& data)
+    {
+        if(count <= static_cast<std::size_t>(m_max_pop) || depth >= max_bulk_depth)
+        {
+            auto* _leaf = new leaf( min, max, m_max_pop, depth );
+            _leaf->m_data.reserve(count);
+            _leaf->m_point.reserve(count);
+            for(std::size_t j = 0; j < count; j++)
+            {
+                _leaf->m_data.push_back(data[indices[j]]);
+                _leaf->m_point.push_back(points[indices[j]]);
+            }
+            return _leaf;
+        }
+
+        auto* _branch = new branch( min, max, m_max_pop, depth );
+        const auto& center = _branch->m_center;
+
+        /* counting sort by octant */
+        auto octant = [&](const Point& p)
+        {
+            int index = 0;
+            for(int i = 0; i < N; i++) { if( p[i] > center[i] ) { index += (1 << i); } }
+            return index;
+        };
+
+        constexpr int children = detail::pow(2, N);
+        std::array<std::size_t, children + 1> offsets{};
+        for(std::size_t j = 0; j < count; j++) { offsets[octant(points[indices[j]]) + 1]++; }
+        for(int c = 0; c < children; c++) { offsets[c + 1] += offsets[c]; }
+
+        auto fill = offsets;
+        for(std::size_t j = 0; j < count; j++) { scratch[fill[octant(points[indices[j]])]++] = indices[j]; }
+        std::copy(scratch, scratch + count, indices);
+
+        for(int c = 0; c < children; c++)
+        {
+            auto c_count = offsets[c + 1] - offsets[c];
+            if(c_count == 0) { continue; }
+
+            Point c_min;
+            Point c_max;
+            for(int i = 0; i < N; i++)
+            {
+                c_min[i] = (c & (1 << i)) ? center[i] : min[i];
+                c_max[i] = (c & (1 << i)) ? max[i] : center[i];
+            }
+
+            _branch->m_children[c] = build(c_min, c_max, depth + 1, indices + offsets[c], scratch + offsets[c], c_count, points, data);
+        }
+
+        return _branch;
+    }
+
+public:
     template<typename Func>
     void traverse(const Func& func)
     {
@@ -0,0 +1,152 @@
+#include "perf_counters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+#endif
+
+namespace vs::prf
+{
+
+const char* hw_event_name(hw_event event)
+{
+    switch(event)
+    {
+    case hw_event::cycles: return "cycles";
+    case hw_event::instructions: return "instructions";
+    case hw_event::l1d_misses: return "l1d_misses";
+    case hw_event::llc_misses: return "llc_misses";
+    case hw_event::branch_misses: return "branch_misses";
+    default: return "unknown";
+    }
+}
+
+hw_counter_group::hw_counter_group()
+{
+    m_fds.fill(-1);
+    m_slot.fill(-1);
+}
+
+hw_counter_group::~hw_counter_group()
+{
+    close();
+}
+
+#ifdef __linux__
+
+namespace
+{
+
+struct event_config
+{
+    std::uint32_t m_type;
+    std::uint64_t m_config;
+};
+
+constexpr std::uint64_t cache_config(std::uint64_t cache, std::uint64_t op, std::uint64_t result)
+{
+    return cache | (op << 8) | (result << 16);
+}
+
+constexpr std::array<event_config, hw_event_count> s_events =
+{{
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HW_CACHE, cache_config(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+}};
+
+int perf_event_open(perf_event_attr* attr, int group)
+{
+    /* this thread, any cpu */
+    return static_cast<int>(syscall(SYS_perf_event_open, attr, 0, -1, group, 0));
+}
+
+}
+
+bool hw_counter_group::open()
+{
+    if(is_open()) { return true; }
+
+    for(std::size_t i = 0; i < hw_event_count; i++)
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = s_events[i].m_type;
+        attr.config = s_events[i].m_config;
+        attr.disabled = (m_leader < 0) ? 1 : 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+
+        int fd = perf_event_open(&attr, m_leader);
+        if(fd < 0)
+        {
+            /* without cycles as leader the group is useless */
+            if(i == 0) { return false; }
+            continue;
+        }
+
+        if(m_leader < 0) { m_leader = fd; }
+        m_fds[i] = fd;
+        m_slot[i] = m_opened++;
+    }
+
+    ioctl(m_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(m_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+}
+
+void hw_counter_group::close()
+{
+    for(auto& fd : m_fds)
+    {
+        if(fd >= 0) { ::close(fd); }
+        fd = -1;
+    }
+    m_slot.fill(-1);
+    m_leader = -1;
+    m_opened = 0;
+}
+
+bool hw_counter_group::read(hw_values& values) const
+{
+    /* PERF_FORMAT_GROUP: { nr, values[nr] } */
+    std::array<std::uint64_t, hw_event_count + 1> buffer;
+
+    auto bytes = static_cast<ssize_t>((m_opened + 1) * sizeof(std::uint64_t));
+    if(!is_open() || ::read(m_leader, buffer.data(), bytes) != bytes) { return false; }
+
+    for(std::size_t i = 0; i < hw_event_count; i++)
+    {
+        values[i] = (m_slot[i] >= 0) ? static_cast<std::int64_t>(buffer[1 + m_slot[i]]) : 0;
+    }
+    return true;
+}
+
+#else
+
+bool hw_counter_group::open()
+{
+    return false;
+}
+
+void hw_counter_group::close()
+{
+
+}
+
+bool hw_counter_group::read(hw_values&) const
+{
+    return false;
+}
+
+#endif
+
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace vs::prf
+{
+
+/*
+ * ******************** [hardware counters] ********************
+ * -> optional hardware performance counters of the calling thread (linux perf_event_open)
+ *      - one counter group per thread (cycles is the group leader); all counters are read with a single read()
+ *      - user space only (exclude kernel/hypervisor) to work with the default perf_event_paranoid setting
+ *
+ * -> degrades gracefully: open() returns false if counters are not permitted / not supported (containers, vms, ...)
+ *    events which are not available individually are skipped and report zero
+ * -> on other platforms open() always fails
+ */
+enum class hw_event : int { cycles = 0, instructions = 1, l1d_misses = 2, llc_misses = 3, branch_misses = 4, count = 5 };
+
+inline constexpr std::size_t hw_event_count = static_cast<std::size_t>(hw_event::count);
+using hw_values = std::array<std::int64_t, hw_event_count>;
+
+const char* hw_event_name(hw_event event);
+
+struct hw_counter_group
+{
+private:
+    std::array<int, hw_event_count> m_fds;
+    std::array<int, hw_event_count> m_slot;     // position of the event in the group read (-1 if not opened)
+    int m_leader{-1};
+    int m_opened{0};
+
+public:
+    hw_counter_group();
+    ~hw_counter_group();
+
+    hw_counter_group(const hw_counter_group&) = delete;
+    hw_counter_group& operator=(const hw_counter_group&) = delete;
+
+    bool open();
+    void close();
+    bool is_open() const { return m_leader >= 0; }
+    bool has_event(hw_event event) const { return m_slot[static_cast<int>(event)] >= 0; }
+
+    /* current counter values (monotonic since open) */
+    bool read(hw_values& values) const;
+};
+
+}
@@ -1,5 +1,22 @@
 #include "profiler.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <ostream>
+#include <string_view>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 namespace vs::prf
 {
 
@@ -21,16 +38,248 @@ double time_cast<milli_seconds>(const duration& t)
     return std::chrono::duration<double, std::ratio<1, 1000>>(t).count();
 }
 
-cpu_sample::cpu_sample(const char *name, monitor& profiler)
-    : m_name(name), m_profiler(profiler), m_start(highres_clock::now())
+namespace
+{
+
+/* id of the calling thread as shown by the os tools (top -H, perf, debuggers); the fallback elsewhere */
+std::uint64_t os_thread_id([[maybe_unused]] std::uint64_t fallback)
+{
+#if defined(_WIN32)
+    return static_cast<std::uint64_t>(GetCurrentThreadId());
+#elif defined(__linux__)
+    return static_cast<std::uint64_t>(::syscall(SYS_gettid));
+#else
+    return fallback;
+#endif
+}
+
+/* json string literal (quoted, escaped) */
+void write_json_string(std::ostream& out, std::string_view text)
+{
+    static constexpr char hex[] = "0123456789abcdef";
+
+    out << '"';
+    for(char c : text)
+    {
+        switch(c)
+        {
+        case '"': out << "\\\""; break;
+        case '\\': out << "\\\\"; break;
+        case '\n': out << "\\n"; break;
+        case '\r': out << "\\r"; break;
+        case '\t': out << "\\t"; break;
+        default:
+            if(static_cast<unsigned char>(c) < 0x20) { out << "\\u00" << hex[(c >> 4) & 0xf] << hex[c & 0xf]; }
+            else { out << c; }
+        }
+    }
+    out << '"';
+}
+
+struct scope_registry
+{
+    std::mutex m_mutex;
+    std::array<const char*, max_scopes> m_names{};
+    std::atomic<std::size_t> m_count{0};
+};
+
+scope_registry& registry()
+{
+    static scope_registry s_registry;
+    return s_registry;
+}
+
+struct counter_registry
+{
+    std::mutex m_mutex;
+    std::array<const char*, max_counters> m_names{};
+    std::array<counter_kind, max_counters> m_kinds{};
+    std::atomic<std::size_t> m_count{0};
+};
+
+counter_registry& counters()
 {
+    static counter_registry s_registry;
+    return s_registry;
+}
+
+std::atomic<std::uint64_t> s_monitor_uid{1};
+
+std::atomic_bool s_alloc_hooks{false};
+
+#ifdef VS_PROFILER_ALLOC
+/* {count, bytes} of the innermost active scope of this thread */
+thread_local std::int64_t* t_alloc_target{nullptr};
+#endif
 
 }
 
+#ifdef VS_PROFILER_ALLOC
+void track_allocation(std::size_t size)
+{
+    if(auto* target = t_alloc_target)
+    {
+        target[0] += 1;
+        target[1] += static_cast<std::int64_t>(size);
+    }
+}
+
+void set_allocation_hooks(bool installed)
+{
+    s_alloc_hooks.store(installed);
+}
+#endif
+
+bool has_allocation_hooks()
+{
+    return s_alloc_hooks.load();
+}
+
+scope_id register_scope(const char *name)
+{
+    auto& reg = registry();
+    std::lock_guard lock(reg.m_mutex);
+
+    auto count = reg.m_count.load();
+    for(std::size_t i = 0; i < count; i++)
+    {
+        if(std::strcmp(reg.m_names[i], name) == 0) { return static_cast<scope_id>(i); }
+    }
+
+    assert(count < max_scopes);
+    if(count >= max_scopes) { return max_scopes - 1; }
+
+    reg.m_names[count] = name;
+    reg.m_count.store(count + 1);
+    return static_cast<scope_id>(count);
+}
+
+const char* scope_name(scope_id id)
+{
+    assert(id < scope_count());
+    return registry().m_names[id];
+}
+
+std::size_t scope_count()
+{
+    return registry().m_count.load();
+}
+
+counter_id register_counter(const char *name, counter_kind kind)
+{
+    auto& reg = counters();
+    std::lock_guard lock(reg.m_mutex);
+
+    auto count = reg.m_count.load();
+    for(std::size_t i = 0; i < count; i++)
+    {
+        if(std::strcmp(reg.m_names[i], name) == 0) { return static_cast<counter_id>(i); }
+    }
+
+    assert(count < max_counters);
+    if(count >= max_counters) { return max_counters - 1; }
+
+    reg.m_names[count] = name;
+    reg.m_kinds[count] = kind;
+    reg.m_count.store(count + 1);
+    return static_cast<counter_id>(count);
+}
+
+const char* counter_name(counter_id id)
+{
+    assert(id < counter_count());
+    return counters().m_names[id];
+}
+
+counter_kind counter_type(counter_id id)
+{
+    assert(id < counter_count());
+    return counters().m_kinds[id];
+}
+
+std::size_t counter_count()
+{
+    return counters().m_count.load();
+}
+
+void monitor::thread_buffer::clear()
+{
+    for(auto id : m_used_ids)
+    {
+        m_times[id] = duration::zero();
+        m_used[id] = false;
+    }
+    m_used_ids.clear();
+
+    for(auto id : m_used_counters)
+    {
+        m_counts[id] = 0;
+        m_counter_used[id] = false;
+    }
+    m_used_counters.clear();
+
+    for(auto& deltas : m_hw_deltas) { deltas.fill(0); }
+    for(auto& allocs : m_allocs) { allocs.fill(0); }
+}
+
+hw_counter_group* monitor::thread_buffer::hw_group()
+{
+    if(!m_hw && !m_hw_failed)
+    {
+        m_hw = std::make_unique<hw_counter_group>();
+        if(!m_hw->open())
+        {
+            m_hw.reset();
+            m_hw_failed = true;
+        }
+    }
+    return m_hw.get();
+}
+
+cpu_sample::cpu_sample(scope_id id, monitor& profiler, level required)
+    : m_id(id), m_profiler(profiler), m_buffer(profiler.is_active(required) ? &profiler.local_buffer() : nullptr)
+{
+    if(!m_buffer) { return; }
+
+    m_node = m_buffer->enter(id);
+#ifdef VS_PROFILER_ALLOC
+    m_alloc_prev = t_alloc_target;
+    t_alloc_target = m_buffer->m_allocs[id].data();
+#endif
+    if(m_profiler.has_hw_counters())
+    {
+        auto* group = m_buffer->hw_group();
+        m_hw = group && group->read(m_hw_start);
+    }
+    m_start = highres_clock::now();
+}
+
 cpu_sample::~cpu_sample()
 {
+    if(!m_buffer) { return; }
+
     auto end = highres_clock::now();
-   m_profiler.add_time(m_name, end - m_start);
+    auto t = end - m_start;
+
+    if(m_hw)
+    {
+        hw_values values;
+        if(m_buffer->m_hw->read(values)) { m_buffer->add_hw(m_id, m_hw_start, values); }
+    }
+
+#ifdef VS_PROFILER_ALLOC
+    t_alloc_target = m_alloc_prev;
+#endif
+
+    m_buffer->add_time(m_id, t);
+    m_buffer->leave(m_node, t);
+    if(m_profiler.is_tracing()) { m_buffer->add_event(m_id, m_start, end); }
+}
+
+monitor::monitor()
+    : m_uid(s_monitor_uid.fetch_add(1)), m_name("monitor " + std::to_string(m_uid)), m_epoch(highres_clock::now())
+{
+
 }
 
 void monitor::start_frame()
@@ -40,37 +289,458 @@ void monitor::start_frame()
 
 void monitor::end_frame()
 {
+    std::lock_guard lock(m_mutex);
+
+    for(auto& buffer : m_buffers)
+    {
+        for(auto id : buffer->m_used_ids)
+        {
+            if(m_frames.size() <= id) { m_frames.resize(id + 1); }
+
+            auto& samples = m_frames[id];
+            if(samples.size() <= static_cast<std::size_t>(m_frame_count))
+            {
+                samples.resize(m_frame_count + 1, duration::zero());
+            }
+
+            samples.back() += buffer->m_times[id];
+
+            if constexpr (tracks_allocations)
+            {
+                if(m_alloc_frames.size() <= id) { m_alloc_frames.resize(id + 1); }
+
+                auto& allocs = m_alloc_frames[id];
+                allocs.m_count.resize(m_frame_count + 1, 0);
+                allocs.m_bytes.resize(m_frame_count + 1, 0);
+                allocs.m_count.back() += buffer->m_allocs[id][0];
+                allocs.m_bytes.back() += buffer->m_allocs[id][1];
+            }
+
+            if(!buffer->m_hw) { continue; }
+
+            if(m_hw_frames.size() <= id) { m_hw_frames.resize(id + 1); }
+            for(std::size_t e = 0; e < hw_event_count; e++)
+            {
+                auto& counts = m_hw_frames[id][e];
+                counts.resize(m_frame_count + 1, 0);
+                counts.back() += buffer->m_hw_deltas[id][e];
+            }
+        }
+
+        for(auto id : buffer->m_used_counters)
+        {
+            if(m_counter_frames.size() <= id) { m_counter_frames.resize(id + 1); }
+
+            auto& counts = m_counter_frames[id];
+            if(counts.size() <= static_cast<std::size_t>(m_frame_count))
+            {
+                counts.resize(m_frame_count + 1, 0);
+            }
+
+            if(counter_type(id) == counter_kind::gauge) { counts.back() = buffer->m_counts[id]; }
+            else { counts.back() += buffer->m_counts[id]; }
+        }
+
+        /* merge call tree by path; parents are always created before their children */
+        for(std::uint32_t i = static_cast<std::uint32_t>(buffer->m_merged.size()); i < buffer->m_nodes.size(); i++)
+        {
+            const auto& node = buffer->m_nodes[i];
+            auto parent = buffer->m_merged[node.m_parent];
+
+            auto& children = m_tree[parent].m_children;
+            auto search = std::find_if(children.begin(), children.end(), [&](auto c){ return m_tree[c].m_id == node.m_id; });
+            if(search != children.end())
+            {
+                buffer->m_merged.push_back(*search);
+            }
+            else
+            {
+                auto entry = static_cast<std::uint32_t>(m_tree.size());
+                m_tree.push_back(tree_entry{node.m_id});
+                m_tree[parent].m_children.push_back(entry);
+                buffer->m_merged.push_back(entry);
+            }
+        }
+
+        for(std::uint32_t i = 1; i < buffer->m_nodes.size(); i++)
+        {
+            auto& node = buffer->m_nodes[i];
+            if(node.m_time == duration::zero()) { continue; }
+
+            auto& times = m_tree[buffer->m_merged[i]].m_times;
+            times.resize(m_frame_count + 1, duration::zero());
+            times.back() += node.m_time;
+            node.m_time = duration::zero();
+        }
+
+        buffer->clear();
+    }
+
     m_frame_count++;
 }
 
+void monitor::add_time(scope_id id, duration t)
+{
+    local_buffer().add_time(id, t);
+}
+
 void monitor::add_time(const std::string &name, duration t)
 {
-    auto& samples = m_samples[name];
-    if(samples.size() <= static_cast<std::size_t>(m_frame_count))
+    /* slow path; registered names need to outlive the registry */
+    static std::mutex s_mutex;
+    static std::map<std::string, scope_id> s_dynamic;
+
+    scope_id id;
     {
-        samples.resize(m_frame_count + 1, duration::zero());
+        std::lock_guard lock(s_mutex);
+        auto search = s_dynamic.find(name);
+        if(search == s_dynamic.end())
+        {
+            search = s_dynamic.emplace(name, 0).first;
+            search->second = register_scope(search->first.c_str());
+        }
+        id = search->second;
     }
 
-    samples.back() += t;
+    add_time(id, t);
+}
+
+void monitor::add_count(counter_id id, std::int64_t value)
+{
+    local_buffer().add_count(id, value);
+}
+
+void monitor::set_gauge(counter_id id, std::int64_t value)
+{
+    local_buffer().set_gauge(id, value);
 }
 
 void monitor::reset()
 {
+    std::lock_guard lock(m_mutex);
+
+    for(auto& buffer : m_buffers)
+    {
+        buffer->clear();
+        buffer->m_trace_count = 0;
+    }
+    m_frames.clear();
+    m_counter_frames.clear();
+    m_hw_frames.clear();
+    m_alloc_frames.clear();
     m_frame_count = 0;
-    m_samples.clear();
+    m_epoch = highres_clock::now();
+
+    for(auto& entry : m_tree) { entry.m_times.clear(); }
+}
+
+monitor::profile_samples monitor::get_samples()
+{
+    std::lock_guard lock(m_mutex);
+
+    profile_samples samples;
+    for(std::size_t id = 0; id < m_frames.size(); id++)
+    {
+        if(m_frames[id].empty()) { continue; }
+
+        auto& times = samples[scope_name(static_cast<scope_id>(id))];
+        times = m_frames[id];
+        times.resize(m_frame_count, duration::zero());
+    }
+
+    return samples;
+}
+
+monitor::sample_matrix monitor::get_sample_matrix()
+{
+    std::lock_guard lock(m_mutex);
+
+    std::vector<std::pair<std::string, scope_id>> scopes;
+    for(std::size_t id = 0; id < m_frames.size(); id++)
+    {
+        if(!m_frames[id].empty()) { scopes.emplace_back(scope_name(static_cast<scope_id>(id)), static_cast<scope_id>(id)); }
+    }
+    std::sort(scopes.begin(), scopes.end());
+
+    sample_matrix matrix;
+    matrix.m_frames = static_cast<std::size_t>(m_frame_count);
+    matrix.m_names.reserve(scopes.size());
+    matrix.m_values.resize(scopes.size() * matrix.m_frames, 0);
+
+    auto* column = matrix.m_values.data();
+    for(const auto& [name, id] : scopes)
+    {
+        matrix.m_names.push_back(name);
+
+        const auto& times = m_frames[id];
+        auto count = std::min(times.size(), matrix.m_frames);
+        for(std::size_t f = 0; f < count; f++) { column[f] = std::chrono::duration_cast<nano_seconds>(times[f]).count(); }
+        column += matrix.m_frames;
+    }
+
+    return matrix;
+}
+
+monitor::profile_counts monitor::get_counters()
+{
+    std::lock_guard lock(m_mutex);
+
+    profile_counts counts;
+    for(std::size_t id = 0; id < m_counter_frames.size(); id++)
+    {
+        if(m_counter_frames[id].empty()) { continue; }
+
+        auto& values = counts[counter_name(static_cast<counter_id>(id))];
+        values = m_counter_frames[id];
+        values.resize(m_frame_count, 0);
+    }
+
+    return counts;
+}
+
+monitor::call_node monitor::get_call_tree()
+{
+    std::lock_guard lock(m_mutex);
+
+    auto frames = static_cast<std::size_t>(m_frame_count);
+    auto build = [&](auto& self, std::uint32_t idx) -> call_node
+    {
+        const auto& entry = m_tree[idx];
+
+        call_node node;
+        node.m_name = (idx == 0) ? "" : scope_name(entry.m_id);
+        node.m_inclusive = entry.m_times;
+        node.m_inclusive.resize(frames, duration::zero());
+
+        frame_times children(frames, duration::zero());
+        for(auto c : entry.m_children)
+        {
+            auto& child = node.m_children.emplace_back(self(self, c));
+            for(std::size_t f = 0; f < frames; f++) { children[f] += child.m_inclusive[f]; }
+        }
+
+        if(idx == 0) { node.m_inclusive = children; }
+
+        node.m_exclusive.resize(frames);
+        for(std::size_t f = 0; f < frames; f++) { node.m_exclusive[f] = node.m_inclusive[f] - children[f]; }
+
+        return node;
+    };
+
+    return build(build, 0);
+}
+
+monitor::profile_hw_counts monitor::get_hw_counters()
+{
+    std::lock_guard lock(m_mutex);
+
+    profile_hw_counts result;
+    for(std::size_t id = 0; id < m_hw_frames.size(); id++)
+    {
+        if(m_hw_frames[id][0].empty()) { continue; }
+
+        auto& counts = result[scope_name(static_cast<scope_id>(id))];
+        for(std::size_t e = 0; e < hw_event_count; e++)
+        {
+            counts[e] = m_hw_frames[id][e];
+            counts[e].resize(m_frame_count, 0);
+        }
+    }
+    return result;
+}
+
+monitor::profile_allocs monitor::get_allocations()
+{
+    std::lock_guard lock(m_mutex);
+
+    profile_allocs result;
+    for(std::size_t id = 0; id < m_alloc_frames.size(); id++)
+    {
+        if(m_alloc_frames[id].m_count.empty()) { continue; }
+
+        auto& allocs = result[scope_name(static_cast<scope_id>(id))];
+        allocs = m_alloc_frames[id];
+        allocs.m_count.resize(m_frame_count, 0);
+        allocs.m_bytes.resize(m_frame_count, 0);
+    }
+    return result;
 }
 
-const monitor::profile_samples &monitor::get_samples()
+bool monitor::enable_hw_counters()
 {
-    for(auto& kv : m_samples)
+    /* probe on the calling thread; other threads open their groups lazily */
+    auto* group = local_buffer().hw_group();
+    m_hw_counters.store(group != nullptr);
+    return group != nullptr;
+}
+
+void monitor::disable_hw_counters()
+{
+    m_hw_counters.store(false);
+}
+
+int monitor::frame_count() const
+{
+    return m_frame_count;
+}
+
+void monitor::set_name(const std::string &name)
+{
+    m_name = name;
+}
+
+const std::string &monitor::name() const
+{
+    return m_name;
+}
+
+void monitor::set_level(level l)
+{
+    /* keeps an existing trace capacity */
+    if(l == level::tracing)
+    {
+        if(m_trace_capacity == 0) { enable_tracing(); }
+        else { m_level.store(l); }
+        return;
+    }
+
+    if(m_trace_capacity > 0) { disable_tracing(); }
+    m_level.store(l);
+}
+
+void monitor::enable_tracing(std::size_t capacity)
+{
+    std::lock_guard lock(m_mutex);
+
+    m_trace_capacity = capacity;
+    for(auto& buffer : m_buffers)
+    {
+        buffer->m_trace.assign(capacity, trace_event{});
+        buffer->m_trace_count = 0;
+    }
+    m_level.store(capacity > 0 ? level::tracing : level::scopes);
+}
+
+void monitor::disable_tracing()
+{
+    std::lock_guard lock(m_mutex);
+
+    if(m_level.load() == level::tracing) { m_level.store(level::scopes); }
+    m_trace_capacity = 0;
+    for(auto& buffer : m_buffers)
+    {
+        buffer->m_trace = std::vector<trace_event>();
+        buffer->m_trace_count = 0;
+    }
+}
+
+void monitor::write_chrome_trace(std::ostream &out)
+{
+    prf::write_chrome_trace(out, {this});
+}
+
+bool monitor::write_chrome_trace(const std::string &path)
+{
+    return prf::write_chrome_trace(path, {this});
+}
+
+void write_chrome_trace(std::ostream &out, const std::vector<monitor*>& monitors)
+{
+    /* timestamps in microseconds relative to the earliest monitor epoch */
+    auto epoch = time_point::max();
+    for(const auto* m : monitors) { epoch = std::min(epoch, m->m_epoch); }
+
+    auto micro = [&epoch](time_point t) { return std::chrono::duration<double, std::micro>(t - epoch).count(); };
+
+    auto precision = out.precision(15);
+
+    bool first = true;
+    auto separator = [&out, &first]() { out << (first ? "\n" : ",\n"); first = false; };
+
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    for(auto* m : monitors)
     {
-        if(kv.second.size() < static_cast<std::size_t>(m_frame_count))
+        std::lock_guard lock(m->m_mutex);
+
+        separator();
+        out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << m->m_uid << ",\"args\":{\"name\":";
+        write_json_string(out, m->m_name);
+        out << "}}";
+
+        for(const auto& buffer : m->m_buffers)
         {
-            kv.second.resize(m_frame_count, duration::zero());
+            if(buffer->m_trace.empty()) { continue; }
+
+            separator();
+            out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << m->m_uid << ",\"tid\":" << buffer->m_thread
+                << ",\"args\":{\"name\":\"thread " << buffer->m_thread << "\"}}";
+
+            /* oldest event first */
+            auto size = buffer->m_trace.size();
+            auto count = std::min<std::uint64_t>(buffer->m_trace_count, size);
+            for(std::uint64_t i = buffer->m_trace_count - count; i < buffer->m_trace_count; i++)
+            {
+                const auto& e = buffer->m_trace[i % size];
+
+                separator();
+                out << "{\"name\":";
+                write_json_string(out, scope_name(e.m_id));
+                out << ",\"ph\":\"X\",\"pid\":" << m->m_uid << ",\"tid\":" << buffer->m_thread
+                    << ",\"ts\":" << micro(e.m_begin) << ",\"dur\":" << std::chrono::duration<double, std::micro>(e.m_end - e.m_begin).count() << "}";
+            }
         }
     }
+    out << "\n]}\n";
+    out.precision(precision);
+}
+
+bool write_chrome_trace(const std::string &path, const std::vector<monitor*>& monitors)
+{
+    std::ofstream file(path);
+    if(!file.is_open()) { return false; }
+
+    write_chrome_trace(file, monitors);
+    return file.good();
+}
+
+monitor::thread_buffer& monitor::local_buffer()
+{
+    /* small per thread cache of (monitor, buffer) pairs; monitor uids are never reused */
+    struct cache_entry
+    {
+        std::uint64_t m_uid{0};
+        thread_buffer* m_buffer{nullptr};
+    };
+    thread_local std::array<cache_entry, 8> t_cache;
+    thread_local unsigned int t_next{0};
+
+    for(const auto& entry : t_cache)
+    {
+        if(entry.m_uid == m_uid) { return *entry.m_buffer; }
+    }
+
+    /* cache miss: this thread's buffer (evicted from the cache) or a new one; one buffer per thread and monitor */
+    std::lock_guard lock(m_mutex);
+    auto owner = std::this_thread::get_id();
+
+    thread_buffer* buffer = nullptr;
+    for(auto& b : m_buffers)
+    {
+        if(b->m_owner == owner) { buffer = b.get(); break; }
+    }
+
+    if(!buffer)
+    {
+        buffer = m_buffers.emplace_back(std::make_unique<thread_buffer>()).get();
+        buffer->m_used_ids.reserve(max_scopes);
+        buffer->m_used_counters.reserve(max_counters);
+        buffer->m_thread = os_thread_id(m_buffers.size() - 1);
+        buffer->m_owner = owner;
+        buffer->m_trace.resize(m_trace_capacity);
+    }
 
-    return m_samples;
+    t_cache[t_next++ % t_cache.size()] = { m_uid, buffer };
+    return *buffer;
 }
 
 }
@@ -1,9 +1,19 @@
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <chrono>
-#include <vector>
+#include <cstdint>
+#include <iosfwd>
+#include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
+
+#include "perf_counters.h"
 
 namespace vs::prf
 {
@@ -21,52 +31,359 @@ template<> double time_cast<nano_seconds>(const duration& t);
 template<> double time_cast<micro_seconds>(const duration& t);
 template<> double time_cast<milli_seconds>(const duration& t);
 
+/*
+ * ******************** [profile scopes] ********************
+ * -> scope names are registered once (static-init or first use of profile_sample) and identified by an index
+ * -> the same name always maps to the same id; ids are shared by all monitors
+ */
+typedef unsigned int scope_id;
+inline constexpr std::size_t max_scopes = 128;
+
+scope_id register_scope(const char* name);
+const char* scope_name(scope_id id);
+std::size_t scope_count();
+
+/*
+ * ******************** [profile counters] ********************
+ * -> named per frame event counters (summed over a frame) and gauges (last value set in a frame)
+ * -> registered like scopes; e.g. number of queries, visited oc-tree nodes, live attraction points, ...
+ */
+typedef unsigned int counter_id;
+inline constexpr std::size_t max_counters = 64;
+
+enum class counter_kind : int { count = 0, gauge = 1 };
+
+counter_id register_counter(const char* name, counter_kind kind = counter_kind::count);
+const char* counter_name(counter_id id);
+counter_kind counter_type(counter_id id);
+std::size_t counter_count();
+
+/*
+ * ******************** [allocation tracking] ********************
+ * -> VS_PROFILER_ALLOC compiles the per scope allocation counters into the library; the replacement of the global
+ *    operator new (alloc_hooks.cpp, cmake target vessel_alloc_hooks) is only linked into executables (tests, benchmarks)
+ *    -> the shared library is also loaded by the python module and must not interpose the allocator of the process
+ * -> counts every allocation and its size (allocation churn); frees are not tracked, so bytes are not live memory
+ * -> has_allocation_hooks(): the replacement is linked into the running program
+ */
+#ifdef VS_PROFILER_ALLOC
+void track_allocation(std::size_t size);
+void set_allocation_hooks(bool installed);
+#endif
+bool has_allocation_hooks();
+
+/*
+ * ******************** [profile level] ********************
+ * -> runtime detail of a monitor; higher levels include the lower ones
+ *      - off:     nothing is recorded; every scope costs a single (predictable) branch
+ *      - frames:  only per frame totals (profile_frame_sample)
+ *      - scopes:  all scopes, call tree, counters and gauges (and hardware counters if enabled)
+ *      - tracing: scopes and trace events
+ * -> VS_PROFILER only decides if the scopes are compiled in at all
+ */
+enum class level : int { off = 0, frames = 1, scopes = 2, tracing = 3 };
+
 /*
  * ******************** [profile monitor] ********************
  * -> simple performance monitoring; collecting per frame time measurements
  *
+ * -> samples are accumulated in fixed arrays of a thread local buffer (one per thread and monitor)
+ * -> buffers are merged into the frame data at end_frame(); call it when no other thread records samples
+ *
+ * -> nesting of scopes is tracked at runtime (per thread); get_call_tree() returns per frame
+ *    inclusive and exclusive times organized as call tree (children in order of first occurrence)
+ *
+ * -> optional hardware counters (enable_hw_counters(); linux only): per scope and frame deltas of
+ *    cycles, instructions, l1d/llc misses and branch misses (inclusive, like the durations)
+ *    each thread opens its own counter group on first use; reading costs a syscall per scope begin/end
+ *
+ * -> optional allocation tracking (VS_PROFILER_ALLOC and vessel_alloc_hooks linked, see above):
+ *    count and bytes of heap allocations per frame, attributed to the innermost active scope of the thread (exclusive)
+ *
+ * -> optional tracing: every scope is additionally recorded as event (begin, end, scope, thread)
+ *    into a preallocated ring buffer per thread (oldest events are overwritten)
+ *    write_chrome_trace() exports them as chrome trace-event json (chrome://tracing, ui.perfetto.dev);
+ *    pid is the monitor, tid the os thread id (linux, windows; the buffer index elsewhere)
  */
 struct monitor
 {
     using frame_times = std::vector<duration>;
     using profile_samples = std::map<std::string, frame_times>;
 
+    using frame_counts = std::vector<std::int64_t>;
+    using profile_counts = std::map<std::string, frame_counts>;
+
+    using hw_frame_counts = std::array<frame_counts, hw_event_count>;
+    using profile_hw_counts = std::map<std::string, hw_frame_counts>;
+
+    struct alloc_frames
+    {
+        frame_counts m_count;
+        frame_counts m_bytes;
+    };
+    using profile_allocs = std::map<std::string, alloc_frames>;
+
+    /* samples of all scopes in nanoseconds; scope i is m_values[i * m_frames, (i + 1) * m_frames) (names sorted as in get_samples()) */
+    struct sample_matrix
+    {
+        std::vector<std::string> m_names;
+        std::vector<std::int64_t> m_values;
+        std::size_t m_frames{0};
+    };
+
 #ifdef VS_PROFILER
     static constexpr bool is_enabled = true;
 #else
     static constexpr bool is_enabled = false;
 #endif
 
+#ifdef VS_PROFILER_ALLOC
+    static constexpr bool tracks_allocations = true;
+#else
+    static constexpr bool tracks_allocations = false;
+#endif
+
+    /* node of the call tree; root has no name and its inclusive time is the sum of its children */
+    struct call_node
+    {
+        std::string m_name;
+        frame_times m_inclusive;
+        frame_times m_exclusive;
+        std::vector<call_node> m_children;
+    };
+
+    static constexpr std::uint32_t no_node = std::numeric_limits<std::uint32_t>::max();
+
+    /* scope nesting of a thread; a node is identified by its path of scope ids */
+    struct scope_node
+    {
+        scope_id m_id;
+        std::uint32_t m_parent{no_node};
+        std::uint32_t m_child{no_node};
+        std::uint32_t m_sibling{no_node};
+        duration m_time{duration::zero()};
+    };
+
+    struct trace_event
+    {
+        time_point m_begin;
+        time_point m_end;
+        scope_id m_id;
+    };
+
+    struct thread_buffer
+    {
+        std::array<duration, max_scopes> m_times{};
+        std::array<bool, max_scopes> m_used{};
+        std::vector<scope_id> m_used_ids;
+
+        std::array<std::int64_t, max_counters> m_counts{};
+        std::array<bool, max_counters> m_counter_used{};
+        std::vector<counter_id> m_used_counters;
+
+        /* allocation count and bytes per scope */
+        std::array<std::array<std::int64_t, 2>, max_scopes> m_allocs{};
+
+        std::array<hw_values, max_scopes> m_hw_deltas{};
+        std::unique_ptr<hw_counter_group> m_hw;
+        bool m_hw_failed{false};
+
+        std::vector<scope_node> m_nodes{ scope_node{0} };
+        std::vector<std::uint32_t> m_merged{ 0 };
+        std::uint32_t m_current{0};
+
+        std::uint64_t m_thread{0};              // os thread id (trace tid), the buffer index where not available
+        std::thread::id m_owner;
+        std::vector<trace_event> m_trace;
+        std::uint64_t m_trace_count{0};
+
+    public:
+        std::uint32_t enter(scope_id id)
+        {
+            auto child = m_nodes[m_current].m_child;
+            while(child != no_node && m_nodes[child].m_id != id) { child = m_nodes[child].m_sibling; }
+
+            if(child == no_node)
+            {
+                child = static_cast<std::uint32_t>(m_nodes.size());
+                m_nodes.push_back(scope_node{id, m_current, no_node, m_nodes[m_current].m_child});
+                m_nodes[m_current].m_child = child;
+            }
+
+            m_current = child;
+            return child;
+        }
+
+        void leave(std::uint32_t node, duration t)
+        {
+            m_nodes[node].m_time += t;
+            m_current = m_nodes[node].m_parent;
+        }
+
+        void add_time(scope_id id, duration t)
+        {
+            if(!m_used[id])
+            {
+                m_used[id] = true;
+                m_used_ids.push_back(id);
+            }
+            m_times[id] += t;
+        }
+
+        void add_hw(scope_id id, const hw_values& begin, const hw_values& end)
+        {
+            for(std::size_t i = 0; i < hw_event_count; i++) { m_hw_deltas[id][i] += end[i] - begin[i]; }
+        }
+
+        /* counter group of this thread; opened on first use (must be called from the owning thread) */
+        hw_counter_group* hw_group();
+
+        void add_count(counter_id id, std::int64_t value)
+        {
+            use_counter(id);
+            m_counts[id] += value;
+        }
+
+        void set_gauge(counter_id id, std::int64_t value)
+        {
+            use_counter(id);
+            m_counts[id] = value;
+        }
+
+        void add_event(scope_id id, time_point begin, time_point end)
+        {
+            if(m_trace.empty()) { return; }
+            m_trace[m_trace_count++ % m_trace.size()] = { begin, end, id };
+        }
+
+        void use_counter(counter_id id)
+        {
+            if(!m_counter_used[id])
+            {
+                m_counter_used[id] = true;
+                m_used_counters.push_back(id);
+            }
+        }
+
+        void clear();
+    };
+
 private:
-    profile_samples m_samples;
+    std::uint64_t m_uid;
+    std::string m_name;
+    time_point m_epoch;
+
+    std::atomic<level> m_level{level::scopes};
+    std::atomic_bool m_hw_counters{false};
+    std::size_t m_trace_capacity{0};
+
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<thread_buffer>> m_buffers;
+
+    std::vector<frame_times> m_frames;
+    std::vector<frame_counts> m_counter_frames;
+    std::vector<hw_frame_counts> m_hw_frames;
+    std::vector<alloc_frames> m_alloc_frames;
     int m_frame_count{0};
 
+    /* merged call tree of all threads (node 0 is the root) */
+    struct tree_entry
+    {
+        scope_id m_id;
+        std::vector<std::uint32_t> m_children;
+        frame_times m_times;
+    };
+    std::vector<tree_entry> m_tree{ tree_entry{0} };
+
 public:
+    monitor();
+    monitor(const monitor&) = delete;
+    monitor& operator=(const monitor&) = delete;
+
     void start_frame();
     void end_frame();
 
+    void add_time(scope_id id, duration t);
     void add_time(const std::string& name, duration t);
+    void add_count(counter_id id, std::int64_t value);
+    void set_gauge(counter_id id, std::int64_t value);
     void reset();
 
-    const profile_samples& get_samples();
+    profile_samples get_samples();
+    sample_matrix get_sample_matrix();
+    profile_counts get_counters();
+    call_node get_call_tree();
+    profile_hw_counts get_hw_counters();
+    profile_allocs get_allocations();
+    int frame_count() const;
+
+    void set_name(const std::string& name);
+    const std::string& name() const;
+
+    void set_level(level l);
+    level get_level() const { return m_level.load(std::memory_order_relaxed); }
+    bool is_active(level l) const { return m_level.load(std::memory_order_relaxed) >= l; }
+
+    /* sets level to tracing; disable_tracing() falls back to scopes */
+    void enable_tracing(std::size_t capacity = 1 << 20);
+    void disable_tracing();
+    bool is_tracing() const { return is_active(level::tracing); }
+
+    /* returns false if hardware counters are not available (counters stay disabled) */
+    bool enable_hw_counters();
+    void disable_hw_counters();
+    bool has_hw_counters() const { return m_hw_counters.load(std::memory_order_relaxed); }
+
+    void write_chrome_trace(std::ostream& out);
+    bool write_chrome_trace(const std::string& path);
+
+    thread_buffer& local_buffer();
+
+    friend void write_chrome_trace(std::ostream& out, const std::vector<monitor*>& monitors);
 };
 
+/* combined trace of several monitors (one process per monitor) */
+void write_chrome_trace(std::ostream& out, const std::vector<monitor*>& monitors);
+bool write_chrome_trace(const std::string& path, const std::vector<monitor*>& monitors);
+
 
 struct cpu_sample final
 {
-    cpu_sample(const char* name, monitor& profiler);
+    cpu_sample(scope_id id, monitor& profiler, level required = level::scopes);
     ~cpu_sample();
 
 private:
-    const char* m_name;
+    scope_id m_id;
     monitor& m_profiler;
+    monitor::thread_buffer* m_buffer;
+    std::uint32_t m_node{0};
+    bool m_hw{false};
+    hw_values m_hw_start;
+#ifdef VS_PROFILER_ALLOC
+    std::int64_t* m_alloc_prev{nullptr};
+#endif
     time_point m_start;
 };
 
 #ifdef VS_PROFILER
-#define profile_sample(name, profiler) vs::prf::cpu_sample sample_ ## name(#name, profiler)
+/* a single declaration (the scope lives until the end of the enclosing block); the name is registered on first use */
+#define profile_sample(name, profiler) \
+    vs::prf::cpu_sample sample_ ## name([]() { static const vs::prf::scope_id id = vs::prf::register_scope(#name); return id; }(), \
+                                        profiler, vs::prf::level::scopes)
+#define profile_frame_sample(name, profiler) \
+    vs::prf::cpu_sample sample_ ## name([]() { static const vs::prf::scope_id id = vs::prf::register_scope(#name); return id; }(), \
+                                        profiler, vs::prf::level::frames)
+#define profile_count(name, profiler, value) \
+    do { static const vs::prf::counter_id counter_ ## name = vs::prf::register_counter(#name); \
+         if((profiler).is_active(vs::prf::level::scopes)) { (profiler).add_count(counter_ ## name, value); } } while(0)
+#define profile_gauge(name, profiler, value) \
+    do { static const vs::prf::counter_id counter_ ## name = vs::prf::register_counter(#name, vs::prf::counter_kind::gauge); \
+         if((profiler).is_active(vs::prf::level::scopes)) { (profiler).set_gauge(counter_ ## name, value); } } while(0)
 #else
 #define profile_sample(name, profiler)
+#define profile_frame_sample(name, profiler)
+#define profile_count(name, profiler, value)
+#define profile_gauge(name, profiler, value)
 #endif
 
 }
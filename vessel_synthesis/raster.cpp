@@ -0,0 +1,350 @@
+#include "raster.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <stdexcept>
+#include <thread>
+
+namespace vs
+{
+
+namespace
+{
+
+constexpr int tile_dim = 16;
+
+struct capsule
+{
+    glm::vec3 m_a;
+    glm::vec3 m_ab;
+    float m_inv_length2;
+    float m_radius;
+    glm::ivec3 m_lo;            // voxel bounds (inclusive)
+    glm::ivec3 m_hi;
+
+public:
+    float distance(const glm::vec3& p) const
+    {
+        glm::vec3 ap = p - m_a;
+        float t = std::clamp(glm::dot(ap, m_ab) * m_inv_length2, 0.0f, 1.0f);
+        return glm::length(ap - t * m_ab) - m_radius;
+    }
+
+    bool contains(const glm::vec3& p) const
+    {
+        glm::vec3 ap = p - m_a;
+        float t = std::clamp(glm::dot(ap, m_ab) * m_inv_length2, 0.0f, 1.0f);
+        glm::vec3 d = ap - t * m_ab;
+        return glm::dot(d, d) <= m_radius * m_radius;
+    }
+
+    /* length of the axis within the box [lo, hi] (slab clipping) */
+    float clipped_length(const glm::vec3& lo, const glm::vec3& hi) const
+    {
+        float t0 = 0.0f, t1 = 1.0f;
+        for(int axis = 0; axis < 3; axis++)
+        {
+            if(m_ab[axis] == 0.0f)
+            {
+                if(m_a[axis] < lo[axis] || m_a[axis] >= hi[axis]) { return 0.0f; }
+                continue;
+            }
+
+            float inv = 1.0f / m_ab[axis];
+            float enter = (lo[axis] - m_a[axis]) * inv, exit = (hi[axis] - m_a[axis]) * inv;
+            if(enter > exit) { std::swap(enter, exit); }
+            t0 = std::max(t0, enter);
+            t1 = std::min(t1, exit);
+        }
+        return (t1 > t0) ? (t1 - t0) * std::sqrt(glm::dot(m_ab, m_ab)) : 0.0f;
+    }
+};
+
+struct tiling
+{
+    glm::ivec3 m_tiles;
+    std::vector<std::uint32_t> m_offsets;      // capsules of tile t: m_bins[m_offsets[t], m_offsets[t+1])
+    std::vector<std::uint32_t> m_bins;
+
+public:
+    std::size_t count() const { return std::size_t(m_tiles.x) * m_tiles.y * m_tiles.z; }
+    std::size_t index(const glm::ivec3& t) const { return (std::size_t(t.z) * m_tiles.y + t.y) * m_tiles.x + t.x; }
+    glm::ivec3 coord(std::size_t t) const { return { int(t % m_tiles.x), int(t / m_tiles.x % m_tiles.y), int(t / (std::size_t(m_tiles.x) * m_tiles.y)) }; }
+};
+
+/* capsules with the voxel range of all centers within radius + reach; capsules outside of the grid are dropped */
+std::vector<capsule> make_capsules(const node_arrays& arrays, const voxel_grid& grid, float reach)
+{
+    const glm::vec3 voxel = grid.voxel_size();
+    std::vector<capsule> result;
+    result.reserve(arrays.size());
+
+    auto position = [&](std::size_t i) { return glm::vec3(arrays.m_positions[3*i], arrays.m_positions[3*i + 1], arrays.m_positions[3*i + 2]); };
+
+    for(std::size_t i = 0; i < arrays.size(); i++)
+    {
+        auto parent = arrays.m_parents[i];
+        if(parent < 0) { continue; }
+
+        capsule c;
+        c.m_a = position(parent);
+        c.m_ab = position(i) - c.m_a;
+        float length2 = glm::dot(c.m_ab, c.m_ab);
+        c.m_inv_length2 = (length2 > 0.0f) ? 1.0f / length2 : 0.0f;
+        c.m_radius = arrays.m_radii[i];
+
+        /* voxel centers are at min + (v + 0.5) * voxel */
+        glm::vec3 lo = (glm::min(c.m_a, c.m_a + c.m_ab) - (c.m_radius + reach) - grid.m_min) / voxel - 0.5f;
+        glm::vec3 hi = (glm::max(c.m_a, c.m_a + c.m_ab) + (c.m_radius + reach) - grid.m_min) / voxel - 0.5f;
+        const glm::vec3 limit(grid.m_resolution);
+        c.m_lo = glm::max(glm::ivec3(glm::ceil(glm::clamp(lo, glm::vec3(-1.0f), limit))), glm::ivec3(0));
+        c.m_hi = glm::min(glm::ivec3(glm::floor(glm::clamp(hi, glm::vec3(-1.0f), limit))), grid.m_resolution - 1);
+
+        if(glm::all(glm::lessThanEqual(c.m_lo, c.m_hi))) { result.push_back(c); }
+    }
+    return result;
+}
+
+/* counting sort of the capsules into the tiles they overlap */
+tiling make_tiling(const std::vector<capsule>& capsules, const voxel_grid& grid)
+{
+    tiling result;
+    result.m_tiles = (grid.m_resolution + tile_dim - 1) / tile_dim;
+    result.m_offsets.assign(result.count() + 1, 0);
+
+    auto for_each_tile = [&](const capsule& c, auto&& func)
+    {
+        glm::ivec3 lo = c.m_lo / tile_dim, hi = c.m_hi / tile_dim, t;
+        for(t.z = lo.z; t.z <= hi.z; t.z++)
+            for(t.y = lo.y; t.y <= hi.y; t.y++)
+                for(t.x = lo.x; t.x <= hi.x; t.x++) { func(result.index(t)); }
+    };
+
+    for(const auto& c : capsules) { for_each_tile(c, [&](std::size_t t) { result.m_offsets[t + 1]++; }); }
+    for(std::size_t t = 0; t < result.count(); t++) { result.m_offsets[t + 1] += result.m_offsets[t]; }
+
+    result.m_bins.resize(result.m_offsets.back());
+    auto fill = result.m_offsets;
+    for(std::uint32_t i = 0; i < capsules.size(); i++) { for_each_tile(capsules[i], [&](std::size_t t) { result.m_bins[fill[t]++] = i; }); }
+
+    return result;
+}
+
+/* calls func(tile) for every tile; tiles are handed out one at a time, func owns the voxels of its tile */
+template<typename Func>
+void for_each_tile_parallel(std::size_t tiles, unsigned int threads, Func&& func)
+{
+    if(threads == 0) { threads = std::max(1u, std::thread::hardware_concurrency()); }
+    threads = static_cast<unsigned int>(std::min<std::size_t>(threads, tiles));
+
+    std::atomic<std::size_t> next{0};
+    auto work = [&]()
+    {
+        for(std::size_t t = next++; t < tiles; t = next++) { func(t); }
+    };
+
+    if(threads <= 1) { work(); return; }
+
+    std::vector<std::thread> workers;
+    for(unsigned int i = 0; i < threads; i++) { workers.emplace_back(work); }
+    for(auto& worker : workers) { worker.join(); }
+}
+
+void check_grid(const voxel_grid& grid)
+{
+    if(glm::any(glm::lessThanEqual(grid.m_resolution, glm::ivec3(0)))) { throw std::invalid_argument("grid resolution must be positive"); }
+    if(glm::any(glm::lessThanEqual(grid.m_max, grid.m_min))) { throw std::invalid_argument("grid max must be larger than min"); }
+}
+
+}
+
+float raster_settings::band_distance(const voxel_grid& grid) const
+{
+    auto voxel = grid.voxel_size();
+    return m_band * std::max({voxel.x, voxel.y, voxel.z});
+}
+
+void rasterize(const node_arrays& arrays, const voxel_grid& grid, std::uint8_t label,
+               std::span<std::uint8_t> labels, std::span<float> distance, const raster_settings& settings)
+{
+    check_grid(grid);
+    if(!(settings.m_band >= 0.0f)) { throw std::invalid_argument("band must not be negative"); }
+    if(labels.size() != grid.count() || distance.size() != grid.count()) { throw std::invalid_argument("volumes do not match the grid"); }
+
+    const float band = settings.band_distance(grid);
+    const glm::vec3 voxel = grid.voxel_size();
+
+    const auto capsules = make_capsules(arrays, grid, band);
+    const auto tiles = make_tiling(capsules, grid);
+
+    for_each_tile_parallel(tiles.count(), settings.m_threads, [&](std::size_t t)
+    {
+        auto begin = tiles.m_offsets[t], end = tiles.m_offsets[t + 1];
+        if(begin == end) { return; }
+
+        const glm::ivec3 tile_lo = tiles.coord(t) * tile_dim;
+        const glm::ivec3 tile_hi = glm::min(tile_lo + tile_dim, grid.m_resolution) - 1;
+
+        /* nearest surface per voxel of the tile */
+        float local[tile_dim * tile_dim * tile_dim];
+        std::fill(std::begin(local), std::end(local), band);
+
+        for(auto b = begin; b < end; b++)
+        {
+            const auto& c = capsules[tiles.m_bins[b]];
+            glm::ivec3 lo = glm::max(c.m_lo, tile_lo), hi = glm::min(c.m_hi, tile_hi), v;
+
+            for(v.z = lo.z; v.z <= hi.z; v.z++)
+            {
+                for(v.y = lo.y; v.y <= hi.y; v.y++)
+                {
+                    float* row = &local[((v.z - tile_lo.z) * tile_dim + (v.y - tile_lo.y)) * tile_dim];
+                    for(v.x = lo.x; v.x <= hi.x; v.x++)
+                    {
+                        glm::vec3 center = grid.m_min + (glm::vec3(v) + 0.5f) * voxel;
+                        float& d = row[v.x - tile_lo.x];
+                        d = std::min(d, c.distance(center));
+                    }
+                }
+            }
+        }
+
+        glm::ivec3 v;
+        for(v.z = tile_lo.z; v.z <= tile_hi.z; v.z++)
+        {
+            for(v.y = tile_lo.y; v.y <= tile_hi.y; v.y++)
+            {
+                for(v.x = tile_lo.x; v.x <= tile_hi.x; v.x++)
+                {
+                    float d = local[((v.z - tile_lo.z) * tile_dim + (v.y - tile_lo.y)) * tile_dim + (v.x - tile_lo.x)];
+                    if(d >= band) { continue; }
+
+                    auto index = grid.index(v.x, v.y, v.z, settings.m_order);
+                    distance[index] = std::min(distance[index], d);
+                    if(d <= 0.0f) { labels[index] = label; }
+                }
+            }
+        }
+    });
+}
+
+void rasterize_occupancy(const node_arrays& arrays, const voxel_grid& grid, std::span<float> occupancy, const raster_settings& settings)
+{
+    check_grid(grid);
+    if(settings.m_supersampling < 1 || settings.m_supersampling > 4) { throw std::invalid_argument("supersampling must be in [1, 4]"); }
+    if(occupancy.size() != grid.count()) { throw std::invalid_argument("volume does not match the grid"); }
+
+    const glm::vec3 voxel = grid.voxel_size();
+    const float half_diagonal = 0.5f * glm::length(voxel);
+    const float thin_radius = 0.5f * std::min({voxel.x, voxel.y, voxel.z});
+    const float inv_volume = 1.0f / (voxel.x * voxel.y * voxel.z);
+
+    /* regular sample offsets from the voxel center */
+    const unsigned int s = settings.m_supersampling;
+    std::vector<glm::vec3> samples;
+    for(unsigned int z = 0; z < s; z++)
+        for(unsigned int y = 0; y < s; y++)
+            for(unsigned int x = 0; x < s; x++) { samples.push_back((glm::vec3(x, y, z) + 0.5f) / float(s) * voxel - 0.5f * voxel); }
+
+    const std::uint64_t all = (samples.size() == 64) ? ~std::uint64_t(0) : (std::uint64_t(1) << samples.size()) - 1;
+    const float sample_weight = 1.0f / samples.size();
+
+    /* every voxel whose box may intersect a capsule */
+    const auto capsules = make_capsules(arrays, grid, half_diagonal);
+    const auto tiles = make_tiling(capsules, grid);
+
+    for_each_tile_parallel(tiles.count(), settings.m_threads, [&](std::size_t t)
+    {
+        auto begin = tiles.m_offsets[t], end = tiles.m_offsets[t + 1];
+        if(begin == end) { return; }
+
+        const glm::ivec3 tile_lo = tiles.coord(t) * tile_dim;
+        const glm::ivec3 tile_hi = glm::min(tile_lo + tile_dim, grid.m_resolution) - 1;
+
+        /* covered samples (resolved capsules) and analytic fraction (thin capsules) per voxel of the tile */
+        std::uint64_t covered[tile_dim * tile_dim * tile_dim]{};
+        float thin[tile_dim * tile_dim * tile_dim]{};
+
+        for(auto b = begin; b < end; b++)
+        {
+            const auto& c = capsules[tiles.m_bins[b]];
+            const bool is_thin = c.m_radius < thin_radius;
+            const float cross_section = 3.14159265358979f * c.m_radius * c.m_radius * inv_volume;
+
+            glm::ivec3 lo = glm::max(c.m_lo, tile_lo), hi = glm::min(c.m_hi, tile_hi), v;
+            for(v.z = lo.z; v.z <= hi.z; v.z++)
+            {
+                for(v.y = lo.y; v.y <= hi.y; v.y++)
+                {
+                    auto row = ((v.z - tile_lo.z) * tile_dim + (v.y - tile_lo.y)) * tile_dim - tile_lo.x;
+                    for(v.x = lo.x; v.x <= hi.x; v.x++)
+                    {
+                        glm::vec3 box_min = grid.m_min + glm::vec3(v) * voxel;
+
+                        if(is_thin)
+                        {
+                            thin[row + v.x] += cross_section * c.clipped_length(box_min, box_min + voxel);
+                            continue;
+                        }
+
+                        auto& mask = covered[row + v.x];
+                        if(mask == all) { continue; }
+
+                        glm::vec3 center = box_min + 0.5f * voxel;
+                        float d = c.distance(center);
+                        if(d >= half_diagonal) { continue; }
+                        if(d <= -half_diagonal) { mask = all; continue; }
+
+                        for(std::size_t k = 0; k < samples.size(); k++)
+                        {
+                            if(!(mask & (std::uint64_t(1) << k)) && c.contains(center + samples[k])) { mask |= std::uint64_t(1) << k; }
+                        }
+                    }
+                }
+            }
+        }
+
+        glm::ivec3 v;
+        for(v.z = tile_lo.z; v.z <= tile_hi.z; v.z++)
+        {
+            for(v.y = tile_lo.y; v.y <= tile_hi.y; v.y++)
+            {
+                for(v.x = tile_lo.x; v.x <= tile_hi.x; v.x++)
+                {
+                    auto local = ((v.z - tile_lo.z) * tile_dim + (v.y - tile_lo.y)) * tile_dim + (v.x - tile_lo.x);
+                    float fraction = std::popcount(covered[local]) * sample_weight + thin[local];
+                    if(fraction <= 0.0f) { continue; }
+
+                    auto index = grid.index(v.x, v.y, v.z, settings.m_order);
+                    occupancy[index] = std::min(1.0f, occupancy[index] + fraction);
+                }
+            }
+        }
+    });
+}
+
+raster_volumes::raster_volumes(const voxel_grid& grid, const raster_settings& settings)
+    : m_grid(grid), m_settings(settings)
+{
+    check_grid(grid);
+    m_labels.assign(grid.count(), 0);
+    m_distance.assign(grid.count(), settings.band_distance(grid));
+    if(settings.m_occupancy) { m_occupancy.assign(grid.count(), 0.0f); }
+}
+
+void raster_volumes::rasterize(const node_arrays& arrays, std::uint8_t label)
+{
+    vs::rasterize(arrays, m_grid, label, m_labels, m_distance, m_settings);
+    if(m_settings.m_occupancy) { vs::rasterize_occupancy(arrays, m_grid, m_occupancy, m_settings); }
+}
+
+void raster_volumes::rasterize(const forest<node_data>& trees, std::uint8_t label)
+{
+    rasterize(to_arrays(trees), label);
+}
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "arrays.h"
+#include "domain.h"
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace vs
+{
+
+/*
+ * ******************** [centerline rasterization] ********************
+ * -> voxelizes the segments of node arrays on a voxel_grid (e.g. domain_voxels::grid()); every segment is a capsule
+ *    from the parent to the node with the node's radius (as Tree.segment_data())
+ *      - labels: voxels whose center lies inside a capsule are set to label (others are not touched, so several
+ *        forests, e.g. arterial and venous, can be written into the same volume)
+ *      - distance: signed distance of the voxel center to the nearest capsule surface (negative inside), kept as
+ *        the minimum with the present value; exact outside, the distance to the nearest capsule's surface inside
+ *
+ * -> distances are only computed within m_band voxels (of the largest voxel extent) of a capsule; volumes are expected
+ *    to be initialized with band_distance() (raster_volumes does so), voxels further away keep it
+ * -> capsules are binned into tiles of 16^3 voxels by conservative voxel bounds (every voxel center within radius + band);
+ *    tiles are processed in parallel (m_threads, 0: hardware concurrency) and each tile is written by one thread only
+ *
+ * -> occupancy (partial volume, m_occupancy): fraction of every voxel covered by vessels, so that vessels far below
+ *    the voxel size (terminal radii) are not lost
+ *      - capsules at least one voxel thick (diameter >= smallest voxel extent) are supersampled with m_supersampling^3
+ *        regular samples per voxel (union of the capsules); voxels entirely inside or outside are decided by the center
+ *        distance, so only voxels at the surface are sampled
+ *      - thinner capsules are added analytically: pi r^2 times the length of the segment clipped to the voxel box
+ *      - contributions are added to the present value and clamped to 1 (overlaps of thin capsules at joints count twice)
+ *
+ * throws std::invalid_argument for an empty grid, a negative band, supersampling outside of [1, 4] or volumes not
+ * matching the grid
+ */
+struct raster_settings
+{
+    voxel_order m_order{voxel_order::fortran};
+    float m_band{4.0f};
+    unsigned int m_threads{0};
+    bool m_occupancy{false};
+    unsigned int m_supersampling{4};
+
+public:
+    float band_distance(const voxel_grid& grid) const;
+};
+
+void rasterize(const node_arrays& arrays, const voxel_grid& grid, std::uint8_t label,
+               std::span<std::uint8_t> labels, std::span<float> distance, const raster_settings& settings = {});
+
+void rasterize_occupancy(const node_arrays& arrays, const voxel_grid& grid, std::span<float> occupancy, const raster_settings& settings = {});
+
+struct raster_volumes
+{
+    voxel_grid m_grid;
+    raster_settings m_settings;
+
+    std::vector<std::uint8_t> m_labels;
+    std::vector<float> m_distance;
+    std::vector<float> m_occupancy;         // only with m_settings.m_occupancy
+
+public:
+    raster_volumes(const voxel_grid& grid, const raster_settings& settings = {});
+
+    void rasterize(const node_arrays& arrays, std::uint8_t label = 1);
+    void rasterize(const forest<node_data>& trees, std::uint8_t label = 1);
+};
+
+}
@@ -0,0 +1,193 @@
+#include "sdf.h"
+#include "domain.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace vs::util
+{
+
+namespace
+{
+
+/* 1d squared euclidean distance transform of sampled function (Felzenszwalb & Huttenlocher) with sample spacing h */
+void distance_transform(const float* f, float* d, int n, float h, std::vector<int>& v, std::vector<float>& z)
+{
+    constexpr float inf = std::numeric_limits<float>::max();
+
+    v.resize(n);
+    z.resize(n + 1);
+
+    /* lower envelope of the parabolas rooted at the finite samples */
+    int k = -1;
+    for(int q = 0; q < n; q++)
+    {
+        if(f[q] >= inf) { continue; }
+
+        float s = -inf;
+        while(k >= 0)
+        {
+            float pq = q*h, pv = v[k]*h;
+            s = ((f[q] + pq*pq) - (f[v[k]] + pv*pv)) / (2.0f*(pq - pv));
+            if(s > z[k]) { break; }
+            k--;
+        }
+
+        k++;
+        v[k] = q;
+        z[k] = (k == 0) ? -inf : s;
+        z[k+1] = inf;
+    }
+
+    if(k < 0)
+    {
+        std::fill(d, d + n, inf);
+        return;
+    }
+
+    k = 0;
+    for(int q = 0; q < n; q++)
+    {
+        while(z[k+1] < q*h) { k++; }
+        float dq = (q - v[k])*h;
+        d[q] = dq*dq + f[v[k]];
+    }
+}
+
+/* 3d squared distance transform; separable along each axis */
+void distance_transform(std::vector<float>& grid, const glm::ivec3& res, const glm::vec3& h)
+{
+    std::vector<float> f, d;
+    std::vector<int> v;
+    std::vector<float> z;
+
+    auto pass = [&](int axis)
+    {
+        int n = res[axis];
+        int a = (axis + 1) % 3, b = (axis + 2) % 3;
+        glm::ivec3 stride{1, res.x, res.x*res.y};
+
+        f.resize(n);
+        d.resize(n);
+
+        for(int j = 0; j < res[b]; j++)
+        {
+            for(int i = 0; i < res[a]; i++)
+            {
+                std::size_t base = std::size_t(i)*stride[a] + std::size_t(j)*stride[b];
+                for(int q = 0; q < n; q++) { f[q] = grid[base + std::size_t(q)*stride[axis]]; }
+                distance_transform(f.data(), d.data(), n, h[axis], v, z);
+                for(int q = 0; q < n; q++) { grid[base + std::size_t(q)*stride[axis]] = d[q]; }
+            }
+        }
+    };
+
+    pass(0);
+    pass(1);
+    pass(2);
+}
+
+}
+
+sdf_grid::sdf_grid(const domain &tissue, unsigned int resolution)
+{
+    /* pad by one cell so that the boundary is always resolved */
+    glm::vec3 extends = glm::max(tissue.max_extends() - tissue.min_extends(), glm::vec3(1e-6f));
+    float cell = std::max({extends.x, extends.y, extends.z}) / std::max(resolution, 2u);
+
+    m_resolution = glm::max(glm::ivec3(glm::ceil(extends / cell)) + 2, glm::ivec3(2));
+    m_cell_size = glm::vec3(cell);
+    m_inv_cell_size = 1.0f / m_cell_size;
+    m_min = tissue.min_extends() - m_cell_size;
+    m_max = m_min + glm::vec3(m_resolution) * m_cell_size;
+
+    std::size_t count = std::size_t(m_resolution.x) * m_resolution.y * m_resolution.z;
+    std::vector<bool> inside(count);
+    for(int z = 0, idx = 0; z < m_resolution.z; z++)
+    {
+        for(int y = 0; y < m_resolution.y; y++)
+        {
+            for(int x = 0; x < m_resolution.x; x++, idx++)
+            {
+                inside[idx] = tissue.contains(m_min + (glm::vec3{x, y, z} + 0.5f) * m_cell_size);
+            }
+        }
+    }
+
+    /* squared distances to the closest inside and outside cell */
+    constexpr float inf = std::numeric_limits<float>::max();
+    std::vector<float> to_inside(count), to_outside(count);
+    for(std::size_t i = 0; i < count; i++)
+    {
+        to_inside[i] = inside[i] ? 0.0f : inf;
+        to_outside[i] = inside[i] ? inf : 0.0f;
+    }
+
+    distance_transform(to_inside, m_resolution, m_cell_size);
+    distance_transform(to_outside, m_resolution, m_cell_size);
+
+    /* boundary lies half a cell between inside and outside cell centers */
+    float half_cell = 0.5f * cell;
+    float far = glm::length(m_max - m_min);
+
+    m_distance.resize(count);
+    for(std::size_t i = 0; i < count; i++)
+    {
+        if(inside[i]) { m_distance[i] = -(std::sqrt(std::min(to_outside[i], far*far)) - half_cell); }
+        else { m_distance[i] = std::sqrt(std::min(to_inside[i], far*far)) - half_cell; }
+    }
+}
+
+float sdf_grid::distance(const glm::vec3 &p) const
+{
+    glm::vec3 g = (p - m_min) * m_inv_cell_size - 0.5f;
+    glm::vec3 limit = glm::vec3(m_resolution - 1);
+
+    if(glm::any(glm::lessThan(g, glm::vec3(0.0f))) || glm::any(glm::greaterThan(g, limit)))
+    {
+        /* outside of grid --> outside of domain */
+        glm::vec3 c = glm::clamp(g, glm::vec3(0.0f), limit);
+        glm::ivec3 i = glm::round(c);
+        return std::max(at(i.x, i.y, i.z), 0.0f) + glm::length((g - c) * m_cell_size);
+    }
+
+    glm::ivec3 i = glm::min(glm::ivec3(g), m_resolution - 2);
+    glm::vec3 t = g - glm::vec3(i);
+
+    float c00 = glm::mix(at(i.x, i.y,   i.z  ), at(i.x+1, i.y,   i.z  ), t.x);
+    float c10 = glm::mix(at(i.x, i.y+1, i.z  ), at(i.x+1, i.y+1, i.z  ), t.x);
+    float c01 = glm::mix(at(i.x, i.y,   i.z+1), at(i.x+1, i.y,   i.z+1), t.x);
+    float c11 = glm::mix(at(i.x, i.y+1, i.z+1), at(i.x+1, i.y+1, i.z+1), t.x);
+
+    return glm::mix(glm::mix(c00, c10, t.y), glm::mix(c01, c11, t.y), t.z);
+}
+
+glm::vec3 sdf_grid::gradient(const glm::vec3 &p) const
+{
+    float h = 0.5f * m_cell_size.x;
+    glm::vec3 grad =
+    {
+        distance(p + glm::vec3{h, 0, 0}) - distance(p - glm::vec3{h, 0, 0}),
+        distance(p + glm::vec3{0, h, 0}) - distance(p - glm::vec3{0, h, 0}),
+        distance(p + glm::vec3{0, 0, h}) - distance(p - glm::vec3{0, 0, h})
+    };
+
+    return grad / (2.0f * h);
+}
+
+glm::ivec3 sdf_grid::resolution() const
+{
+    return m_resolution;
+}
+
+glm::vec3 sdf_grid::cell_size() const
+{
+    return m_cell_size;
+}
+
+float sdf_grid::at(int x, int y, int z) const
+{
+    return m_distance[(std::size_t(z)*m_resolution.y + y)*m_resolution.x + x];
+}
+
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace vs
+{
+struct domain;
+}
+
+namespace vs::util
+{
+
+/*
+ * ******************** [signed distance grid] ********************
+ * -> cached signed distance field of a domain; negative inside, positive outside
+ *      - built once from domain::contains() at the cell centers of a regular grid over the domain extends
+ *      - exact euclidean distance transform (separable, per axis) for the distances to inside and outside cells
+ *      - distance() is a trilinear lookup; points outside of the grid are outside of the domain
+ *
+ * -> accuracy is limited by the cell size (about one cell)
+ */
+struct sdf_grid
+{
+private:
+    glm::vec3 m_min;
+    glm::vec3 m_max;
+    glm::ivec3 m_resolution;
+    glm::vec3 m_cell_size;
+    glm::vec3 m_inv_cell_size;
+
+    std::vector<float> m_distance;
+
+public:
+    sdf_grid(const domain& tissue, unsigned int resolution = 64);
+
+    float distance(const glm::vec3& p) const;
+    glm::vec3 gradient(const glm::vec3& p) const;
+
+    glm::ivec3 resolution() const;
+    glm::vec3 cell_size() const;
+
+private:
+    float at(int x, int y, int z) const;
+};
+
+}
@@ -0,0 +1,172 @@
+#include "serialize.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace vs
+{
+
+namespace
+{
+
+static_assert(sizeof(serial_header) == 24, "unexpected padding in serial_header");
+static_assert(sizeof(serial_node) == 24, "unexpected padding in serial_node");
+
+std::size_t archive_size(std::size_t trees, std::size_t nodes)
+{
+    return sizeof(serial_header) + (trees + 1) * sizeof(std::uint64_t) + nodes * sizeof(serial_node);
+}
+
+/* header, offsets and records of the given trees; records are written in place */
+template<typename Trees>
+void write_archive(const Trees& trees, std::size_t tree_count, std::byte* out)
+{
+    serial_header header;
+    header.m_trees = tree_count;
+
+    auto* offsets = out + sizeof(serial_header);
+    auto* records = offsets + (tree_count + 1) * sizeof(std::uint64_t);
+
+    std::uint64_t offset = 0;
+    std::memcpy(offsets, &offset, sizeof(offset));
+
+    std::vector<node_id> queue;
+    std::size_t t = 0;
+    for(const binary_tree<node_data>* tree : trees)
+    {
+        queue.clear();
+        if(tree->size() > 0) { queue.push_back(tree->get_root().id()); }
+
+        /* breadth first; the queue index is the row and the parent row is known when a child is queued */
+        std::vector<std::int32_t> parents{-1};
+        parents.reserve(tree->size());
+
+        for(std::size_t q = 0; q < queue.size(); q++)
+        {
+            const auto& n = tree->get_node(queue[q]);
+
+            serial_node record{{n.data().m_pos.x, n.data().m_pos.y, n.data().m_pos.z}, n.data().m_radius, parents[q], n.id()};
+            std::memcpy(records, &record, sizeof(record));
+            records += sizeof(record);
+
+            for(auto child : n.children())
+            {
+                if(child == not_a_node) { continue; }
+                queue.push_back(child);
+                parents.push_back(static_cast<std::int32_t>(q));
+            }
+        }
+
+        offset += queue.size();
+        std::memcpy(offsets + (++t) * sizeof(std::uint64_t), &offset, sizeof(offset));
+    }
+
+    header.m_nodes = offset;
+    std::memcpy(out, &header, sizeof(header));
+}
+
+[[noreturn]] void malformed(const std::string& reason)
+{
+    throw std::invalid_argument("malformed serialized forest: " + reason);
+}
+
+forest<node_data> read_archive(const std::byte* data, std::size_t size)
+{
+    serial_header header;
+    if(size < sizeof(header)) { malformed("buffer too small"); }
+    std::memcpy(&header, data, sizeof(header));
+
+    if(std::memcmp(header.m_magic, serial_header{}.m_magic, sizeof(header.m_magic)) != 0) { malformed("wrong magic"); }
+    if(header.m_version != serial_header{}.m_version) { malformed("unsupported version " + std::to_string(header.m_version)); }
+    if(header.m_trees > size || header.m_nodes > size || archive_size(header.m_trees, header.m_nodes) != size) { malformed("size does not match header"); }
+
+    std::vector<std::uint64_t> offsets(header.m_trees + 1);
+    std::memcpy(offsets.data(), data + sizeof(header), offsets.size() * sizeof(std::uint64_t));
+    if(offsets.front() != 0 || offsets.back() != header.m_nodes) { malformed("offsets do not match node count"); }
+    for(std::size_t t = 0; t < header.m_trees; t++)
+    {
+        if(offsets[t + 1] < offsets[t] || offsets[t + 1] > header.m_nodes) { malformed("offsets are not ascending"); }
+    }
+
+    const auto* records = data + sizeof(header) + offsets.size() * sizeof(std::uint64_t);
+
+    forest<node_data> result;
+    std::vector<serial_node> nodes;
+    std::vector<std::uint8_t> children;
+
+    for(std::size_t t = 0; t < header.m_trees; t++)
+    {
+        auto count = offsets[t + 1] - offsets[t];
+
+        nodes.resize(count);
+        std::memcpy(nodes.data(), records + offsets[t] * sizeof(serial_node), count * sizeof(serial_node));
+
+        /* validate before building: breadth first rows, one root at row 0, at most two children */
+        children.assign(count, 0);
+        for(std::size_t i = 0; i < count; i++)
+        {
+            auto parent = nodes[i].m_parent;
+            if((i == 0) != (parent < 0)) { malformed("tree " + std::to_string(t) + " must have exactly one root at its first row"); }
+            if(i > 0 && (static_cast<std::size_t>(parent) >= i || ++children[parent] > 2)) { malformed("invalid parent of row " + std::to_string(i)); }
+        }
+
+        auto& tree = result.emplace_back();
+        tree.reserve(count);
+        for(std::size_t i = 0; i < count; i++)
+        {
+            const auto& r = nodes[i];
+            auto parent = (r.m_parent < 0) ? not_a_node : nodes[r.m_parent].m_id;
+            if(tree.exists(r.m_id) || r.m_id == not_a_node) { malformed("duplicate node id " + std::to_string(r.m_id)); }
+
+            tree.restore_node(r.m_id, parent, node_data{{r.m_pos[0], r.m_pos[1], r.m_pos[2]}, r.m_radius, &tree});
+        }
+    }
+
+    return result;
+}
+
+}
+
+std::size_t serialized_size(const binary_tree<node_data>& tree)
+{
+    return archive_size(1, tree.size());
+}
+
+std::size_t serialized_size(const forest<node_data>& trees)
+{
+    std::size_t nodes = 0;
+    for(const auto& tree : trees.trees()) { nodes += tree.size(); }
+    return archive_size(trees.trees().size(), nodes);
+}
+
+void serialize(const binary_tree<node_data>& tree, std::byte* out)
+{
+    const binary_tree<node_data>* trees[] = { &tree };
+    write_archive(trees, 1, out);
+}
+
+void serialize(const forest<node_data>& trees, std::byte* out)
+{
+    std::vector<const binary_tree<node_data>*> pointers;
+    for(const auto& tree : trees.trees()) { pointers.push_back(&tree); }
+    write_archive(pointers, pointers.size(), out);
+}
+
+binary_tree<node_data> deserialize_tree(const std::byte* data, std::size_t size)
+{
+    auto trees = read_archive(data, size);
+    if(trees.trees().size() != 1) { malformed("expected a single tree"); }
+
+    binary_tree<node_data> tree = std::move(trees.trees().front());
+    for(auto& [id, n] : tree.get_all_nodes()) { n.data().m_tree = nullptr; }
+    return tree;
+}
+
+forest<node_data> deserialize_forest(const std::byte* data, std::size_t size)
+{
+    return read_archive(data, size);
+}
+
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "binarytree.h"
+#include "forest.h"
+#include "points.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace vs
+{
+
+/*
+ * ******************** [binary serialization] ********************
+ * -> compact binary image of trees and forests in one contiguous buffer (pickling, transfer between processes)
+ *      - header: magic "VSBT", format version, tree count, node count
+ *      - node offsets per tree (tree count + 1, uint64)
+ *      - node records in breadth first order per tree: position, radius, parent row within the tree (-1 for the root), node id
+ *
+ * -> node ids and child order are preserved
+ * -> m_tree: deserialize_forest() links the nodes to their tree in the returned forest (list elements, the link
+ *    survives moving the forest); deserialize_tree() returns a tree by value and leaves m_tree null, the caller
+ *    relinks it where the tree is finally stored (synthesizer::set_forest() relinks forests as well)
+ * -> host byte order; meant for exchange between processes of the same build, not as a file format
+ *
+ * usage: buffer of serialized_size() bytes, then serialize() into it; deserialize_*() throw std::invalid_argument on malformed input
+ */
+struct serial_header
+{
+    char m_magic[4]{'V', 'S', 'B', 'T'};
+    std::uint32_t m_version{1};
+    std::uint64_t m_trees{0};
+    std::uint64_t m_nodes{0};
+};
+
+struct serial_node
+{
+    float m_pos[3];
+    float m_radius;
+    std::int32_t m_parent;
+    node_id m_id;
+};
+
+std::size_t serialized_size(const binary_tree<node_data>& tree);
+std::size_t serialized_size(const forest<node_data>& trees);
+
+void serialize(const binary_tree<node_data>& tree, std::byte* out);
+void serialize(const forest<node_data>& trees, std::byte* out);
+
+binary_tree<node_data> deserialize_tree(const std::byte* data, std::size_t size);
+forest<node_data> deserialize_forest(const std::byte* data, std::size_t size);
+
+}
@@ -12,11 +12,28 @@
 
 #include <Eigen/Eigen>
 
+#include <cmath>
 #include <numeric>
+#include <stdexcept>
+#include <string>
 
 namespace vs
 {
 
+namespace
+{
+
+/* releases a claim of the synthesizer (try_claim()) on every exit, also if a callback throws */
+struct claim_guard
+{
+    std::atomic_bool& m_flag;
+
+public:
+    ~claim_guard() { m_flag.store(false); }
+};
+
+}
+
 namespace law
 {
 
@@ -82,6 +99,53 @@ void synthesizer::system_data::clear()
 
     m_attr_search.clear();
     m_killed_attr.clear();
+
+    m_generation++;
+    m_arrays.reset();
+}
+
+void synthesizer::step_delta::reset(const forest& trees)
+{
+    m_new_trees.clear();
+    m_new_ids.clear();
+    m_new_parents.clear();
+    m_new_positions.clear();
+    m_new_radii.clear();
+
+    m_radius_trees.clear();
+    m_radius_ids.clear();
+    m_radii.clear();
+
+    m_killed_attr.clear();
+
+    m_tree_index.clear();
+    m_radius_slot.clear();
+
+    std::uint32_t index = 0;
+    for(const auto& t : trees.trees()) { m_tree_index.emplace(&t, index++); }
+}
+
+void synthesizer::step_delta::add_node(const tree::node& n)
+{
+    m_new_trees.push_back(m_tree_index.at(n.data().m_tree));
+    m_new_ids.push_back(n.id());
+    m_new_parents.push_back(n.parent());
+    m_new_positions.push_back(n.data().m_pos);
+    m_new_radii.push_back(n.data().m_radius);
+}
+
+void synthesizer::step_delta::set_radius(const tree::node& n)
+{
+    auto [slot, inserted] = m_radius_slot.emplace(&n, static_cast<std::uint32_t>(m_radii.size()));
+    if(!inserted)
+    {
+        m_radii[slot->second] = n.data().m_radius;
+        return;
+    }
+
+    m_radius_trees.push_back(m_tree_index.at(n.data().m_tree));
+    m_radius_ids.push_back(n.id());
+    m_radii.push_back(n.data().m_radius);
 }
 
 void synthesizer::system_data::clear_attr()
@@ -95,7 +159,8 @@ synthesizer::synthesizer(domain &tissue)
       m_systems{ system_data(tissue.min_extends(), tissue.max_extends()),
                  system_data(tissue.min_extends(), tissue.max_extends()) }
 {
-
+    get_system_data(system::arterial).m_profiler.set_name("arterial");
+    get_system_data(system::venous).m_profiler.set_name("venous");
 }
 
 void synthesizer::set_settings(const settings &sett)
@@ -134,12 +199,34 @@ void synthesizer::set_forest(const system sys, const forest &other)
     sys_data.clear();
 
     sys_data.m_forest = other;
+    index_forest(sys);
+}
+
+void synthesizer::set_forest(const system sys, forest &&other)
+{
+    auto& sys_data = get_system_data(sys);
+    sys_data.clear();
+
+    sys_data.m_forest = std::move(other);
+    index_forest(sys);
+}
+
+void synthesizer::index_forest(const system sys)
+{
+    auto& sys_data = get_system_data(sys);
+
+    std::vector<glm::vec3> points;
+    std::vector<tree::node*> nodes;
 
     sys_data.m_forest.breadth_first([&](auto& n_tree, auto& n)
     {
         n.data().m_tree = &n_tree; /* TODO: this is so dangerous */
-        sys_data.m_node_search.insert(n.data().m_pos, &n);
+        points.push_back(n.data().m_pos);
+        nodes.push_back(&n);
     });
+
+    /* top-down bulk load instead of one insert per node */
+    sys_data.m_node_search.bulk_insert(points, nodes);
 }
 
 
@@ -155,17 +242,110 @@ synthesizer::tree::node& synthesizer::create_root(const system sys, const glm::v
     auto& root = new_tree.create_root(pos, get_system_settings(sys).m_term_radius, &new_tree);
 
     sys_data.m_node_search.insert(root.data().m_pos, &root);
+    sys_data.m_generation++;
 
     return root;
 }
 
+std::shared_ptr<const node_arrays> synthesizer::get_arrays(const system sys)
+{
+    auto& sys_data = get_system_data(sys);
+
+    /* callers on several threads (e.g. views released from python) share one rebuild */
+    std::lock_guard lock(sys_data.m_arrays_mutex);
+    if(!sys_data.m_arrays || sys_data.m_arrays_generation != sys_data.m_generation)
+    {
+        sys_data.m_arrays = std::make_shared<const node_arrays>(to_arrays(sys_data.m_forest));
+        sys_data.m_arrays_generation = sys_data.m_generation;
+    }
+    return sys_data.m_arrays;
+}
+
+std::uint64_t synthesizer::get_generation(const system sys) const
+{
+    return m_systems[static_cast<int>(sys)].m_generation;
+}
+
+std::size_t synthesizer::delete_where(const system sys, const std::uint8_t* mask, std::size_t count)
+{
+    if(!try_claim()) { throw std::runtime_error("forest is being modified by a running synthesis"); }
+    claim_guard guard{m_is_running};
+
+    auto& sys_data = get_system_data(sys);
+    auto arrays = get_arrays(sys);
+    if(count != arrays->size()) { throw std::invalid_argument("mask size does not match the node count"); }
+
+    /* deleted subtrees are removed from the node search first (parents are stored before their children) */
+    std::vector<std::uint8_t> removed(mask, mask + count);
+    auto tree = sys_data.m_forest.trees().begin();
+    for(std::size_t t = 0; t < arrays->tree_count(); t++, tree++)
+    {
+        for(auto i = arrays->m_offsets[t]; i < arrays->m_offsets[t + 1]; i++)
+        {
+            auto parent = arrays->m_parents[i];
+            if(parent >= 0 && removed[parent]) { removed[i] = 1; }
+            if(!removed[i]) { continue; }
+
+            auto& n = tree->get_node(arrays->m_ids[i]);
+            sys_data.m_node_search.remove(n.data().m_pos, &n);
+        }
+    }
+
+    auto deleted = vs::delete_where(sys_data.m_forest, mask, count);
+    sys_data.m_generation++;
+    return deleted;
+}
+
+void synthesizer::update_nodes(const system sys, const float* positions, const float* radii, std::size_t count)
+{
+    if(!try_claim()) { throw std::runtime_error("forest is being modified by a running synthesis"); }
+    claim_guard guard{m_is_running};
+
+    auto& sys_data = get_system_data(sys);
+    auto arrays = get_arrays(sys);
+    if(count != arrays->size()) { throw std::invalid_argument("array size does not match the node count"); }
+
+    for(std::size_t i = 0; i < count; i++)
+    {
+        if(positions && !(std::isfinite(positions[3*i]) && std::isfinite(positions[3*i + 1]) && std::isfinite(positions[3*i + 2])))
+        {
+            throw std::invalid_argument("position " + std::to_string(i) + " is not finite");
+        }
+        if(radii && !(std::isfinite(radii[i]) && radii[i] >= 0.0f))
+        {
+            throw std::invalid_argument("radius " + std::to_string(i) + " is negative or not finite");
+        }
+    }
+
+    auto tree = sys_data.m_forest.trees().begin();
+    for(std::size_t t = 0; t < arrays->tree_count(); t++, tree++)
+    {
+        for(auto i = arrays->m_offsets[t]; i < arrays->m_offsets[t + 1]; i++)
+        {
+            auto& n = tree->get_node(arrays->m_ids[i]);
+            if(radii) { n.data().m_radius = radii[i]; }
+            if(positions)
+            {
+                glm::vec3 pos(positions[3*i], positions[3*i + 1], positions[3*i + 2]);
+                if(pos == n.data().m_pos) { continue; }
+
+                sys_data.m_node_search.remove(n.data().m_pos, &n);
+                n.data().m_pos = pos;
+                sys_data.m_node_search.insert(pos, &n);
+            }
+        }
+    }
+
+    sys_data.m_generation++;
+}
+
 void synthesizer::create_attr(const system sys, const glm::vec3 &pos)
 {
     auto& sys_data = get_system_data(sys);
     sys_data.m_attr_search.insert(pos, attr{pos});
 }
 
-void synthesizer::try_attr(const system sys, const glm::vec3 &pos)
+bool synthesizer::try_attr(const system sys, const glm::vec3 &pos)
 {
     auto& sys_data = get_system_data(sys);
     const auto& params = get_system_parameter(sys);
@@ -175,7 +355,7 @@ void synthesizer::try_attr(const system sys, const glm::vec3 &pos)
 
         std::vector<tree::node*> nodes;
         sys_data.m_node_search.euclidean_range(pos, params.m_birth_node, nodes);
-        if(!nodes.empty()) return;
+        if(!nodes.empty()) return false;
     }
 
     {
@@ -183,19 +363,37 @@ void synthesizer::try_attr(const system sys, const glm::vec3 &pos)
 
         std::vector<attr> attrs;
         sys_data.m_attr_search.euclidean_range(pos, params.m_birth_attr, attrs);
-        if(!attrs.empty()) return;
+        if(!attrs.empty()) return false;
     }
 
     sys_data.m_attr_search.insert(pos, attr{pos});
+    return true;
 }
 
-void synthesizer::run()
+bool synthesizer::try_claim()
 {
-    /* profiling is enabled */
-    if constexpr (prf::monitor::is_enabled)
+    bool expected = false;
+    if(!m_is_running.compare_exchange_strong(expected, true)) { return false; }
+
+    m_stop_requested.store(false);
+    return true;
+}
+
+void synthesizer::release_claim()
+{
+    m_is_running.store(false);
+}
+
+void synthesizer::run(bool claimed)
+{
+    if(!claimed && !try_claim()) { throw std::runtime_error("synthesizer is already running"); }
+    claim_guard guard{m_is_running};
+
+    for(auto sys : {system::arterial, system::venous})
     {
-        get_system_data(system::arterial).m_profiler.reset();
-        get_system_data(system::venous).m_profiler.reset();
+        auto& profiler = get_system_data(sys).m_profiler;
+        profiler.reset();
+        profiler.set_level(prf::monitor::is_enabled ? m_settings.m_profiling : prf::level::off);
     }
 
     if(get_system_data(system::arterial).m_forest.trees().empty())
@@ -204,22 +402,21 @@ void synthesizer::run()
     }
 
     init_runtime_params();
-
-    m_is_running.store(true);
+    init_boundary();
 
     /* main simulation loop */
-    while( (m_params.m_curr_step++ < m_settings.m_steps) && m_is_running.load())
+    while( (m_params.m_curr_step++ < m_settings.m_steps) && !m_stop_requested.load())
     {
         /* profiling is enabled */
-        if constexpr (prf::monitor::is_enabled)
+        if(get_system_data(system::arterial).m_profiler.is_active(prf::level::frames))
         {
             get_system_data(system::arterial).m_profiler.start_frame();
             get_system_data(system::venous).m_profiler.start_frame();
         }
 
         {
-            profile_sample(total_arterial, get_system_data(system::arterial).m_profiler);
-            profile_sample(total_venous, get_system_data(system::venous).m_profiler);
+            profile_frame_sample(total_arterial, get_system_data(system::arterial).m_profiler);
+            profile_frame_sample(total_venous, get_system_data(system::venous).m_profiler);
 
             /* place new oxygen-drains for arterial system to reach */
             sample_attraction();
@@ -236,14 +433,35 @@ void synthesizer::run()
         }
 
         /* profiling is enabled */
-        if constexpr (prf::monitor::is_enabled)
+        if(get_system_data(system::arterial).m_profiler.is_active(prf::level::frames))
         {
             get_system_data(system::arterial).m_profiler.end_frame();
             get_system_data(system::venous).m_profiler.end_frame();
         }
+
+        if(m_step_callback) { m_step_callback(m_params.m_curr_step, get_system_data(system::arterial).m_delta, get_system_data(system::venous).m_delta); }
+        if(m_progress) { m_progress(m_params.m_curr_step, m_settings.m_steps); }
     }
+}
 
-    m_is_running.store(false);
+void synthesizer::stop()
+{
+    m_stop_requested.store(true);
+}
+
+bool synthesizer::is_running() const
+{
+    return m_is_running.load();
+}
+
+void synthesizer::set_progress_callback(const progress_callback &callback)
+{
+    m_progress = callback;
+}
+
+void synthesizer::set_step_callback(const step_callback &callback)
+{
+    m_step_callback = callback;
 }
 
 void synthesizer::init_runtime_params()
@@ -264,12 +482,28 @@ void synthesizer::init_runtime_params()
     }
 }
 
+void synthesizer::init_boundary()
+{
+    if(m_settings.m_boundary.m_mode == boundary::none) { return; }
+
+    /* signed distance grid is built once per domain geometry (and resolution) */
+    auto generation = m_domain.get().generation();
+    if(!m_boundary || m_boundary_resolution != m_settings.m_boundary.m_resolution || m_boundary_generation != generation)
+    {
+        m_boundary = std::make_unique<util::sdf_grid>(m_domain.get(), m_settings.m_boundary.m_resolution);
+        m_boundary_resolution = m_settings.m_boundary.m_resolution;
+        m_boundary_generation = generation;
+    }
+}
+
 void synthesizer::step(const system sys)
 {
     auto& data = get_system_data(sys);
+    if(m_step_callback) { data.m_delta.reset(data.m_forest); }
     if(data.m_forest.trees().empty()) { return; }
 
     profile_sample(step, data.m_profiler);
+    data.m_generation++;
 
     std::map<tree::node*, std::list<attr>> attr_map;
 
@@ -281,15 +515,22 @@ void synthesizer::step(const system sys)
 
     /* remove attraction points which are too close */
     step_kill(sys, attr_map);
+
+    profile_gauge(attr_points, data.m_profiler, data.m_attr_search.size());
+    profile_gauge(nodes, data.m_profiler, data.m_node_search.size());
 }
 
 void synthesizer::sample_attraction()
 {
-    profile_sample(step_closest, get_system_data(system::arterial).m_profiler);
+    profile_sample(sample_attraction, get_system_data(system::arterial).m_profiler);
 
     std::vector<glm::vec3> points;
     m_domain.get().samples(points, get_settings().m_sample_count);
-    std::for_each(points.begin(), points.end(), [&](const auto& p) { try_attr(system::arterial, p); });
+
+    std::size_t rejected = 0;
+    std::for_each(points.begin(), points.end(), [&](const auto& p) { rejected += !try_attr(system::arterial, p); });
+
+    profile_count(rejected_samples, get_system_data(system::arterial).m_profiler, rejected);
 }
 
 void synthesizer::step_closest(const system sys, std::map<tree::node*, std::list<attr> >& attr_map)
@@ -300,6 +541,11 @@ void synthesizer::step_closest(const system sys, std::map<tree::node*, std::list
 
     profile_sample(step_closest, data.m_profiler);
 
+    /* query statistics are only collected for profiling */
+    util::query_stats stats;
+    util::query_stats* stats_ptr = (prf::monitor::is_enabled && data.m_profiler.is_active(prf::level::scopes)) ? &stats : nullptr;
+    std::size_t queries = 0;
+
     /* check all attraction points if they are influence a vessel node */
     std::vector<tree::node*> nodes;
     data.m_attr_search.traverse([&](const attr& p)
@@ -308,7 +554,8 @@ void synthesizer::step_closest(const system sys, std::map<tree::node*, std::list
             profile_sample(influence_query, data.m_profiler);
 
             nodes.clear();
-            data.m_node_search.euclidean_range(p.m_pos, params.m_influence_attr, nodes);
+            data.m_node_search.euclidean_range(p.m_pos, params.m_influence_attr, nodes, stats_ptr);
+            queries++;
             if(nodes.empty()) { return; }
         }
 
@@ -369,6 +616,10 @@ void synthesizer::step_closest(const system sys, std::map<tree::node*, std::list
             attr_map[min_node].push_back(p);
         }
     });
+
+    profile_count(queries, data.m_profiler, queries);
+    profile_count(octree_nodes_visited, data.m_profiler, stats.m_nodes_visited);
+    profile_count(candidates_tested, data.m_profiler, stats.m_candidates_tested);
 }
 
 void synthesizer::step_growth(const system sys, std::map<tree::node *, std::list<attr> >& attr_map)
@@ -379,6 +630,11 @@ void synthesizer::step_growth(const system sys, std::map<tree::node *, std::list
 
     profile_sample(step_growth, data.m_profiler);
 
+    auto* delta = m_step_callback ? &data.m_delta : nullptr;
+    std::size_t created = 0;
+    std::size_t bifurcations = 0;
+    std::size_t rejected = 0;
+
     for(const auto& attr_pair : attr_map)
     {
         auto* node = attr_pair.first;
@@ -461,41 +717,59 @@ void synthesizer::step_growth(const system sys, std::map<tree::node *, std::list
             glm::vec3 left = glm::normalize(glm::rotate(dir, glm::radians(angle_l), up));
             glm::vec3 right = glm::normalize(glm::rotate(dir, glm::radians(angle_r), up));
 
-            auto* tree = node->data().m_tree;
-            auto& end_l = tree->create_node(node->id(), node->data().m_pos + params.m_growth_distance * glm::normalize(left), radius_l, tree);
-            auto& end_r = tree->create_node(node->id(), node->data().m_pos + params.m_growth_distance * glm::normalize(right), radius_r, tree);
-
-            auto recalc_radii = [&sett, tree] (auto& node)
+            /* both branches have to stay inside the domain; otherwise the leaf elongates */
+            if( constrain_growth(node->data().m_pos, left, params.m_growth_distance) &&
+                constrain_growth(node->data().m_pos, right, params.m_growth_distance) )
             {
-                if(node.is_inter())
-                {
-                    node.data().m_radius = tree->get_node(node.children()[0]).data().m_radius;
-                }
-                else if(node.is_joint())
-                {
-                    auto& child_0 = node.data().m_tree->get_node(node.children()[0]);
-                    auto& child_1 = node.data().m_tree->get_node(node.children()[1]);
+                created += 2;
+                bifurcations++;
 
-                    node.data().m_radius = law::murray_radius(child_0.data().m_radius, child_1.data().m_radius, sett.m_bif_index);
-                }
-            };
-            tree->to_root(recalc_radii, node->id());
+                auto* tree = node->data().m_tree;
+                auto& end_l = tree->create_node(node->id(), node->data().m_pos + params.m_growth_distance * glm::normalize(left), radius_l, tree);
+                auto& end_r = tree->create_node(node->id(), node->data().m_pos + params.m_growth_distance * glm::normalize(right), radius_r, tree);
 
-            data.m_node_search.insert(end_l.data().m_pos, &end_l);
-            data.m_node_search.insert(end_r.data().m_pos, &end_r);
+                auto recalc_radii = [&sett, tree, delta] (auto& node)
+                {
+                    auto radius = node.data().m_radius;
+                    if(node.is_inter())
+                    {
+                        node.data().m_radius = tree->get_node(node.children()[0]).data().m_radius;
+                    }
+                    else if(node.is_joint())
+                    {
+                        auto& child_0 = node.data().m_tree->get_node(node.children()[0]);
+                        auto& child_1 = node.data().m_tree->get_node(node.children()[1]);
+
+                        node.data().m_radius = law::murray_radius(child_0.data().m_radius, child_1.data().m_radius, sett.m_bif_index);
+                    }
+                    if(delta && node.data().m_radius != radius) { delta->set_radius(node); }
+                };
+                tree->to_root(recalc_radii, node->id());
+
+                data.m_node_search.insert(end_l.data().m_pos, &end_l);
+                data.m_node_search.insert(end_r.data().m_pos, &end_r);
+                if(delta) { delta->add_node(end_l); delta->add_node(end_r); }
+
+                continue;
+            }
         }
+
         /* elongate from a leaf or develop a new lateral sprout */
-        else if( !sett.m_only_leaf_development || (node->is_leaf() || node->is_inter()) )
+        if( !sett.m_only_leaf_development || (node->is_leaf() || node->is_inter()) )
         {
             if(node->is_root() && node->is_inter()) { continue; } // TODO: currently force root to only have one child
 
             profile_sample(growth_sprout, data.m_profiler);
 
+            if( !constrain_growth(node->data().m_pos, dir, params.m_growth_distance) ) { rejected++; continue; }
+            created++;
+
             auto* tree = node->data().m_tree;
             auto& end = tree->create_node(node->id(), node->data().m_pos + params.m_growth_distance * glm::normalize(dir), sett.m_term_radius, tree);
 
-            auto recalc_radii = [&sett, tree] (auto& node)
+            auto recalc_radii = [&sett, tree, delta] (auto& node)
             {
+                auto radius = node.data().m_radius;
                 if(node.is_inter())
                 {
                     node.data().m_radius = tree->get_node(node.children()[0]).data().m_radius;
@@ -507,12 +781,18 @@ void synthesizer::step_growth(const system sys, std::map<tree::node *, std::list
 
                     node.data().m_radius = law::murray_radius(child_0.data().m_radius, child_1.data().m_radius, sett.m_bif_index);
                 }
+                if(delta && node.data().m_radius != radius) { delta->set_radius(node); }
             };
             tree->to_root(recalc_radii, node->id());
 
             data.m_node_search.insert(end.data().m_pos, &end);
+            if(delta) { delta->add_node(end); }
         }
     }
+
+    profile_count(nodes_created, data.m_profiler, created);
+    profile_count(bifurcations, data.m_profiler, bifurcations);
+    profile_count(growth_rejected, data.m_profiler, rejected);
 }
 
 void synthesizer::step_kill(const system sys, std::map<tree::node*, std::list<attr> > &attr_map)
@@ -522,6 +802,11 @@ void synthesizer::step_kill(const system sys, std::map<tree::node*, std::list<at
 
     profile_sample(step_kill, data.m_profiler);
 
+    util::query_stats stats;
+    util::query_stats* stats_ptr = (prf::monitor::is_enabled && data.m_profiler.is_active(prf::level::scopes)) ? &stats : nullptr;
+    std::size_t queries = 0;
+    std::size_t killed = 0;
+
     for(const auto& attrPair : attr_map)
     {
         const std::list<attr>& attr_list = attrPair.second;
@@ -532,7 +817,8 @@ void synthesizer::step_kill(const system sys, std::map<tree::node*, std::list<at
         {
             {
                 profile_sample(kill_node_query, data.m_profiler);
-                data.m_node_search.euclidean_range(p.m_pos, params.m_kill_attr, nodes);
+                data.m_node_search.euclidean_range(p.m_pos, params.m_kill_attr, nodes, stats_ptr);
+                queries++;
             }
 
             if(nodes.empty()) continue;
@@ -541,9 +827,16 @@ void synthesizer::step_kill(const system sys, std::map<tree::node*, std::list<at
                 profile_sample(kill_attr_remove, data.m_profiler);
                 data.m_attr_search.remove(p.m_pos, p);
                 data.m_killed_attr.push_back(p.m_pos);
+                if(m_step_callback) { data.m_delta.m_killed_attr.push_back(p.m_pos); }
+                killed++;
             }
         }
     }
+
+    profile_count(queries, data.m_profiler, queries);
+    profile_count(octree_nodes_visited, data.m_profiler, stats.m_nodes_visited);
+    profile_count(candidates_tested, data.m_profiler, stats.m_candidates_tested);
+    profile_count(points_killed, data.m_profiler, killed);
 }
 
 void synthesizer::combine_systems()
@@ -563,6 +856,30 @@ void synthesizer::combine_systems()
     art_data.m_killed_attr.clear();
 }
 
+bool synthesizer::constrain_growth(const glm::vec3 &origin, glm::vec3 &dir, float distance) const
+{
+    if(m_settings.m_boundary.m_mode == boundary::none || !m_boundary) { return true; }
+
+    if(m_boundary->distance(origin + distance * dir) <= 0.0f) { return true; }
+    if(m_settings.m_boundary.m_mode == boundary::reject) { return false; }
+
+    /* deflect: remove the outward component of the growth direction */
+    glm::vec3 normal = m_boundary->gradient(origin + distance * dir);
+    float length = glm::length(normal);
+    if(length < 1e-6f) { return false; }
+    normal /= length;
+
+    glm::vec3 tangent = dir - std::max(glm::dot(dir, normal), 0.0f) * normal;
+    length = glm::length(tangent);
+    if(length < 1e-6f) { return false; }
+    tangent /= length;
+
+    if(m_boundary->distance(origin + distance * tangent) > 0.0f) { return false; }
+
+    dir = tangent;
+    return true;
+}
+
 void synthesizer::domain_growth(const system sys)
 {
     profile_sample(domain_growth, get_system_data(sys).m_profiler);
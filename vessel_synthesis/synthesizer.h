@@ -1,19 +1,28 @@
 #pragma once
 
+#include "arrays.h"
 #include "binarytree.h"
 #include "forest.h"
 #include "domain.h"
 #include "octree.h"
 #include "points.h"
 #include "profiler.h"
+#include "sdf.h"
 
 #include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 namespace vs
 {
 
 enum class system : int { arterial = 0, venous = 1, count = 2 };
 enum class grow_func : int { none = 0, linear = 1, exponential = 2, count = 2 };
+enum class boundary : int { none = 0, reject = 1, deflect = 2, count = 3 };
 
 /*
  * ******************** [synthesizer settings] ********************
@@ -22,6 +31,12 @@ enum class grow_func : int { none = 0, linear = 1, exponential = 2, count = 2 };
  * - steps: number of iterations (arterial and venous development step)
  * - sample_count: the number of attraction points sampled in each step
  *
+ * - boundary: enforce the domain boundary on new vessel nodes
+ *      - none: no enforcement (domain is only defined by its samples)
+ *      - reject: growth that would leave the domain is discarded
+ *      - deflect: growth direction is projected onto the boundary tangent plane; rejected if still outside
+ *      - resolution: cells along the longest axis of the cached signed distance grid
+ *
  * - for both arterial and venous system:
  *      - parent_inertia: enforces to follow the direction of the parent ("stiffness" of tree)
  *      - birth_attr: distance between attraction points
@@ -49,6 +64,15 @@ struct settings
     unsigned int m_steps{100};
     unsigned int m_sample_count{1000};
 
+    struct
+    {
+        vs::boundary m_mode{vs::boundary::none};
+        unsigned int m_resolution{64};
+    } m_boundary;
+
+    /* detail of the performance monitors (applied at run()) */
+    prf::level m_profiling{prf::level::scopes};
+
     struct system
     {
         float m_parent_inertia{0.5f};
@@ -92,8 +116,12 @@ public:
  * 1. "growth domain" needs to be defined --> see domain.h
  * 2. arterial tree roots or an initial vascular trees can be set from which the development starts (create_root(), set_forest())
  * 3. adjust settings (get_settings())
- * 4. run()
- * 5. retrieve developed trees for each system (get_forest())
+ * 4. run() (blocking; stop() ends it after the current step from another thread, progress callback is called after each step)
+ *    the step callback receives the changes of each step (step_delta) for incremental consumers
+ * 5. retrieve developed trees for each system (get_forest(), or get_arrays() for a shared read-only snapshot)
+ *
+ * -> modify the forests only through set_forest(), create_root(), delete_where() and update_nodes();
+ *    they keep the node search (m_node_search) and the array snapshot in sync
  *
  * dev notes:
  * -> this version is single threaded, and uses an oc-tree for nearest neighbour searches
@@ -111,6 +139,44 @@ struct synthesizer
     using oc_tree_attr = util::oc_tree<glm::vec3, 3, attr>;
     using oc_tree_node = util::oc_tree<glm::vec3, 3, tree::node*>;
 
+    /* called from the thread executing run() after each step with (finished steps, total steps) */
+    using progress_callback = std::function<void(unsigned int, unsigned int)>;
+
+    /*
+     * changes of one system during one step (recorded in step_growth() and step_kill() only if a step callback is set)
+     * -> nodes are identified by (index of the tree in the forest, node id)
+     * -> new nodes with parent id, position and radius; m_radius_* holds existing nodes whose radius changed (last value)
+     * -> killed attraction points
+     * -> buffers are cleared but keep their capacity from step to step
+     */
+    struct step_delta
+    {
+        std::vector<std::uint32_t> m_new_trees;
+        std::vector<node_id> m_new_ids;
+        std::vector<node_id> m_new_parents;
+        std::vector<glm::vec3> m_new_positions;
+        std::vector<float> m_new_radii;
+
+        std::vector<std::uint32_t> m_radius_trees;
+        std::vector<node_id> m_radius_ids;
+        std::vector<float> m_radii;
+
+        std::vector<glm::vec3> m_killed_attr;
+
+        /* tree index lookup and slot of a node in m_radius_* (or new node) */
+        std::unordered_map<const tree*, std::uint32_t> m_tree_index;
+        std::unordered_map<const tree::node*, std::uint32_t> m_radius_slot;
+
+    public:
+        /* clears the buffers and indexes the trees of the forest */
+        void reset(const forest& trees);
+
+        void add_node(const tree::node& n);
+        void set_radius(const tree::node& n);
+    };
+
+    /* called from the thread executing run() after each step with (finished steps, arterial delta, venous delta) */
+    using step_callback = std::function<void(unsigned int, const step_delta&, const step_delta&)>;
 
     /* scaled distance parameters over time */
     struct parameter
@@ -138,6 +204,13 @@ struct synthesizer
         oc_tree_node m_node_search;
         std::vector<glm::vec3> m_killed_attr;
         prf::monitor m_profiler;
+        step_delta m_delta;
+
+        /* incremented on every change of m_forest; m_arrays is the snapshot of generation m_arrays_generation */
+        std::uint64_t m_generation{0};
+        std::uint64_t m_arrays_generation{0};
+        std::shared_ptr<const node_arrays> m_arrays;
+        std::mutex m_arrays_mutex;
 
     public:
         system_data(const glm::vec3& min, const glm::vec3& max);
@@ -152,7 +225,16 @@ private:
     parameter m_params;
     system_data m_systems[static_cast<int>(system::count)];
 
-    std::atomic_bool m_is_running;
+    /* cached signed distance grid of the domain (boundary enforcement); rebuilt if the resolution or the domain changed */
+    std::unique_ptr<util::sdf_grid> m_boundary;
+    unsigned int m_boundary_resolution{0};
+    std::uint64_t m_boundary_generation{0};
+
+    /* claimed by try_claim() / run() until run() returns; m_stop_requested is reset by the claim only */
+    std::atomic_bool m_is_running{false};
+    std::atomic_bool m_stop_requested{false};
+    progress_callback m_progress;
+    step_callback m_step_callback;
 
 
 public:
@@ -169,15 +251,46 @@ public:
 
     const forest& get_forest(const system sys);
     void set_forest(const system sys, const forest& other);
+    void set_forest(const system sys, forest&& other);
 
     tree::node& create_root(const system sys, const glm::vec3& pos);
-    void create_attr(const system sys, const glm::vec3& pos);
-    void try_attr(const system sys, const glm::vec3& pos);
 
-    void run();
+    /*
+     * snapshot of the forest as node arrays; rebuilt only if the forest changed since the last call
+     * -> holders of the pointer keep their snapshot, it is never modified
+     */
+    std::shared_ptr<const node_arrays> get_arrays(const system sys);
+    std::uint64_t get_generation(const system sys) const;
+
+    /*
+     * rows as in get_arrays(); see vs::delete_where()
+     * -> edits claim the synthesizer like run(); both throw std::runtime_error while it is running
+     */
+    std::size_t delete_where(const system sys, const std::uint8_t* mask, std::size_t count);
+    /* new positions (3 * count) and/or radii (count) per row; either may be nullptr */
+    void update_nodes(const system sys, const float* positions, const float* radii, std::size_t count);
+    void create_attr(const system sys, const glm::vec3& pos);
+    bool try_attr(const system sys, const glm::vec3& pos);
+
+    /*
+     * claims the synthesizer for a run (false if it is already claimed or running); the claim is released by run(true),
+     * which must follow, e.g. on another thread
+     */
+    bool try_claim();
+    /* gives up a claim that is not followed by run(true) (e.g. the thread for the run could not be started) */
+    void release_claim();
+    /* throws std::runtime_error if not claimed and already running; stop() after the claim ends the run before its first step */
+    void run(bool claimed = false);
+    void stop();
+    bool is_running() const;
+
+    void set_progress_callback(const progress_callback& callback);
+    void set_step_callback(const step_callback& callback);
 
 private:
     void init_runtime_params();
+    void init_boundary();
+    void index_forest(const system sys);
 
     void step(const system sys);
     void sample_attraction();
@@ -186,6 +299,8 @@ private:
     void step_kill(const system sys, std::map< tree::node*, std::list<attr> >& attr_map);
     void combine_systems();
 
+    bool constrain_growth(const glm::vec3& origin, glm::vec3& dir, float distance) const;
+
     void domain_growth(const system sys);
 };
 
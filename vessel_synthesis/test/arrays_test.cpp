@@ -0,0 +1,469 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <vessel_synthesis/arrays.h>
+#include <vessel_synthesis/mapped.h>
+#include <vessel_synthesis/mesh.h>
+#include <vessel_synthesis/octree.h>
+#include <vessel_synthesis/serialize.h>
+#include <vessel_synthesis/vtp.h>
+
+#include <glm/glm.hpp>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <string>
+
+namespace
+{
+
+/*       0
+ *      / \
+ *     1   2
+ *     |  / \
+ *     3 4   5
+ */
+vs::binary_tree<vs::node_data> example_tree()
+{
+    vs::binary_tree<vs::node_data> tree;
+    auto& root = tree.create_root(vs::node_data{{0.0f, 0.0f, 0.0f}, 0.5f, nullptr});
+    auto& n_1 = tree.create_node(root, vs::node_data{{1.0f, 0.0f, 0.0f}, 0.4f, nullptr});
+    auto& n_2 = tree.create_node(root, vs::node_data{{0.0f, 1.0f, 0.0f}, 0.3f, nullptr});
+    tree.create_node(n_1, vs::node_data{{2.0f, 0.0f, 0.0f}, 0.2f, nullptr});
+    tree.create_node(n_2, vs::node_data{{0.0f, 2.0f, 0.0f}, 0.1f, nullptr});
+    tree.create_node(n_2, vs::node_data{{0.0f, 2.0f, 1.0f}, 0.1f, nullptr});
+    return tree;
+}
+
+/* example tree, an empty tree and the example tree without node 1 (ids 0, 2, 4, 5: rows are not ids) */
+vs::forest<vs::node_data> example_forest()
+{
+    vs::forest<vs::node_data> forest;
+    forest.emplace_back(example_tree());
+    forest.emplace_back();
+    forest.emplace_back(example_tree()).delete_node(1);
+    return forest;
+}
+
+/* temporary file name unique to the process and the test (tests may run in parallel, e.g. ctest -j) */
+std::string unique_temp_path(const std::string& extension)
+{
+    const auto* test = testing::UnitTest::GetInstance()->current_test_info();
+    auto name = std::string("vs_") + test->test_suite_name() + "_" + test->name() + "_" + std::to_string(std::random_device{}()) + "." + extension;
+    return (std::filesystem::temp_directory_path() / name).string();
+}
+
+/* full binary tree with 2^depth - 1 nodes, children spread in alternating planes */
+vs::binary_tree<vs::node_data> full_tree(int depth)
+{
+    vs::binary_tree<vs::node_data> tree;
+    std::vector<vs::node_id> level{ tree.create_root(vs::node_data{{0.0f, 0.0f, 0.0f}, 1.0f, nullptr}).id() };
+
+    for(int d = 1; d < depth; d++)
+    {
+        std::vector<vs::node_id> next;
+        for(auto id : level)
+        {
+            auto parent = tree.get_node(id).data();
+            for(float side : {-1.0f, 1.0f})
+            {
+                auto spread = (d % 2 == 0) ? glm::vec3(0.0f, side, 0.0f) : glm::vec3(0.0f, 0.0f, side);
+                auto position = parent.m_pos + glm::vec3(1.0f, 0.0f, 0.0f) + spread / static_cast<float>(d);
+                next.push_back(tree.create_node(id, vs::node_data{position, 0.8f * parent.m_radius, nullptr}).id());
+            }
+        }
+        level = std::move(next);
+    }
+    return tree;
+}
+
+}
+
+TEST(arrays, tree)
+{
+    auto tree = example_tree();
+    auto arrays = vs::to_arrays(tree);
+
+    /*=======================================================*/
+    ASSERT_EQ(arrays.size(), 6);
+    ASSERT_EQ(arrays.m_positions.size(), 18);
+    EXPECT_THAT(arrays.m_ids, testing::ElementsAre(0, 1, 2, 3, 4, 5));
+    EXPECT_THAT(arrays.m_parents, testing::ElementsAre(-1, 0, 0, 1, 2, 2));
+    EXPECT_THAT(arrays.m_offsets, testing::ElementsAre(0, 6));
+    /*=======================================================*/
+
+    /*=======================================================*/
+    using t = vs::node_type;
+    std::vector<vs::node_type> types(arrays.m_types.size());
+    std::transform(arrays.m_types.begin(), arrays.m_types.end(), types.begin(), [](auto c){ return static_cast<t>(c); });
+    EXPECT_THAT(types, testing::ElementsAre(t::root, t::inter, t::joint, t::leaf, t::leaf, t::leaf));
+    /*=======================================================*/
+
+    /*=======================================================*/
+    for(std::size_t i = 0; i < arrays.size(); i++)
+    {
+        const auto& n = tree.get_node(arrays.m_ids[i]);
+        EXPECT_EQ(arrays.m_positions[3*i + 0], n.data().m_pos.x);
+        EXPECT_EQ(arrays.m_positions[3*i + 1], n.data().m_pos.y);
+        EXPECT_EQ(arrays.m_positions[3*i + 2], n.data().m_pos.z);
+        EXPECT_EQ(arrays.m_radii[i], n.data().m_radius);
+    }
+    /*=======================================================*/
+}
+
+TEST(arrays, forest)
+{
+    vs::forest<vs::node_data> forest;
+    forest.emplace_back(example_tree());
+    forest.emplace_back();
+    forest.emplace_back(example_tree());
+
+    auto arrays = vs::to_arrays(forest);
+
+    /*=======================================================*/
+    ASSERT_EQ(arrays.size(), 12);
+    EXPECT_EQ(arrays.tree_count(), 3);
+    EXPECT_THAT(arrays.m_offsets, testing::ElementsAre(0, 6, 6, 12));
+    EXPECT_THAT(arrays.m_parents, testing::ElementsAre(-1, 0, 0, 1, 2, 2, -1, 6, 6, 7, 8, 8));
+    /*=======================================================*/
+}
+
+TEST(arrays, from_arrays)
+{
+    vs::forest<vs::node_data> forest;
+    forest.emplace_back(example_tree());
+    forest.emplace_back(example_tree());
+    auto arrays = vs::to_arrays(forest);
+
+    std::vector<std::int64_t> parents(arrays.m_parents.begin(), arrays.m_parents.end());
+    std::vector<std::int64_t> tree_ids(arrays.size());
+    for(std::size_t t = 0; t < arrays.tree_count(); t++)
+    {
+        std::fill(tree_ids.begin() + arrays.m_offsets[t], tree_ids.begin() + arrays.m_offsets[t + 1], t);
+    }
+
+    /*=======================================================*/
+    auto result = vs::from_arrays(arrays.m_positions.data(), arrays.m_radii.data(), parents.data(), tree_ids.data(), arrays.size());
+    auto round_trip = vs::to_arrays(result);
+
+    ASSERT_EQ(result.trees().size(), 2);
+    EXPECT_EQ(round_trip.m_positions, arrays.m_positions);
+    EXPECT_EQ(round_trip.m_radii, arrays.m_radii);
+    EXPECT_EQ(round_trip.m_parents, arrays.m_parents);
+    EXPECT_EQ(round_trip.m_types, arrays.m_types);
+    EXPECT_EQ(&result.trees().front(), result.trees().front().get_root().data().m_tree);
+    /*=======================================================*/
+
+    /*=======================================================*/
+    auto invalid = [&](std::vector<std::int64_t> p, const std::int64_t* ids)
+    {
+        EXPECT_THROW(vs::from_arrays(arrays.m_positions.data(), arrays.m_radii.data(), p.data(), ids, p.size()), std::invalid_argument);
+    };
+
+    auto p = parents; p[3] = 12;
+    invalid(p, nullptr);                                // out of range
+    p = parents; p[5] = 0;
+    invalid(p, nullptr);                                // three children
+    p = parents; p[7] = 1;
+    invalid(p, tree_ids.data());                        // parent in other tree
+    std::vector<std::int64_t> single_tree(parents.size(), 0);
+    invalid(parents, single_tree.data());               // two roots in one tree
+    p = parents; p[0] = 3;
+    invalid(p, nullptr);                                // cycle
+    /*=======================================================*/
+}
+
+TEST(arrays, orders)
+{
+    vs::forest<vs::node_data> forest;
+    forest.emplace_back(example_tree());
+    forest.emplace_back(example_tree());
+    auto orders = vs::to_orders(vs::to_arrays(forest));
+
+    /*=======================================================*/
+    EXPECT_THAT(orders.m_depth_first, testing::ElementsAre(0, 1, 3, 2, 4, 5, 6, 7, 9, 8, 10, 11));
+    EXPECT_THAT(orders.m_post_order, testing::ElementsAre(3, 1, 4, 5, 2, 0, 9, 7, 10, 11, 8, 6));
+    EXPECT_THAT(orders.m_depths, testing::ElementsAre(0, 1, 1, 2, 2, 2, 0, 1, 1, 2, 2, 2));
+    EXPECT_THAT(orders.m_strahler, testing::ElementsAre(2, 1, 2, 1, 1, 1, 2, 1, 2, 1, 1, 1));
+    EXPECT_THAT(orders.m_subtree_begin, testing::ElementsAre(0, 1, 3, 2, 4, 5, 6, 7, 9, 8, 10, 11));
+    EXPECT_THAT(orders.m_subtree_end, testing::ElementsAre(6, 3, 6, 3, 5, 6, 12, 9, 12, 9, 11, 12));
+    /*=======================================================*/
+
+    /*=======================================================*/
+    auto tree = example_tree();
+    std::vector<vs::node_id> post_order;
+    tree.post_order([&](const auto& n){ post_order.push_back(n.id()); });
+    EXPECT_THAT(post_order, testing::ElementsAre(3, 1, 4, 5, 2, 0));
+    /*=======================================================*/
+}
+
+TEST(arrays, delete_where)
+{
+    vs::forest<vs::node_data> forest;
+    forest.emplace_back(example_tree());
+    forest.emplace_back(example_tree());
+
+    /* tree 0: node 2 (and 4, 5 with it), node 4 again; tree 1: root */
+    std::vector<std::uint8_t> mask{0, 0, 1, 0, 1, 0,  1, 0, 0, 0, 0, 0};
+
+    /*=======================================================*/
+    EXPECT_EQ(vs::delete_where(forest, mask.data(), mask.size()), 9);
+
+    auto arrays = vs::to_arrays(forest);
+    EXPECT_THAT(arrays.m_ids, testing::ElementsAre(0, 1, 3));
+    EXPECT_THAT(arrays.m_offsets, testing::ElementsAre(0, 3, 3));
+    EXPECT_THROW(vs::delete_where(forest, mask.data(), mask.size()), std::invalid_argument);
+    /*=======================================================*/
+}
+
+TEST(serialize, forest)
+{
+    auto forest = example_forest();
+    forest.trees().back().create_node(0, vs::node_data{{5.0f, 0.0f, 0.0f}, 0.2f, nullptr});
+
+    std::vector<std::byte> buffer(vs::serialized_size(forest));
+    vs::serialize(forest, buffer.data());
+
+    /*=======================================================*/
+    auto result = vs::deserialize_forest(buffer.data(), buffer.size());
+    auto expected = vs::to_arrays(forest);
+    auto arrays = vs::to_arrays(result);
+
+    ASSERT_EQ(result.trees().size(), 3);
+    EXPECT_EQ(arrays.m_positions, expected.m_positions);
+    EXPECT_EQ(arrays.m_radii, expected.m_radii);
+    EXPECT_EQ(arrays.m_parents, expected.m_parents);
+    EXPECT_EQ(arrays.m_ids, expected.m_ids);
+    EXPECT_EQ(arrays.m_offsets, expected.m_offsets);
+    EXPECT_EQ(result.trees().back().create_node(6, vs::node_data{}).id(), 7);
+    EXPECT_EQ(result.trees().back().get_root().data().m_tree, &result.trees().back());
+    /*=======================================================*/
+
+    /*=======================================================*/
+    EXPECT_THROW(vs::deserialize_forest(buffer.data(), buffer.size() - 1), std::invalid_argument);
+    EXPECT_THROW(vs::deserialize_tree(buffer.data(), buffer.size()), std::invalid_argument);
+
+    auto corrupt = buffer;
+    vs::serial_node record;
+    auto* first = corrupt.data() + sizeof(vs::serial_header) + 4 * sizeof(std::uint64_t) + 3 * sizeof(vs::serial_node);
+    std::memcpy(&record, first, sizeof(record));
+    record.m_parent = 5;                                 // parent stored after the child
+    std::memcpy(first, &record, sizeof(record));
+    EXPECT_THROW(vs::deserialize_forest(corrupt.data(), corrupt.size()), std::invalid_argument);
+
+    /* offsets beyond the node count are rejected before any record is read */
+    corrupt = buffer;
+    std::uint64_t offset = 11 + 1000;
+    std::memcpy(corrupt.data() + sizeof(vs::serial_header) + sizeof(std::uint64_t), &offset, sizeof(offset));
+    EXPECT_THROW(vs::deserialize_forest(corrupt.data(), corrupt.size()), std::invalid_argument);
+    /*=======================================================*/
+}
+
+TEST(mesh, tube)
+{
+    auto tree = example_tree();
+
+    vs::mesh_settings settings;
+    settings.m_segments = 8;
+    settings.m_subdivisions = 2;
+
+    /*=======================================================*/
+    /* 6 rings, 2 subdivision rings per segment, root cap + 3 leaf caps */
+    auto mesh = vs::make_tube_mesh(tree, settings);
+    EXPECT_EQ(mesh.vertex_count(), 6 * 8 + 5 * 2 * 8 + 4);
+    EXPECT_EQ(mesh.triangle_count(), 5 * 3 * 2 * 8 + 4 * 8);
+    EXPECT_EQ(mesh.m_normals.size(), mesh.m_vertices.size());
+    /*=======================================================*/
+
+    /*=======================================================*/
+    /* a chain is a closed, consistently oriented surface: every directed edge is used once
+       (joint rings are shared by three segments) */
+    vs::binary_tree<vs::node_data> chain;
+    auto& root = chain.create_root(vs::node_data{{0.0f, 0.0f, 0.0f}, 0.5f, nullptr});
+    auto& n_1 = chain.create_node(root, vs::node_data{{1.0f, 0.0f, 0.0f}, 0.4f, nullptr});
+    chain.create_node(n_1, vs::node_data{{1.5f, 1.0f, 0.0f}, 0.3f, nullptr});
+    auto tube = vs::make_tube_mesh(chain, settings);
+
+    std::map<std::pair<std::uint32_t, std::uint32_t>, int> edges;
+    for(std::size_t t = 0; t < tube.triangle_count(); t++)
+    {
+        for(int j = 0; j < 3; j++) { edges[{tube.m_triangles[3*t + j], tube.m_triangles[3*t + (j + 1) % 3]}]++; }
+    }
+    EXPECT_EQ(edges.size(), 3 * tube.triangle_count());
+    for(const auto& [edge, count] : edges) { EXPECT_EQ(edges.count({edge.second, edge.first}), 1); }
+
+    /* counter clockwise seen from outside: face normals point along the vertex normals */
+    for(std::size_t t = 0; t < tube.triangle_count(); t++)
+    {
+        auto vertex = [&](int j) { auto v = tube.m_triangles[3*t + j]; return glm::vec3(tube.m_vertices[3*v], tube.m_vertices[3*v + 1], tube.m_vertices[3*v + 2]); };
+        auto normal = [&](int j) { auto v = tube.m_triangles[3*t + j]; return glm::vec3(tube.m_normals[3*v], tube.m_normals[3*v + 1], tube.m_normals[3*v + 2]); };
+        auto face = glm::cross(vertex(1) - vertex(0), vertex(2) - vertex(0));
+        EXPECT_GT(glm::dot(face, normal(0) + normal(1) + normal(2)), 0.0f);
+    }
+    /*=======================================================*/
+
+    /*=======================================================*/
+    /* large enough to be split over threads (4096 nodes per thread) */
+    auto large = vs::to_arrays(full_tree(14));
+    ASSERT_GT(large.size(), 3 * 4096);
+
+    auto single = settings;
+    single.m_threads = 1;
+    auto threaded = settings;
+    threaded.m_threads = 4;
+
+    auto single_mesh = vs::make_tube_mesh(large, single);
+    auto threaded_mesh = vs::make_tube_mesh(large, threaded);
+    EXPECT_EQ(threaded_mesh.m_vertices, single_mesh.m_vertices);
+    EXPECT_EQ(threaded_mesh.m_normals, single_mesh.m_normals);
+    EXPECT_EQ(threaded_mesh.m_triangles, single_mesh.m_triangles);
+
+    settings.m_segments = 2;
+    EXPECT_THROW(vs::make_tube_mesh(tree, settings), std::invalid_argument);
+    /*=======================================================*/
+}
+
+TEST(vtp, forest)
+{
+    auto forest = example_forest();
+
+    auto path = unique_temp_path("vtp");
+    ASSERT_TRUE(vs::write_vtp(path, forest));
+
+    std::ifstream in(path, std::ios::binary);
+    std::string file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    std::filesystem::remove(path);
+
+    /*=======================================================*/
+    /* one piece per non empty tree */
+    auto count = [&](const std::string& text)
+    {
+        std::size_t n = 0;
+        for(auto pos = file.find(text); pos != std::string::npos; pos = file.find(text, pos + 1)) { n++; }
+        return n;
+    };
+    EXPECT_EQ(count("<Piece "), 2);
+    EXPECT_EQ(count("<Piece NumberOfPoints=\"6\" NumberOfVerts=\"0\" NumberOfLines=\"5\""), 1);
+    EXPECT_EQ(count("<Piece NumberOfPoints=\"4\" NumberOfVerts=\"0\" NumberOfLines=\"3\""), 1);
+    /*=======================================================*/
+
+    /*=======================================================*/
+    /* arrays follow the '_' of the appended section at their (patched) offsets */
+    auto data = file.find('_', file.find("<AppendedData")) + 1;
+    auto array = [&](const std::string& name, int piece)
+    {
+        auto pos = file.find("Name=\"" + name + "\"");
+        for(int p = 0; p < piece; p++) { pos = file.find("Name=\"" + name + "\"", pos + 1); }
+
+        auto attribute = file.find("offset=\"", pos) + 8;
+        auto offset = std::stoull(file.substr(attribute, 20));
+
+        std::uint64_t bytes;
+        std::memcpy(&bytes, file.data() + data + offset, sizeof(bytes));
+        return std::string_view(file.data() + data + offset + sizeof(bytes), bytes);
+    };
+
+    auto radii = array("radius", 1);
+    auto expected = vs::to_arrays(forest);
+    ASSERT_EQ(radii.size(), 4 * sizeof(float));
+    EXPECT_EQ(std::memcmp(radii.data(), expected.m_radii.data() + 6, radii.size()), 0);
+
+    std::int32_t tree_id;
+    std::memcpy(&tree_id, array("tree_id", 1).data(), sizeof(tree_id));
+    EXPECT_EQ(tree_id, 2);
+
+    /* rows local to the piece */
+    auto connectivity = array("connectivity", 1);
+    ASSERT_EQ(connectivity.size(), 6 * sizeof(std::int64_t));
+    std::vector<std::int64_t> lines(6);
+    std::memcpy(lines.data(), connectivity.data(), connectivity.size());
+    EXPECT_THAT(lines, testing::ElementsAre(0, 1, 1, 2, 1, 3));
+    EXPECT_EQ(array("offsets", 1).size(), 3 * sizeof(std::int64_t));
+    /*=======================================================*/
+}
+
+TEST(mapped, forest)
+{
+    auto forest = example_forest();
+
+    auto path = unique_temp_path("vsfm");
+    ASSERT_TRUE(vs::write_mapped(path, forest));
+
+    /*=======================================================*/
+    {
+        vs::mapped_forest mapped(path);
+        auto expected = vs::to_arrays(forest);
+
+        ASSERT_EQ(mapped.size(), 10);
+        ASSERT_EQ(mapped.tree_count(), 3);
+        EXPECT_THAT(mapped.offsets(), testing::ElementsAreArray(expected.m_offsets));
+        EXPECT_THAT(mapped.positions(), testing::ElementsAreArray(expected.m_positions));
+        EXPECT_THAT(mapped.parents(), testing::ElementsAreArray(expected.m_parents));
+        EXPECT_THAT(mapped.ids(), testing::ElementsAreArray(expected.m_ids));
+        EXPECT_EQ(reinterpret_cast<std::uintptr_t>(mapped.radii().data()) % 64, 0);
+
+        auto tree = mapped.tree(2);
+        EXPECT_EQ(tree.m_first, 6);
+        EXPECT_THAT(tree.m_ids, testing::ElementsAre(0, 2, 4, 5));
+        EXPECT_THROW(mapped.tree(3), std::out_of_range);
+
+        auto result = vs::to_arrays(mapped.to_forest());
+        EXPECT_EQ(result.m_positions, expected.m_positions);
+        EXPECT_EQ(result.m_ids, expected.m_ids);
+        EXPECT_EQ(mapped.to_tree(2).create_node(0, vs::node_data{}).id(), 6);
+    }
+    /*=======================================================*/
+
+    /*=======================================================*/
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.write("VSXX", 4);
+    }
+    EXPECT_THROW(vs::mapped_forest{path}, std::invalid_argument);
+    std::filesystem::remove(path);
+    EXPECT_THROW(vs::mapped_forest{path}, std::runtime_error);
+    /*=======================================================*/
+}
+
+TEST(octree, bulk_insert)
+{
+    vs::util::oc_tree<glm::vec3, 3, int> octree({-1.0f, -1.0f, -1.0f}, {1.0f, 1.0f, 1.0f}, 8);
+
+    std::vector<glm::vec3> points;
+    std::vector<int> data;
+    for(int i = 0; i < 1000; i++)
+    {
+        points.emplace_back(std::sin(i * 1.3f), std::cos(i * 0.7f), std::sin(i * 0.11f));
+        data.push_back(i);
+    }
+    points.emplace_back(2.0f, 0.0f, 0.0f);
+    data.push_back(-1);
+
+    octree.insert({0.0f, 0.0f, 0.0f}, 1000);
+
+    /*=======================================================*/
+    EXPECT_EQ(octree.bulk_insert(points, data), 1000);
+    EXPECT_EQ(octree.size(), 1001);
+
+    std::vector<int> result;
+    octree.euclidean_range({0.0f, 0.0f, 0.0f}, 0.5f, result);
+
+    std::vector<int> expected{1000};
+    for(int i = 0; i < 1000; i++) { if(glm::length(points[i]) <= 0.5f) { expected.push_back(i); } }
+
+    std::sort(result.begin(), result.end());
+    std::sort(expected.begin(), expected.end());
+    EXPECT_EQ(result, expected);
+    /*=======================================================*/
+
+    /*=======================================================*/
+    EXPECT_TRUE(octree.remove(points[10], 10));
+    octree.insert({0.1f, 0.1f, 0.1f}, 2000);
+    EXPECT_EQ(octree.size(), 1001);
+    /*=======================================================*/
+}
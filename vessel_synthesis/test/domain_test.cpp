@@ -0,0 +1,328 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <vessel_synthesis/domain.h>
+#include <vessel_synthesis/raster.h>
+#include <vessel_synthesis/sdf.h>
+
+TEST(domain, contains)
+{
+    vs::domain_sphere sphere({0.0, 0.0, 0.0}, 0.5);
+
+    /*=======================================================*/
+    EXPECT_TRUE(sphere.contains({0.0, 0.0, 0.0}));
+    EXPECT_TRUE(sphere.contains({0.0, 0.49, 0.0}));
+    EXPECT_FALSE(sphere.contains({0.0, 0.51, 0.0}));
+    /*=======================================================*/
+
+    /*=======================================================*/
+    for(int i = 0; i < 1000; i++)
+    {
+        EXPECT_TRUE(sphere.contains(sphere.sample()));
+    }
+    /*=======================================================*/
+}
+
+TEST(domain, sparse_voxels)
+{
+    vs::domain_sparse_voxels sparse({0.0, 0.0, 0.0}, {0.1, 0.1, 0.1});
+    EXPECT_THROW(sparse.sample(), std::runtime_error);
+
+    /*=======================================================*/
+    sparse.activate(glm::ivec3{0, 0, 0});
+    sparse.activate(glm::ivec3{0, 0, 0});
+    sparse.activate(glm::ivec3{7, 7, 7});
+    sparse.activate(glm::ivec3{-1, 3, 1000});
+
+    EXPECT_EQ(sparse.active_count(), 3);
+    EXPECT_EQ(sparse.tile_count(), 2);
+
+    EXPECT_TRUE(sparse.contains({0.05, 0.05, 0.05}));
+    EXPECT_TRUE(sparse.contains({0.75, 0.75, 0.75}));
+    EXPECT_TRUE(sparse.contains({-0.05, 0.35, 100.05}));
+    EXPECT_FALSE(sparse.contains({0.15, 0.05, 0.05}));
+    EXPECT_FALSE(sparse.contains({-0.05, 0.05, 0.05}));
+    /*=======================================================*/
+
+    /*=======================================================*/
+    auto min = sparse.min_extends();
+    auto max = sparse.max_extends();
+    EXPECT_FLOAT_EQ(min.x, -0.1f);
+    EXPECT_FLOAT_EQ(max.y, 0.8f);
+    EXPECT_FLOAT_EQ(max.z, 100.1f);
+    /*=======================================================*/
+
+    /*=======================================================*/
+    for(int i = 0; i < 1000; i++)
+    {
+        auto p = sparse.sample();
+        EXPECT_TRUE(sparse.contains(p));
+    }
+    /*=======================================================*/
+    /*=======================================================*/
+    /* tiles a multiple of 2^21 tiles apart are distinct */
+    vs::domain_sparse_voxels far({0.0, 0.0, 0.0}, {1.0, 1.0, 1.0});
+    glm::ivec3 alias{8 << 21, 0, 0};
+    far.activate(glm::ivec3{0, 0, 0});
+    EXPECT_FALSE(far.is_active(alias));
+
+    far.activate(alias + glm::ivec3{1, 0, 0});
+    EXPECT_EQ(far.tile_count(), 2);
+    EXPECT_TRUE(far.is_active(alias + glm::ivec3{1, 0, 0}));
+    EXPECT_FALSE(far.is_active(glm::ivec3{1, 0, 0}));
+    /*=======================================================*/
+
+    /*=======================================================*/
+    /* only changes of the geometry count; composites follow their children */
+    EXPECT_EQ(sparse.generation(), 3u);
+
+    vs::domain_sphere sphere({0.0, 0.0, 0.0}, 0.5);
+    vs::domain_union both({sparse, sphere});
+    auto generation = both.generation();
+
+    sparse.activate(glm::ivec3{0, 0, 0});
+    EXPECT_EQ(both.generation(), generation);
+    sparse.activate(glm::ivec3{1, 0, 0});
+    EXPECT_GT(both.generation(), generation);
+    /*=======================================================*/
+}
+
+TEST(domain, sparse_voxels_mask)
+{
+    std::vector<bool> mask(4*4*4, false);
+    mask[0] = true;
+    mask[1*16 + 2*4 + 3] = true;
+
+    vs::domain_sparse_voxels sparse({0.0, 0.0, 0.0}, {1.0, 1.0, 1.0}, {4, 4, 4}, mask);
+
+    /*=======================================================*/
+    EXPECT_EQ(sparse.active_count(), 2);
+    EXPECT_TRUE(sparse.contains({0.1, 0.1, 0.1}));
+    EXPECT_TRUE(sparse.contains({0.8, 0.6, 0.3}));
+    EXPECT_FALSE(sparse.contains({0.6, 0.8, 0.3}));
+    /*=======================================================*/
+
+    /*=======================================================*/
+    /* masks smaller than the resolution are rejected before they are read */
+    std::vector<bool> small(4*4*3, true);
+    EXPECT_THROW(vs::domain_sparse_voxels({0.0, 0.0, 0.0}, {1.0, 1.0, 1.0}, {4, 4, 4}, small), std::invalid_argument);
+    EXPECT_THROW(vs::domain_voxels({0.0, 0.0, 0.0}, {1.0, 1.0, 1.0}, {4, 4, 4}, small), std::invalid_argument);
+    EXPECT_THROW(vs::domain_voxels({0.0, 0.0, 0.0}, {1.0, 1.0, 1.0}, {4, 0, 4}, small), std::invalid_argument);
+    /*=======================================================*/
+}
+
+TEST(domain, voxels_mask_order)
+{
+    /* 5 x 3 x 2 voxels (x, y, z); odd sizes exercise the tail of the scan */
+    const glm::ivec3 res(5, 3, 2);
+    std::vector<std::uint8_t> fortran(res.x * res.y * res.z, 0), c(fortran.size(), 0);
+    auto set = [&](int x, int y, int z)
+    {
+        fortran[x + res.x * (y + res.y * z)] = 1;
+        c[z + res.z * (y + res.y * x)] = 1;
+    };
+    set(0, 0, 0);
+    set(4, 1, 0);
+    set(2, 2, 1);
+
+    vs::domain_voxels f({0.0, 0.0, 0.0}, {5.0, 3.0, 2.0}, res, fortran.data(), vs::voxel_order::fortran);
+    vs::domain_voxels r({0.0, 0.0, 0.0}, {5.0, 3.0, 2.0}, res, c.data(), vs::voxel_order::c);
+
+    /*=======================================================*/
+    for(const auto* d : {&f, &r})
+    {
+        EXPECT_TRUE(d->contains({0.5, 0.5, 0.5}));
+        EXPECT_TRUE(d->contains({4.5, 1.5, 0.5}));
+        EXPECT_TRUE(d->contains({2.5, 2.5, 1.5}));
+        EXPECT_FALSE(d->contains({1.5, 0.5, 0.5}));
+        EXPECT_FALSE(d->contains({2.5, 2.5, 0.5}));
+        EXPECT_FLOAT_EQ(d->volume(), 3.0f);
+    }
+    /*=======================================================*/
+}
+
+TEST(domain, composite)
+{
+    vs::domain_sphere organ({0.0, 0.0, 0.0}, 0.5);
+    vs::domain_sphere tumour({0.25, 0.0, 0.0}, 0.2);
+    vs::domain_sphere lobe({1.0, 0.0, 0.0}, 0.5);
+
+    /*=======================================================*/
+    vs::domain_difference difference(organ, tumour);
+    EXPECT_TRUE(difference.contains({-0.25, 0.0, 0.0}));
+    EXPECT_FALSE(difference.contains({0.25, 0.0, 0.0}));
+    EXPECT_NEAR(difference.volume(), organ.volume() - tumour.volume(), 0.05f * organ.volume());
+
+    for(int i = 0; i < 1000; i++)
+    {
+        EXPECT_TRUE(difference.contains(difference.sample()));
+    }
+    /*=======================================================*/
+
+    /*=======================================================*/
+    vs::domain_union lobes({organ, lobe});
+    EXPECT_FLOAT_EQ(lobes.min_extends().x, -0.5f);
+    EXPECT_FLOAT_EQ(lobes.max_extends().x, 1.5f);
+
+    for(int i = 0; i < 1000; i++)
+    {
+        EXPECT_TRUE(lobes.contains(lobes.sample()));
+    }
+    /*=======================================================*/
+
+    /*=======================================================*/
+    vs::domain_intersection overlap({organ, lobe});
+    EXPECT_FLOAT_EQ(overlap.min_extends().x, 0.5f);
+    EXPECT_FLOAT_EQ(overlap.max_extends().x, 0.5f);
+    EXPECT_THROW(overlap.sample(), std::runtime_error);
+
+    vs::domain_intersection overlap_tumour({organ, tumour});
+    for(int i = 0; i < 1000; i++)
+    {
+        EXPECT_TRUE(overlap_tumour.contains(overlap_tumour.sample()));
+    }
+    /*=======================================================*/
+
+    /*=======================================================*/
+    /* bounds and estimates follow a child that changed after the composite was built */
+    vs::domain_sparse_voxels sparse({0.0, 0.0, 0.0}, {0.1, 0.1, 0.1});
+    sparse.activate(glm::ivec3{0, 0, 0});
+    vs::domain_sphere drop({-1.0, 0.0, 0.0}, 0.05);
+    vs::domain_union grown({sparse, drop});
+    EXPECT_FALSE(grown.contains({2.05, 0.05, 0.05}));
+
+    sparse.activate(glm::ivec3{20, 0, 0});
+    EXPECT_TRUE(grown.contains({2.05, 0.05, 0.05}));
+    EXPECT_FLOAT_EQ(grown.max_extends().x, 2.1f);
+    EXPECT_NEAR(grown.volume(), drop.volume() + 0.002f, 0.1f * drop.volume());
+
+    bool sampled = false;
+    for(int i = 0; i < 1000; i++)
+    {
+        auto p = grown.sample();
+        EXPECT_TRUE(grown.contains(p));
+        sampled |= (p.x > 2.0f);
+    }
+    EXPECT_TRUE(sampled);
+    /*=======================================================*/
+
+    /*=======================================================*/
+    /* seeding a composite does not reseed its (shared) children */
+    vs::domain_sphere reference({0.0, 0.0, 0.0}, 0.5);
+    organ.seed(7);
+    reference.seed(7);
+    difference.seed(1);
+    EXPECT_EQ(organ.sample(), reference.sample());
+    /*=======================================================*/
+}
+
+TEST(domain, sdf_grid)
+{
+    vs::domain_sphere sphere({0.0, 0.0, 0.0}, 0.5);
+    vs::util::sdf_grid sdf(sphere, 64);
+
+    /*=======================================================*/
+    float tolerance = 2.0f * sdf.cell_size().x;
+    EXPECT_NEAR(sdf.distance({0.0, 0.0, 0.0}), -0.5f, tolerance);
+    EXPECT_NEAR(sdf.distance({0.3, 0.0, 0.0}), -0.2f, tolerance);
+    EXPECT_NEAR(sdf.distance({0.0, 0.6, 0.0}), 0.1f, tolerance);
+    EXPECT_GT(sdf.distance({2.0, 0.0, 0.0}), 1.0f);
+    /*=======================================================*/
+
+    /*=======================================================*/
+    auto normal = glm::normalize(sdf.gradient({0.0, 0.0, 0.45}));
+    EXPECT_NEAR(normal.z, 1.0f, 0.05f);
+    /*=======================================================*/
+}
+
+TEST(domain, rasterize)
+{
+    /* one segment along x through the center of a 20^3 grid over [0, 1]^3 */
+    vs::binary_tree<vs::node_data> tree;
+    auto& root = tree.create_root(vs::node_data{{0.2f, 0.5f, 0.5f}, 0.1f, nullptr});
+    tree.create_node(root, vs::node_data{{0.8f, 0.5f, 0.5f}, 0.2f, nullptr});
+    vs::forest<vs::node_data> forest;
+    forest.emplace_back(std::move(tree));
+
+    std::vector<std::uint8_t> mask(20 * 20 * 20, 1);
+    vs::domain_voxels domain({0.0f, 0.0f, 0.0f}, {1.0f, 1.0f, 1.0f}, {20, 20, 20}, mask.data(), vs::voxel_order::fortran);
+
+    vs::raster_settings settings;
+    settings.m_order = vs::voxel_order::c;
+    vs::raster_volumes volumes(domain.grid(), settings);
+    volumes.rasterize(forest, 2);
+
+    /*=======================================================*/
+    const auto& grid = volumes.m_grid;
+    const float band = settings.band_distance(grid);
+    EXPECT_FLOAT_EQ(band, 0.2f);
+
+    for(int z = 0; z < 20; z++)
+    for(int y = 0; y < 20; y++)
+    for(int x = 0; x < 20; x++)
+    {
+        glm::vec3 p = (glm::vec3(x, y, z) + 0.5f) * 0.05f;
+        glm::vec3 q{std::clamp(p.x, 0.2f, 0.8f), 0.5f, 0.5f};
+        float expected = std::min(glm::distance(p, q) - 0.2f, band);
+
+        auto i = grid.index(x, y, z, vs::voxel_order::c);
+        ASSERT_NEAR(volumes.m_distance[i], expected, 1e-5f);
+        ASSERT_EQ(volumes.m_labels[i], expected <= 0.0f ? 2 : 0);
+    }
+    /*=======================================================*/
+
+    /*=======================================================*/
+    vs::raster_settings threaded = settings;
+    threaded.m_threads = 4;
+    vs::raster_volumes parallel(grid, threaded);
+    parallel.rasterize(forest, 2);
+    EXPECT_EQ(parallel.m_labels, volumes.m_labels);
+    EXPECT_EQ(parallel.m_distance, volumes.m_distance);
+
+    EXPECT_THROW(vs::raster_volumes(vs::voxel_grid{{0.0f, 0.0f, 0.0f}, {1.0f, 1.0f, 1.0f}, {0, 4, 4}}), std::invalid_argument);
+    /*=======================================================*/
+}
+
+TEST(domain, rasterize_occupancy)
+{
+    /* a thin segment (far below the voxel size) and a thick one, both away from the grid boundary */
+    vs::node_arrays arrays;
+    arrays.m_positions = {0.13f, 0.21f, 0.27f,  0.81f, 0.33f, 0.29f,  0.5f, 0.5f, 0.3f,  0.5f, 0.5f, 0.7f};
+    arrays.m_radii = {0.001f, 0.001f, 0.1f, 0.1f};
+    arrays.m_parents = {-1, 0, -1, 2};
+
+    vs::voxel_grid grid{{0.0f, 0.0f, 0.0f}, {1.0f, 1.0f, 1.0f}, {20, 20, 20}};
+    const float pi = 3.14159265f;
+
+    auto total = [&](const std::vector<float>& occupancy) { double sum = 0.0; for(auto o : occupancy) { sum += o; } return sum * 0.05 * 0.05 * 0.05; };
+
+    /*=======================================================*/
+    vs::node_arrays thin = arrays;
+    thin.m_parents[3] = -1;
+    std::vector<float> occupancy(grid.count(), 0.0f);
+    vs::rasterize_occupancy(thin, grid, occupancy);
+
+    float length = glm::distance(glm::vec3(0.13f, 0.21f, 0.27f), glm::vec3(0.81f, 0.33f, 0.29f));
+    EXPECT_NEAR(total(occupancy), pi * 0.001f * 0.001f * length, 1e-8);
+    EXPECT_GT(std::count_if(occupancy.begin(), occupancy.end(), [](float o) { return o > 0.0f; }), 13);
+    /*=======================================================*/
+
+    /*=======================================================*/
+    vs::raster_settings settings;
+    settings.m_occupancy = true;
+    vs::raster_volumes volumes(grid, settings);
+    volumes.rasterize(arrays);
+
+    float capsule = pi * 0.1f * 0.1f * 0.4f + 4.0f / 3.0f * pi * 0.1f * 0.1f * 0.1f;
+    EXPECT_NEAR(total(volumes.m_occupancy), capsule, 0.05 * capsule);
+    EXPECT_EQ(*std::max_element(volumes.m_occupancy.begin(), volumes.m_occupancy.end()), 1.0f);
+
+    settings.m_threads = 4;
+    vs::raster_volumes parallel(grid, settings);
+    parallel.rasterize(arrays);
+    EXPECT_EQ(parallel.m_occupancy, volumes.m_occupancy);
+
+    settings.m_supersampling = 5;
+    EXPECT_THROW(vs::rasterize_occupancy(arrays, grid, occupancy, settings), std::invalid_argument);
+    /*=======================================================*/
+}
@@ -0,0 +1,428 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <vessel_synthesis/profiler.h>
+
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+using namespace std::chrono_literals;
+
+/* minimal json syntax check (no semantic checks); true if the whole text is a single json value */
+struct json_checker
+{
+    const std::string& m_text;
+    std::size_t m_pos{0};
+
+public:
+    bool check()
+    {
+        return value() && (skip(), m_pos == m_text.size());
+    }
+
+private:
+    void skip()
+    {
+        while(m_pos < m_text.size() && std::isspace(static_cast<unsigned char>(m_text[m_pos]))) { m_pos++; }
+    }
+
+    bool literal(const char* word)
+    {
+        auto n = std::strlen(word);
+        if(m_text.compare(m_pos, n, word) != 0) { return false; }
+        m_pos += n;
+        return true;
+    }
+
+    bool string()
+    {
+        if(m_text[m_pos++] != '"') { return false; }
+        while(m_pos < m_text.size())
+        {
+            auto c = static_cast<unsigned char>(m_text[m_pos++]);
+            if(c == '"') { return true; }
+            if(c < 0x20) { return false; }
+            if(c == '\\')
+            {
+                if(m_pos >= m_text.size()) { return false; }
+                auto e = m_text[m_pos++];
+                if(e == 'u')
+                {
+                    for(int i = 0; i < 4; i++)
+                    {
+                        if(m_pos >= m_text.size() || !std::isxdigit(static_cast<unsigned char>(m_text[m_pos++]))) { return false; }
+                    }
+                }
+                else if(!std::strchr("\"\\/bfnrt", e)) { return false; }
+            }
+        }
+        return false;
+    }
+
+    bool number()
+    {
+        auto begin = m_pos;
+        if(m_text[m_pos] == '-') { m_pos++; }
+        while(m_pos < m_text.size() && std::strchr("0123456789.eE+-", m_text[m_pos])) { m_pos++; }
+        return m_pos > begin && std::isdigit(static_cast<unsigned char>(m_text[m_pos - 1]));
+    }
+
+    template<typename F>
+    bool list(char close, F element)
+    {
+        m_pos++;
+        skip();
+        if(m_pos < m_text.size() && m_text[m_pos] == close) { m_pos++; return true; }
+        while(true)
+        {
+            if(!element()) { return false; }
+            skip();
+            if(m_pos >= m_text.size()) { return false; }
+            auto c = m_text[m_pos++];
+            if(c == close) { return true; }
+            if(c != ',') { return false; }
+        }
+    }
+
+    bool value()
+    {
+        skip();
+        if(m_pos >= m_text.size()) { return false; }
+        switch(m_text[m_pos])
+        {
+        case '{': return list('}', [this]() { skip(); return m_pos < m_text.size() && string() && (skip(), m_pos < m_text.size() && m_text[m_pos++] == ':') && value(); });
+        case '[': return list(']', [this]() { return value(); });
+        case '"': return string();
+        case 't': return literal("true");
+        case 'f': return literal("false");
+        case 'n': return literal("null");
+        default:  return number();
+        }
+    }
+};
+
+/* runs func on count threads and waits for them */
+template<typename F>
+void on_threads(int count, F func)
+{
+    std::vector<std::thread> threads;
+    for(int t = 0; t < count; t++) { threads.emplace_back(func, t); }
+    for(auto& thread : threads) { thread.join(); }
+}
+
+/* first child with the given name or nullptr */
+const vs::prf::monitor::call_node* child(const vs::prf::monitor::call_node& node, const std::string& name)
+{
+    for(const auto& c : node.m_children)
+    {
+        if(c.m_name == name) { return &c; }
+    }
+    return nullptr;
+}
+
+}
+
+/*=====================================================================================================*/
+/*=====================================================================================================*/
+/*=====================================================================================================*/
+
+TEST(profiler, scopes)
+{
+    auto a = vs::prf::register_scope("test_scope_a");
+    auto b = vs::prf::register_scope("test_scope_b");
+
+    /* names are compared by content, not by pointer */
+    std::string name = "test_scope_a";
+    EXPECT_EQ(vs::prf::register_scope(name.c_str()), a);
+    EXPECT_NE(a, b);
+    EXPECT_STREQ(vs::prf::scope_name(a), "test_scope_a");
+    EXPECT_STREQ(vs::prf::scope_name(b), "test_scope_b");
+    EXPECT_GT(vs::prf::scope_count(), std::size_t(b));
+}
+
+TEST(profiler, threads)
+{
+    vs::prf::monitor profiler;
+    auto id = vs::prf::register_scope("test_thread_work");
+
+    /* buffers of all threads are summed into the frame */
+    for(int frame = 0; frame < 2; frame++)
+    {
+        profiler.start_frame();
+        on_threads(4, [&](int t)
+        {
+            for(int i = 0; i <= t; i++) { profiler.add_time(id, 1ms); }
+        });
+        profiler.end_frame();
+    }
+
+    auto samples = profiler.get_samples();
+    ASSERT_EQ(profiler.frame_count(), 2);
+    ASSERT_EQ(samples["test_thread_work"].size(), 2u);
+    EXPECT_EQ(samples["test_thread_work"][0], std::chrono::duration_cast<vs::prf::duration>(10ms));
+    EXPECT_EQ(samples["test_thread_work"][1], std::chrono::duration_cast<vs::prf::duration>(10ms));
+
+    auto matrix = profiler.get_sample_matrix();
+    ASSERT_EQ(matrix.m_names, std::vector<std::string>{"test_thread_work"});
+    EXPECT_EQ(matrix.m_values, (std::vector<std::int64_t>{10000000, 10000000}));
+}
+
+TEST(profiler, many_monitors)
+{
+    /* more monitors than the per thread cache holds; nesting must survive the eviction of a monitor */
+    std::vector<std::unique_ptr<vs::prf::monitor>> monitors;
+    for(int i = 0; i < 12; i++) { monitors.push_back(std::make_unique<vs::prf::monitor>()); }
+
+    auto outer = vs::prf::register_scope("test_outer");
+    auto inner = vs::prf::register_scope("test_inner");
+    auto other = vs::prf::register_scope("test_other");
+
+    auto& profiler = *monitors.front();
+    profiler.enable_tracing(16);
+    {
+        vs::prf::cpu_sample sample_outer(outer, profiler);
+        for(auto& m : monitors) { vs::prf::cpu_sample sample_other(other, *m); }
+        vs::prf::cpu_sample sample_inner(inner, profiler);
+    }
+    profiler.end_frame();
+
+    auto tree = profiler.get_call_tree();
+    ASSERT_EQ(tree.m_children.size(), 1u);
+    const auto* node_outer = child(tree, "test_outer");
+    ASSERT_NE(node_outer, nullptr);
+    EXPECT_NE(child(*node_outer, "test_inner"), nullptr);
+    EXPECT_NE(child(*node_outer, "test_other"), nullptr);
+
+    /* still a single buffer (thread) for this monitor */
+    std::ostringstream trace;
+    profiler.write_chrome_trace(trace);
+
+    std::string text = trace.str();
+    std::size_t threads = 0;
+    for(auto pos = text.find("\"thread_name\""); pos != std::string::npos; pos = text.find("\"thread_name\"", pos + 1)) { threads++; }
+    EXPECT_EQ(threads, 1u);
+}
+
+TEST(profiler, counters)
+{
+    vs::prf::monitor profiler;
+    auto count = vs::prf::register_counter("test_count");
+    auto gauge = vs::prf::register_counter("test_gauge", vs::prf::counter_kind::gauge);
+    EXPECT_EQ(vs::prf::register_counter("test_count"), count);
+    EXPECT_EQ(vs::prf::counter_type(count), vs::prf::counter_kind::count);
+    EXPECT_EQ(vs::prf::counter_type(gauge), vs::prf::counter_kind::gauge);
+
+    /* counts are summed over threads and calls; a gauge keeps the last value set */
+    profiler.start_frame();
+    on_threads(3, [&](int) { profiler.add_count(count, 2); profiler.add_count(count, 3); });
+    profiler.set_gauge(gauge, 7);
+    profiler.set_gauge(gauge, 5);
+    profiler.end_frame();
+
+    /* a frame without events */
+    profiler.start_frame();
+    profiler.end_frame();
+
+    profiler.start_frame();
+    profiler.add_count(count, 1);
+    profiler.set_gauge(gauge, 9);
+    profiler.end_frame();
+
+    auto counters = profiler.get_counters();
+    EXPECT_EQ(counters["test_count"], (vs::prf::monitor::frame_counts{15, 0, 1}));
+    EXPECT_EQ(counters["test_gauge"], (vs::prf::monitor::frame_counts{5, 0, 9}));
+
+    profiler.reset();
+    EXPECT_EQ(profiler.frame_count(), 0);
+    EXPECT_TRUE(profiler.get_counters().empty());
+}
+
+TEST(profiler, level)
+{
+    vs::prf::monitor profiler;
+    auto frame = vs::prf::register_scope("test_level_frame");
+    auto scope = vs::prf::register_scope("test_level_scope");
+
+    auto record = [&]()
+    {
+        profiler.start_frame();
+        {
+            vs::prf::cpu_sample sample_frame(frame, profiler, vs::prf::level::frames);
+            vs::prf::cpu_sample sample_scope(scope, profiler, vs::prf::level::scopes);
+        }
+        profiler.end_frame();
+
+        auto samples = profiler.get_samples();
+        profiler.reset();
+        return std::make_pair(samples.count("test_level_frame"), samples.count("test_level_scope"));
+    };
+
+    profiler.set_level(vs::prf::level::off);
+    EXPECT_FALSE(profiler.is_active(vs::prf::level::frames));
+    EXPECT_EQ(record(), std::make_pair(std::size_t(0), std::size_t(0)));
+
+    profiler.set_level(vs::prf::level::frames);
+    EXPECT_TRUE(profiler.is_active(vs::prf::level::frames));
+    EXPECT_FALSE(profiler.is_active(vs::prf::level::scopes));
+    EXPECT_EQ(record(), std::make_pair(std::size_t(1), std::size_t(0)));
+
+    profiler.set_level(vs::prf::level::scopes);
+    EXPECT_EQ(record(), std::make_pair(std::size_t(1), std::size_t(1)));
+    EXPECT_FALSE(profiler.is_tracing());
+
+    profiler.set_level(vs::prf::level::tracing);
+    EXPECT_TRUE(profiler.is_tracing());
+    profiler.disable_tracing();
+    EXPECT_EQ(profiler.get_level(), vs::prf::level::scopes);
+}
+
+TEST(profiler, call_tree)
+{
+    vs::prf::monitor profiler;
+    auto a = vs::prf::register_scope("test_tree_a");
+    auto b = vs::prf::register_scope("test_tree_b");
+    auto c = vs::prf::register_scope("test_tree_c");
+
+    /* same paths of different threads are merged: a -> {b, c} */
+    profiler.start_frame();
+    on_threads(3, [&](int t)
+    {
+        vs::prf::cpu_sample sample_a(a, profiler);
+        vs::prf::cpu_sample sample_child(t == 2 ? c : b, profiler);
+        std::this_thread::sleep_for(1ms);
+    });
+    profiler.end_frame();
+
+    auto tree = profiler.get_call_tree();
+    EXPECT_EQ(tree.m_name, "");
+    ASSERT_EQ(tree.m_children.size(), 1u);
+
+    const auto& node_a = tree.m_children.front();
+    EXPECT_EQ(node_a.m_name, "test_tree_a");
+    ASSERT_EQ(node_a.m_children.size(), 2u);
+
+    const auto* node_b = child(node_a, "test_tree_b");
+    const auto* node_c = child(node_a, "test_tree_c");
+    ASSERT_NE(node_b, nullptr);
+    ASSERT_NE(node_c, nullptr);
+    EXPECT_TRUE(node_b->m_children.empty());
+
+    /* inclusive = exclusive + children; the root has no own time */
+    ASSERT_EQ(node_a.m_inclusive.size(), 1u);
+    EXPECT_EQ(node_a.m_inclusive[0], node_a.m_exclusive[0] + node_b->m_inclusive[0] + node_c->m_inclusive[0]);
+    EXPECT_EQ(tree.m_inclusive[0], node_a.m_inclusive[0]);
+    EXPECT_EQ(tree.m_exclusive[0], vs::prf::duration::zero());
+    EXPECT_GE(node_b->m_inclusive[0], std::chrono::duration_cast<vs::prf::duration>(2ms));
+    EXPECT_GE(node_c->m_inclusive[0], std::chrono::duration_cast<vs::prf::duration>(1ms));
+
+    /* the scope totals agree with the tree */
+    EXPECT_EQ(profiler.get_samples()["test_tree_a"][0], node_a.m_inclusive[0]);
+}
+
+TEST(profiler, trace)
+{
+    vs::prf::monitor profiler;
+    profiler.set_name("trace test");
+    auto outer = vs::prf::register_scope("test_trace_outer");
+    auto inner = vs::prf::register_scope("test_trace_inner");
+
+    /* ring buffer of 4 events per thread keeps the newest ones */
+    profiler.enable_tracing(4);
+    on_threads(2, [&](int)
+    {
+        for(int i = 0; i < 3; i++)
+        {
+            vs::prf::cpu_sample sample_outer(outer, profiler);
+            vs::prf::cpu_sample sample_inner(inner, profiler);
+        }
+    });
+    profiler.end_frame();
+
+    std::ostringstream trace;
+    profiler.write_chrome_trace(trace);
+
+    auto text = trace.str();
+    EXPECT_TRUE(json_checker{text}.check()) << text;
+    EXPECT_NE(text.find("\"trace test\""), std::string::npos);
+
+    std::size_t events = 0;
+    for(auto pos = text.find("\"ph\":\"X\""); pos != std::string::npos; pos = text.find("\"ph\":\"X\"", pos + 1)) { events++; }
+    EXPECT_EQ(events, 8u);
+
+    /* quotes, backslashes and control characters in monitor and scope names are escaped */
+    profiler.set_name("say \"hi\"\\\t");
+    auto quoted = vs::prf::register_scope("test_trace_\"quoted\"\\");
+    {
+        vs::prf::cpu_sample sample_quoted(quoted, profiler);
+    }
+    profiler.end_frame();
+
+    std::ostringstream escaped;
+    profiler.write_chrome_trace(escaped);
+    EXPECT_TRUE(json_checker{escaped.str()}.check()) << escaped.str();
+    EXPECT_NE(escaped.str().find(R"("say \"hi\"\\\t")"), std::string::npos);
+    EXPECT_NE(escaped.str().find(R"("test_trace_\"quoted\"\\")"), std::string::npos);
+
+    /* without tracing only the metadata of the monitor is written */
+    profiler.disable_tracing();
+    std::ostringstream empty;
+    profiler.write_chrome_trace(empty);
+    EXPECT_TRUE(json_checker{empty.str()}.check());
+    EXPECT_EQ(empty.str().find("\"ph\":\"X\""), std::string::npos);
+}
+
+TEST(profiler, allocations)
+{
+    if(!vs::prf::monitor::tracks_allocations || !vs::prf::has_allocation_hooks()) { GTEST_SKIP() << "allocation hooks are not linked (VS_PROFILER_ALLOC)"; }
+
+    vs::prf::monitor profiler;
+    auto outer = vs::prf::register_scope("test_alloc_outer");
+    auto inner = vs::prf::register_scope("test_alloc_inner");
+
+    std::vector<std::unique_ptr<std::array<char, 64>>> kept;
+    kept.reserve(8);
+
+    auto record = [&]()
+    {
+        vs::prf::cpu_sample sample_outer(outer, profiler);
+        kept.push_back(std::make_unique<std::array<char, 64>>());
+        {
+            vs::prf::cpu_sample sample_inner(inner, profiler);
+            for(int i = 0; i < 3; i++) { kept.push_back(std::make_unique<std::array<char, 64>>()); }
+        }
+    };
+
+    /* first pass creates the thread buffer and call tree nodes (allocations of the profiler itself) */
+    record();
+    profiler.reset();
+    kept.clear();
+
+    /* exclusive per scope: the inner allocations are not counted for the outer scope */
+    record();
+    profiler.end_frame();
+
+    auto allocs = profiler.get_allocations();
+    EXPECT_EQ(allocs["test_alloc_outer"].m_count, vs::prf::monitor::frame_counts{1});
+    EXPECT_EQ(allocs["test_alloc_outer"].m_bytes, vs::prf::monitor::frame_counts{64});
+    EXPECT_EQ(allocs["test_alloc_inner"].m_count, vs::prf::monitor::frame_counts{3});
+    EXPECT_EQ(allocs["test_alloc_inner"].m_bytes, vs::prf::monitor::frame_counts{192});
+
+    /* failed allocations call the new_handler until it is unset */
+    static int handler_calls = 0;
+    std::set_new_handler([]() { if(++handler_calls == 2) { std::set_new_handler(nullptr); } });
+    EXPECT_THROW(::operator delete(::operator new(std::numeric_limits<std::size_t>::max() / 2)), std::bad_alloc);
+    EXPECT_EQ(handler_calls, 2);
+    EXPECT_EQ(::operator new(std::numeric_limits<std::size_t>::max() / 2, std::nothrow), nullptr);
+}
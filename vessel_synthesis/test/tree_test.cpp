@@ -2,6 +2,11 @@
 #include <gmock/gmock.h>
 
 #include <vessel_synthesis/binarytree.h>
+#include <vessel_synthesis/domain.h>
+#include <vessel_synthesis/sdf.h>
+#include <vessel_synthesis/synthesizer.h>
+
+#include <set>
 
 TEST(binary_tree, create_node)
 {
@@ -206,8 +211,6 @@ TEST(binary_tree, custom_data)
 
 
 
-#include <vessel_synthesis/domain.h>
-#include <vessel_synthesis/synthesizer.h>
 TEST(synthesis, test)
 {
     vs::domain_sphere sphere({0.0, 0.0, 0.0}, 0.5);
@@ -225,3 +228,126 @@ TEST(synthesis, test)
     synth.get_settings().scale(1.5f);
     synth2.run();
 }
+
+TEST(synthesis, boundary)
+{
+    vs::domain_sphere sphere({0.0, 0.0, 0.0}, 0.5);
+
+    vs::synthesizer synth(sphere);
+    synth.create_root(vs::system::arterial, {0.45, 0.0, 0.0});
+    synth.get_settings().scale(1.5f);
+    synth.get_settings().m_steps = 50;
+    synth.get_settings().m_boundary.m_mode = vs::boundary::deflect;
+    synth.run();
+
+    auto forest = synth.get_forest(vs::system::arterial);
+    vs::util::sdf_grid sdf(sphere, 64);
+    forest.breadth_first([&](auto& t, auto& node)
+    {
+        if(!node.is_root()) { EXPECT_LE(sdf.distance(node.data().m_pos), 0.0f); }
+    });
+}
+
+TEST(synthesis, boundary_domain_change)
+{
+    /* slab x < 0.3 that is extended to x < 1 after the first run; the far corner keeps the extends (oc-trees) fixed */
+    vs::domain_sparse_voxels slab({0.0, 0.0, 0.0}, {0.1, 0.1, 0.1});
+    auto fill = [&slab](int max_x)
+    {
+        for(int x = 0; x < max_x; x++)
+            for(int y = 0; y < 10; y++)
+                for(int z = 0; z < 10; z++) { slab.activate(glm::ivec3{x, y, z}); }
+    };
+    fill(3);
+    slab.activate(glm::ivec3{9, 9, 9});
+
+    vs::synthesizer synth(slab);
+    synth.create_root(vs::system::arterial, {0.05, 0.5, 0.5});
+    synth.get_settings().scale(2.0f);
+    synth.get_settings().m_steps = 30;
+    synth.get_settings().m_boundary.m_mode = vs::boundary::reject;
+    synth.run();
+
+    auto max_x = [&synth]()
+    {
+        float x = 0.0f;
+        auto forest = synth.get_forest(vs::system::arterial);
+        forest.breadth_first([&](auto&, auto& node) { x = std::max(x, node.data().m_pos.x); });
+        return x;
+    };
+    EXPECT_LT(max_x(), 0.3f);
+
+    /* the signed distance grid follows the domain, growth is no longer rejected beyond the old slab */
+    fill(10);
+    synth.get_settings().m_steps = 60;
+    synth.run();
+    EXPECT_GT(max_x(), 0.4f);
+}
+
+TEST(synthesis, forest_snapshot)
+{
+    vs::domain_sphere sphere({0.0, 0.0, 0.0}, 0.5);
+
+    vs::synthesizer synth(sphere);
+    synth.create_root(vs::system::arterial, {0.45, 0.0, 0.0});
+    synth.get_settings().scale(1.5f);
+    synth.get_settings().m_steps = 30;
+    synth.run();
+
+    /*=======================================================*/
+    auto arrays = synth.get_arrays(vs::system::arterial);
+    EXPECT_EQ(arrays, synth.get_arrays(vs::system::arterial));
+    /*=======================================================*/
+
+    /*=======================================================*/
+    std::vector<std::uint8_t> mask(arrays->size(), 0);
+    mask[1] = 1;
+    auto deleted = synth.delete_where(vs::system::arterial, mask.data(), mask.size());
+
+    auto pruned = synth.get_arrays(vs::system::arterial);
+    EXPECT_NE(arrays, pruned);
+    EXPECT_GT(deleted, 0);
+    EXPECT_EQ(pruned->size(), arrays->size() - deleted);
+    /*=======================================================*/
+
+    /*=======================================================*/
+    /* the node search only refers to nodes that still exist */
+    auto& data = synth.get_system_data(vs::system::arterial);
+
+    std::set<const vs::synthesizer::tree::node*> nodes;
+    data.m_forest.breadth_first([&](auto&, auto& n){ nodes.insert(&n); });
+
+    std::vector<vs::synthesizer::tree::node*> indexed;
+    data.m_node_search.euclidean_range({0.0f, 0.0f, 0.0f}, 2.0f, indexed);
+    EXPECT_EQ(indexed.size(), data.m_node_search.size());
+    for(auto* n : indexed) { EXPECT_TRUE(nodes.count(n)); }
+    /*=======================================================*/
+}
+
+TEST(synthesis, step_callback)
+{
+    vs::domain_sphere sphere({0.0, 0.0, 0.0}, 0.5);
+
+    vs::synthesizer synth(sphere);
+    synth.create_root(vs::system::arterial, {0.45, 0.0, 0.0});
+    synth.get_settings().scale(1.5f);
+    synth.get_settings().m_steps = 30;
+
+    std::size_t created = 0;
+    unsigned int steps = 0;
+    synth.set_step_callback([&](unsigned int step, const auto& arterial, const auto& venous)
+    {
+        created += arterial.m_new_ids.size();
+        steps = step;
+
+        EXPECT_EQ(arterial.m_new_positions.size(), arterial.m_new_ids.size());
+        EXPECT_EQ(arterial.m_radius_ids.size(), arterial.m_radii.size());
+        EXPECT_TRUE(venous.m_new_ids.empty());
+    });
+    synth.run();
+
+    /*=======================================================*/
+    EXPECT_EQ(steps, 30);
+    EXPECT_EQ(created + 1, synth.get_forest(vs::system::arterial).trees().front().size());
+    /*=======================================================*/
+}
@@ -0,0 +1,261 @@
+#include "vtp.h"
+
+#include "arrays.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+#ifdef VS_ZLIB
+#include <zlib.h>
+#endif
+
+namespace vs
+{
+
+namespace
+{
+
+constexpr std::size_t block_size = 1 << 16;
+
+/*
+ * one array of the appended data section, filled in chunks
+ * -> raw: uint64 byte count followed by the data
+ * -> compressed: uint64 header (block count, block size, size of the last partial block, compressed size per block)
+ *    followed by the compressed blocks; the header is written as placeholder and patched in finish()
+ */
+class array_writer
+{
+public:
+    array_writer(std::ofstream& out, std::size_t size, const vtp_settings& settings)
+        : m_out(out), m_begin(out.tellp()), m_compress(settings.m_compress), m_level(settings.m_level)
+    {
+        if(m_compress)
+        {
+            auto blocks = (size + block_size - 1) / block_size;
+            m_header.assign(3 + blocks, 0);
+            m_header[0] = blocks;
+            m_header[1] = block_size;
+            m_header[2] = size % block_size;
+            m_block.reserve(block_size);
+        }
+        else
+        {
+            m_header.assign(1, size);
+        }
+        write_header();
+    }
+
+    template<typename T>
+    void append(const std::vector<T>& values)
+    {
+        const auto* data = reinterpret_cast<const char*>(values.data());
+        std::size_t bytes = values.size() * sizeof(T);
+
+        if(!m_compress)
+        {
+            m_out.write(data, static_cast<std::streamsize>(bytes));
+            return;
+        }
+
+        while(bytes > 0)
+        {
+            auto count = std::min(bytes, block_size - m_block.size());
+            m_block.insert(m_block.end(), data, data + count);
+            data += count;
+            bytes -= count;
+
+            if(m_block.size() == block_size) { compress_block(); }
+        }
+    }
+
+    void finish()
+    {
+        if(!m_compress) { return; }
+        if(!m_block.empty()) { compress_block(); }
+
+        auto end = m_out.tellp();
+        m_out.seekp(m_begin);
+        write_header();
+        m_out.seekp(end);
+    }
+
+private:
+    void write_header()
+    {
+        m_out.write(reinterpret_cast<const char*>(m_header.data()), static_cast<std::streamsize>(m_header.size() * sizeof(std::uint64_t)));
+    }
+
+    void compress_block()
+    {
+#ifdef VS_ZLIB
+        auto bound = compressBound(static_cast<uLong>(m_block.size()));
+        m_compressed.resize(bound);
+
+        auto size = static_cast<uLongf>(bound);
+        if(compress2(reinterpret_cast<Bytef*>(m_compressed.data()), &size, reinterpret_cast<const Bytef*>(m_block.data()),
+                     static_cast<uLong>(m_block.size()), m_level) != Z_OK)
+        {
+            m_out.setstate(std::ios::failbit);
+        }
+
+        m_header[3 + m_blocks++] = size;
+        m_out.write(m_compressed.data(), static_cast<std::streamsize>(size));
+#endif
+        m_block.clear();
+    }
+
+    std::ofstream& m_out;
+    std::streampos m_begin;
+    bool m_compress;
+    int m_level;
+
+    std::vector<std::uint64_t> m_header;
+    std::vector<char> m_block;
+    std::vector<char> m_compressed;
+    std::size_t m_blocks{0};
+};
+
+/* digits of the offset attributes; patched once the sizes of the (compressed) arrays are known */
+constexpr int offset_digits = 20;
+
+void write_offset(std::ofstream& out, std::uint64_t offset)
+{
+    char text[offset_digits + 1];
+    std::snprintf(text, sizeof(text), "%020llu", static_cast<unsigned long long>(offset));
+    out.write(text, offset_digits);
+}
+
+bool write_trees(const std::string& path, const std::vector<const binary_tree<node_data>*>& trees, const vtp_settings& settings)
+{
+    if(settings.m_compress && !vtp_compression_available()) { throw std::invalid_argument("library was built without zlib, vtp compression is not available"); }
+    if(settings.m_compress && (settings.m_level < 1 || settings.m_level > 9)) { throw std::invalid_argument("compression level must be in [1, 9]"); }
+
+    std::ofstream out(path, std::ios::binary);
+    if(!out) { return false; }
+
+    std::vector<std::size_t> pieces;
+    for(std::size_t t = 0; t < trees.size(); t++)
+    {
+        if(trees[t]->size() > 0) { pieces.push_back(t); }
+    }
+
+    /* header; the position of every offset attribute is kept for patching */
+    std::vector<std::streampos> placeholders;
+    auto data_array = [&](const char* type, const char* name, int components)
+    {
+        out << "        <DataArray type=\"" << type << "\" Name=\"" << name << "\"";
+        if(components > 1) { out << " NumberOfComponents=\"" << components << "\""; }
+        out << " format=\"appended\" offset=\"";
+        placeholders.push_back(out.tellp());
+        write_offset(out, 0);
+        out << "\"/>\n";
+    };
+
+    constexpr bool little = (std::endian::native == std::endian::little);
+    out << "<?xml version=\"1.0\"?>\n"
+        << "<VTKFile type=\"PolyData\" version=\"1.0\" byte_order=\"" << (little ? "LittleEndian" : "BigEndian") << "\" header_type=\"UInt64\""
+        << (settings.m_compress ? " compressor=\"vtkZLibDataCompressor\"" : "") << ">\n"
+        << "  <PolyData>\n";
+    for(auto t : pieces)
+    {
+        out << "    <Piece NumberOfPoints=\"" << trees[t]->size() << "\" NumberOfVerts=\"0\" NumberOfLines=\"" << trees[t]->size() - 1
+            << "\" NumberOfStrips=\"0\" NumberOfPolys=\"0\">\n"
+            << "      <PointData Scalars=\"radius\">\n";
+        data_array("Float32", "radius", 1);
+        data_array("Int32", "tree_id", 1);
+        data_array("UInt8", "node_type", 1);
+        out << "      </PointData>\n"
+            << "      <Points>\n";
+        data_array("Float32", "points", 3);
+        out << "      </Points>\n"
+            << "      <Lines>\n";
+        data_array("Int64", "connectivity", 1);
+        data_array("Int64", "offsets", 1);
+        out << "      </Lines>\n"
+            << "    </Piece>\n";
+    }
+    if(pieces.empty()) { out << "    <Piece NumberOfPoints=\"0\" NumberOfVerts=\"0\" NumberOfLines=\"0\" NumberOfStrips=\"0\" NumberOfPolys=\"0\"/>\n"; }
+    out << "  </PolyData>\n"
+        << "  <AppendedData encoding=\"raw\">\n"
+        << "   _";
+
+    /* arrays in the order of the header; the arrays of a tree are built once and written as its piece */
+    const auto appended = out.tellp();
+    std::vector<std::uint64_t> offsets;
+
+    auto write_array = [&](const auto& values)
+    {
+        offsets.push_back(static_cast<std::uint64_t>(out.tellp() - appended));
+
+        array_writer writer(out, values.size() * sizeof(values[0]), settings);
+        writer.append(values);
+        writer.finish();
+    };
+
+    std::vector<std::int32_t> ids;
+    std::vector<std::int64_t> connectivity, cell_offsets;
+    for(auto t : pieces)
+    {
+        auto arrays = to_arrays(*trees[t]);
+        const auto segments = arrays.size() - 1;
+
+        ids.assign(arrays.size(), static_cast<std::int32_t>(t));
+
+        connectivity.clear();
+        cell_offsets.clear();
+        for(std::size_t i = 1; i < arrays.size(); i++)
+        {
+            connectivity.push_back(arrays.m_parents[i]);
+            connectivity.push_back(static_cast<std::int64_t>(i));
+        }
+        for(std::size_t s = 0; s < segments; s++) { cell_offsets.push_back(2 * static_cast<std::int64_t>(s + 1)); }
+
+        write_array(arrays.m_radii);
+        write_array(ids);
+        write_array(arrays.m_types);
+        write_array(arrays.m_positions);
+        write_array(connectivity);
+        write_array(cell_offsets);
+    }
+
+    out << "\n  </AppendedData>\n"
+        << "</VTKFile>\n";
+
+    for(std::size_t i = 0; i < offsets.size(); i++)
+    {
+        out.seekp(placeholders[i]);
+        write_offset(out, offsets[i]);
+    }
+
+    return static_cast<bool>(out);
+}
+
+}
+
+bool vtp_compression_available()
+{
+#ifdef VS_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool write_vtp(const std::string& path, const binary_tree<node_data>& tree, const vtp_settings& settings)
+{
+    return write_trees(path, {&tree}, settings);
+}
+
+bool write_vtp(const std::string& path, const forest<node_data>& trees, const vtp_settings& settings)
+{
+    std::vector<const binary_tree<node_data>*> list;
+    for(const auto& tree : trees.trees()) { list.push_back(&tree); }
+    return write_trees(path, list, settings);
+}
+
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "binarytree.h"
+#include "forest.h"
+#include "points.h"
+
+#include <string>
+
+namespace vs
+{
+
+/*
+ * ******************** [vtp export] ********************
+ * -> VTK XML PolyData (.vtp) with raw appended binary data, readable by ParaView / vtkXMLPolyDataReader
+ *      - one piece per non empty tree (readers append the pieces to one poly data)
+ *      - points: node positions (breadth first, rows as in to_arrays())
+ *      - lines: one line cell (parent, node) per segment
+ *      - point data: radius (Float32), tree_id (Int32, index in the forest), node_type (UInt8, see node_type)
+ *
+ * -> streamed tree by tree: the arrays of a tree are built once and written as its piece, memory is bounded by
+ *    the largest tree, independent of the forest size
+ * -> m_compress: every array is split into blocks of 64 KiB that are compressed with zlib (vtkZLibDataCompressor);
+ *    only available if the library was built with zlib (VS_ZLIB, see vtp_compression_available())
+ *
+ * write_vtp() returns false if the file can not be written; throws std::invalid_argument for unavailable
+ * compression or a level outside of [1, 9]
+ */
+struct vtp_settings
+{
+    bool m_compress{false};
+    int m_level{6};
+};
+
+bool vtp_compression_available();
+
+bool write_vtp(const std::string& path, const binary_tree<node_data>& tree, const vtp_settings& settings = {});
+bool write_vtp(const std::string& path, const forest<node_data>& trees, const vtp_settings& settings = {});
+
+}